@@ -0,0 +1,196 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavutil/avutil.h>
+#include <libavutil/buffer.h>
+
+#include "chunk_store.h"
+
+int chunk_store_create(ChunkStore **chunk_store)
+{
+  ChunkStore *store;
+
+  if (!(store = calloc(1, sizeof(ChunkStore))))
+  {
+    return AVERROR(ENOMEM);
+  }
+  pthread_mutex_init(&store->mutex, NULL);
+  pthread_cond_init(&store->cond, NULL);
+
+  *chunk_store = store;
+
+  return 0;
+}
+
+void chunk_store_free(ChunkStore **chunk_store)
+{
+  Chunk *chunk;
+  ChunkStore *store = *chunk_store;
+  if (store == NULL) return;
+
+  while ((chunk = store->head))
+  {
+    store->head = chunk->next;
+    av_buffer_unref(&chunk->buf);
+    free(chunk);
+  }
+  pthread_mutex_destroy(&store->mutex);
+  pthread_cond_destroy(&store->cond);
+  free(store);
+  *chunk_store = NULL;
+}
+
+static int64_t chunk_end(const Chunk *chunk)
+{
+  return chunk->offset + (int64_t)chunk->buf->size;
+}
+
+// drop the chunks every cursor is past, caller holds the mutex
+static void chunk_store_trim(ChunkStore *store)
+{
+  Chunk *chunk;
+  int64_t slowest = store->end;
+
+  if (!store->cursors) return;
+  for (ChunkCursor *c = store->cursors; c; c = c->next)
+  {
+    slowest = FFMIN(slowest, c->position);
+  }
+  while ((chunk = store->head) && chunk_end(chunk) <= slowest)
+  {
+    store->head = chunk->next;
+    if (!store->head) store->tail = NULL;
+    store->start = chunk_end(chunk);
+    store->bytes -= chunk->buf->size;
+    av_buffer_unref(&chunk->buf);
+    free(chunk);
+  }
+}
+
+int chunk_store_append(ChunkStore *chunk_store, AVBufferRef *buf)
+{
+  Chunk *chunk;
+
+  if (!(chunk = calloc(1, sizeof(Chunk))))
+  {
+    av_buffer_unref(&buf);
+    return AVERROR(ENOMEM);
+  }
+  chunk->buf = buf;
+
+  pthread_mutex_lock(&chunk_store->mutex);
+  chunk->offset = chunk_store->end;
+  if (chunk_store->tail) chunk_store->tail->next = chunk;
+  else chunk_store->head = chunk;
+  chunk_store->tail = chunk;
+  chunk_store->end += buf->size;
+  chunk_store->bytes += buf->size;
+  pthread_cond_broadcast(&chunk_store->cond);
+  pthread_mutex_unlock(&chunk_store->mutex);
+  return 0;
+}
+
+void chunk_store_done(ChunkStore *chunk_store)
+{
+  pthread_mutex_lock(&chunk_store->mutex);
+  chunk_store->is_done = 1;
+  pthread_cond_broadcast(&chunk_store->cond);
+  pthread_mutex_unlock(&chunk_store->mutex);
+}
+
+int chunk_store_open_cursor(ChunkStore *chunk_store, ChunkCursor **cursor)
+{
+  ChunkCursor *c;
+
+  if (!(c = calloc(1, sizeof(ChunkCursor))))
+  {
+    return AVERROR(ENOMEM);
+  }
+  c->store = chunk_store;
+
+  pthread_mutex_lock(&chunk_store->mutex);
+  c->position = chunk_store->start;
+  c->next = chunk_store->cursors;
+  chunk_store->cursors = c;
+  chunk_store->nb_cursors++;
+  pthread_mutex_unlock(&chunk_store->mutex);
+
+  *cursor = c;
+
+  return 0;
+}
+
+void chunk_store_close_cursor(ChunkCursor **cursor)
+{
+  ChunkCursor *c = *cursor;
+  ChunkStore *store;
+  if (c == NULL) return;
+  store = c->store;
+
+  pthread_mutex_lock(&store->mutex);
+  for (ChunkCursor **p = &store->cursors; *p; p = &(*p)->next)
+  {
+    if (*p == c)
+    {
+      *p = c->next;
+      store->nb_cursors--;
+      break;
+    }
+  }
+  chunk_store_trim(store);
+  pthread_mutex_unlock(&store->mutex);
+  free(c);
+  *cursor = NULL;
+}
+
+int chunk_store_read(ChunkCursor *cursor, uint8_t *buf, int size, volatile int *abort)
+{
+  int n;
+  int64_t offset;
+  Chunk *chunk;
+  AVBufferRef *ref;
+  ChunkStore *store = cursor->store;
+
+  pthread_mutex_lock(&store->mutex);
+  while (cursor->position == store->end && !store->is_done && !*abort)
+  {
+    pthread_cond_wait(&store->cond, &store->mutex);
+  }
+  if (*abort || cursor->position == store->end)
+  {
+    pthread_mutex_unlock(&store->mutex);
+    return *abort ? AVERROR_EXIT : AVERROR_EOF;
+  }
+  for (chunk = store->head; chunk_end(chunk) <= cursor->position; chunk = chunk->next);
+  // the chunk may be dropped by the trim below or another reader, the copy holds on to it
+  if (!(ref = av_buffer_ref(chunk->buf)))
+  {
+    pthread_mutex_unlock(&store->mutex);
+    return AVERROR(ENOMEM);
+  }
+  offset = cursor->position - chunk->offset;
+  n = FFMIN(size, (int)(ref->size - offset));
+  cursor->position += n;
+  chunk_store_trim(store);
+  pthread_mutex_unlock(&store->mutex);
+
+  memcpy(buf, ref->data + offset, n);
+  av_buffer_unref(&ref);
+  return n;
+}
+
+int64_t chunk_store_lag(ChunkCursor *cursor)
+{
+  int64_t lag;
+  pthread_mutex_lock(&cursor->store->mutex);
+  lag = cursor->store->end - cursor->position;
+  pthread_mutex_unlock(&cursor->store->mutex);
+  return lag;
+}
+
+void chunk_store_wake(ChunkStore *chunk_store)
+{
+  pthread_mutex_lock(&chunk_store->mutex);
+  pthread_cond_broadcast(&chunk_store->cond);
+  pthread_mutex_unlock(&chunk_store->mutex);
+}
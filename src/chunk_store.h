@@ -0,0 +1,72 @@
+#ifndef CHUNK_STORE_H
+#define CHUNK_STORE_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include <libavutil/buffer.h>
+
+// one write of the input, never modified once appended
+typedef struct Chunk
+{
+  AVBufferRef *buf;
+  // position of the first byte in the input
+  int64_t offset;
+  struct Chunk *next;
+} Chunk;
+
+struct ChunkStore;
+
+// where one consumer is in the input
+typedef struct ChunkCursor
+{
+  struct ChunkStore *store;
+  int64_t position;
+  struct ChunkCursor *next;
+} ChunkCursor;
+
+// an input written once and read by several consumers, each at its own cursor. chunks
+// are shared, not copied per consumer, and dropped once the slowest cursor is past
+// them, so memory follows how far the consumers lag rather than how many there are.
+// without any cursor nothing is dropped, the first consumer starts from the beginning.
+typedef struct ChunkStore
+{
+  Chunk *head;
+  Chunk *tail;
+  // input positions of the first byte held and of the end
+  int64_t start;
+  int64_t end;
+  long bytes;
+  ChunkCursor *cursors;
+  int nb_cursors;
+  int is_done;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+} ChunkStore;
+
+int chunk_store_create(ChunkStore **chunk_store);
+
+// every cursor must be closed before
+void chunk_store_free(ChunkStore **chunk_store);
+
+// append buf to the input, the store takes over the reference
+int chunk_store_append(ChunkStore *chunk_store, AVBufferRef *buf);
+
+// no more chunks, readers get AVERROR_EOF at the end
+void chunk_store_done(ChunkStore *chunk_store);
+
+// a cursor at the oldest byte still held
+int chunk_store_open_cursor(ChunkStore *chunk_store, ChunkCursor **cursor);
+
+void chunk_store_close_cursor(ChunkCursor **cursor);
+
+// copy up to size bytes at the cursor to buf and move on, waiting for data while there
+// is none. AVERROR_EOF at the end of a done input, AVERROR_EXIT once *abort is set
+int chunk_store_read(ChunkCursor *cursor, uint8_t *buf, int size, volatile int *abort);
+
+// bytes of the input the cursor has not read yet
+int64_t chunk_store_lag(ChunkCursor *cursor);
+
+// wake readers so they look at their abort flag again
+void chunk_store_wake(ChunkStore *chunk_store);
+#endif
@@ -0,0 +1,330 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <libavutil/avutil.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/time.h>
+#include <libswscale/swscale.h>
+
+#include "compositor.h"
+
+static void *ticker_run(void *arg);
+
+// the planes of the canvas at pixel (x, y), so a tile is scaled or cleared in place
+static void canvas_planes(Compositor *c, int x, int y, uint8_t *planes[4])
+{
+  const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(c->format);
+  for (int i = 0; i < 4; i++)
+  {
+    int ty = i == 1 || i == 2 ? y >> desc->log2_chroma_h : y;
+    planes[i] = c->data[i] ? c->data[i] + ty * c->line_size[i] + FFMAX(av_image_get_linesize(c->format, x, i), 0) : NULL;
+  }
+}
+
+static void clear_rect(Compositor *c, int x, int y, int width, int height)
+{
+  uint8_t *planes[4];
+  ptrdiff_t line_size[4];
+
+  canvas_planes(c, x, y, planes);
+  for (int i = 0; i < 4; i++)
+  {
+    line_size[i] = c->line_size[i];
+  }
+  av_image_fill_black(planes, line_size, c->format, AVCOL_RANGE_MPEG, width, height);
+}
+
+int compositor_create(Compositor **compositor, int width, int height, int format, int columns, int rows, int fps,
+                      ThreadPool *pool, int priority, CompositorOutput output, void *opaque)
+{
+  int ret;
+  int tile_width, tile_height;
+  Compositor *c;
+
+  if (width <= 0 || height <= 0 || columns <= 0 || rows <= 0 || fps <= 0 || columns * rows > COMPOSITOR_MAX_TILES)
+  {
+    return AVERROR(EINVAL);
+  }
+  tile_width = width / columns & ~1;
+  tile_height = height / rows & ~1;
+  if (tile_width < 2 || tile_height < 2)
+  {
+    return AVERROR(EINVAL);
+  }
+  if (!(c = calloc(1, sizeof(Compositor))))
+  {
+    return AVERROR(ENOMEM);
+  }
+  c->width = width;
+  c->height = height;
+  c->format = format;
+  c->columns = columns;
+  c->rows = rows;
+  c->nb_tiles = columns * rows;
+  c->pool = pool;
+  c->priority = priority;
+  c->interval = 1000000 / fps;
+  c->output = output;
+  c->opaque = opaque;
+  for (int i = 0; i < c->nb_tiles; i++)
+  {
+    c->tiles[i].x = i % columns * tile_width;
+    c->tiles[i].y = i / columns * tile_height;
+    c->tiles[i].width = tile_width;
+    c->tiles[i].height = tile_height;
+  }
+
+  if ((ret = av_image_alloc(c->data, c->line_size, width, height, format, 1)) < 0)
+  {
+    fprintf(stderr, "Could not allocate %dx%d canvas\n", width, height);
+    free(c);
+    return ret;
+  }
+  c->size = ret;
+  clear_rect(c, 0, 0, width, height);
+
+  pthread_mutex_init(&c->mutex, NULL);
+  pthread_cond_init(&c->cond, NULL);
+  if (pthread_create(&c->ticker, NULL, &ticker_run, c) != 0)
+  {
+    fprintf(stderr, "Could not start compositor thread\n");
+    pthread_mutex_destroy(&c->mutex);
+    pthread_cond_destroy(&c->cond);
+    av_freep(&c->data[0]);
+    free(c);
+    return AVERROR(EAGAIN);
+  }
+
+  *compositor = c;
+
+  return 0;
+}
+
+int compositor_stop(Compositor *compositor, int timeout_ms)
+{
+  int ret = 0;
+  struct timespec deadline;
+  Compositor *c = compositor;
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += timeout_ms / 1000;
+  deadline.tv_nsec += (timeout_ms % 1000) * 1000000;
+  if (deadline.tv_nsec >= 1000000000)
+  {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000;
+  }
+
+  pthread_mutex_lock(&c->mutex);
+  c->quit = 1;
+  pthread_cond_broadcast(&c->cond);
+  while (!c->exited && ret == 0)
+  {
+    if (pthread_cond_timedwait(&c->cond, &c->mutex, &deadline) != 0) ret = c->exited ? 0 : AVERROR(ETIMEDOUT);
+  }
+  pthread_mutex_unlock(&c->mutex);
+  return ret;
+}
+
+void compositor_free(Compositor **compositor)
+{
+  Compositor *c = *compositor;
+  if (c == NULL) return;
+
+  pthread_mutex_lock(&c->mutex);
+  c->quit = 1;
+  pthread_cond_broadcast(&c->cond);
+  pthread_mutex_unlock(&c->mutex);
+  pthread_join(c->ticker, NULL);
+
+  for (int i = 0; i < c->nb_tiles; i++)
+  {
+    av_frame_free(&c->tiles[i].pending);
+    av_frame_free(&c->tiles[i].current);
+    sws_freeContext(c->tiles[i].sws);
+  }
+  av_freep(&c->data[0]);
+  pthread_mutex_destroy(&c->mutex);
+  pthread_cond_destroy(&c->cond);
+  free(c);
+  *compositor = NULL;
+}
+
+int compositor_attach(Compositor *compositor, int tile)
+{
+  int ret = 0;
+  CompositorTile *t;
+
+  if (tile < 0 || tile >= compositor->nb_tiles) return AVERROR(EINVAL);
+  t = &compositor->tiles[tile];
+
+  pthread_mutex_lock(&compositor->mutex);
+  if (t->attached)
+  {
+    ret = AVERROR(EBUSY);
+  }
+  else
+  {
+    t->attached = 1;
+    t->composed = t->dropped = t->repeated = 0;
+  }
+  pthread_mutex_unlock(&compositor->mutex);
+  return ret;
+}
+
+void compositor_detach(Compositor *compositor, int tile)
+{
+  if (tile < 0 || tile >= compositor->nb_tiles) return;
+
+  pthread_mutex_lock(&compositor->mutex);
+  compositor->tiles[tile].attached = 0;
+  av_frame_free(&compositor->tiles[tile].pending);
+  pthread_mutex_unlock(&compositor->mutex);
+}
+
+int compositor_busy(Compositor *compositor)
+{
+  int busy = 0;
+
+  pthread_mutex_lock(&compositor->mutex);
+  for (int i = 0; i < compositor->nb_tiles; i++)
+  {
+    busy |= compositor->tiles[i].attached;
+  }
+  pthread_mutex_unlock(&compositor->mutex);
+  return busy;
+}
+
+int compositor_submit(Compositor *compositor, int tile, const AVFrame *frame)
+{
+  AVFrame *ref;
+  CompositorTile *t;
+
+  if (tile < 0 || tile >= compositor->nb_tiles) return AVERROR(EINVAL);
+  t = &compositor->tiles[tile];
+
+  // a reference, not a copy, the input's thread gets straight back to decoding
+  if (!(ref = av_frame_clone(frame)))
+  {
+    return AVERROR(ENOMEM);
+  }
+  pthread_mutex_lock(&compositor->mutex);
+  if (t->pending)
+  {
+    av_frame_free(&t->pending);
+    t->dropped++;
+  }
+  t->pending = ref;
+  pthread_mutex_unlock(&compositor->mutex);
+  return 0;
+}
+
+// scale the tile's new frame into its rectangle, letterboxed to keep the aspect ratio
+static int compose_tile(Compositor *c, CompositorTile *t)
+{
+  int width = t->width;
+  int height = t->height;
+  uint8_t *planes[4];
+  const AVFrame *frame = t->current;
+
+  if ((int64_t)frame->width * t->height > (int64_t)frame->height * t->width)
+  {
+    height = FFMAX(2, (int)((int64_t)t->width * frame->height / frame->width) & ~1);
+  }
+  else
+  {
+    width = FFMAX(2, (int)((int64_t)t->height * frame->width / frame->height) & ~1);
+  }
+  if (frame->width != t->source_width || frame->height != t->source_height)
+  {
+    clear_rect(c, t->x, t->y, t->width, t->height);
+    t->source_width = frame->width;
+    t->source_height = frame->height;
+  }
+
+  if (!(t->sws = sws_getCachedContext(t->sws, frame->width, frame->height, frame->format,
+                                      width, height, c->format, SWS_BILINEAR, NULL, NULL, NULL)))
+  {
+    fprintf(stderr, "Could not create scale context for a %dx%d tile!\n", width, height);
+    return AVERROR(EINVAL);
+  }
+  canvas_planes(c, t->x + ((t->width - width) / 2 & ~1), t->y + ((t->height - height) / 2 & ~1), planes);
+  sws_scale(t->sws, (const uint8_t * const *)frame->data, frame->linesize, 0, frame->height, planes, c->line_size);
+  return 0;
+}
+
+static void compose_job(void *arg, int index)
+{
+  Compositor *c = arg;
+  CompositorTile *t = &c->tiles[index];
+
+  if (!t->current) return;
+  t->ret = compose_tile(c, t);
+  av_frame_free(&t->current);
+}
+
+static void *ticker_run(void *arg)
+{
+  Compositor *c = arg;
+  int64_t now;
+  int64_t next = av_gettime_relative();
+  struct timespec ts;
+
+  pthread_mutex_lock(&c->mutex);
+  while (!c->quit)
+  {
+    now = av_gettime_relative();
+    if (now < next)
+    {
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_sec += (next - now) / 1000000;
+      ts.tv_nsec += (next - now) % 1000000 * 1000;
+      if (ts.tv_nsec >= 1000000000)
+      {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+      }
+      pthread_cond_timedwait(&c->cond, &c->mutex, &ts);
+      continue;
+    }
+    // a ticker that fell behind skips the ticks it missed instead of bunching them up
+    next += c->interval;
+    if (next < now) next = now + c->interval;
+
+    for (int i = 0; i < c->nb_tiles; i++)
+    {
+      CompositorTile *t = &c->tiles[i];
+      if (t->pending)
+      {
+        t->current = t->pending;
+        t->pending = NULL;
+        t->composed++;
+      }
+      else if (t->attached)
+      {
+        t->repeated++;
+      }
+    }
+    pthread_mutex_unlock(&c->mutex);
+
+    thread_pool_run(c->pool, &compose_job, c, c->nb_tiles, c->priority);
+    for (int i = 0; i < c->nb_tiles; i++)
+    {
+      if (c->tiles[i].ret < 0)
+      {
+        fprintf(stderr, "Could not compose tile %d (%s)\n", i, av_err2str(c->tiles[i].ret));
+        c->tiles[i].ret = 0;
+      }
+    }
+    c->ticks++;
+    if (c->output) c->output(c->opaque, c->data[0], c->size, c->width, c->height);
+
+    pthread_mutex_lock(&c->mutex);
+  }
+  c->exited = 1;
+  pthread_cond_broadcast(&c->cond);
+  pthread_mutex_unlock(&c->mutex);
+  return NULL;
+}
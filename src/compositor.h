@@ -0,0 +1,99 @@
+#ifndef COMPOSITOR_H
+#define COMPOSITOR_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include <libavutil/frame.h>
+
+#include "thread_pool.h"
+
+// tiles one composed frame holds at most, a 5 x 5 wall
+#define COMPOSITOR_MAX_TILES 25
+
+struct SwsContext;
+
+// one input's place on the wall
+typedef struct CompositorTile
+{
+  // rectangle of the canvas, even so chroma planes of neighbours never share a byte
+  int x;
+  int y;
+  int width;
+  int height;
+  // newest frame handed over by the input and not composed yet, NULL when none
+  AVFrame *pending;
+  // frame being scaled by the current tick, only touched by the ticker
+  AVFrame *current;
+  struct SwsContext *sws;
+  // geometry of the last frame scaled, the letterbox is cleared when it changes
+  int source_width;
+  int source_height;
+  int attached;
+  // frames composed, replaced by a newer one before a tick took them, and ticks that
+  // found no new frame and showed the previous one again
+  long composed;
+  long dropped;
+  long repeated;
+  int ret;
+} CompositorTile;
+
+// called from the ticker with the composed canvas, one contiguous image of size bytes
+typedef void (*CompositorOutput)(void *opaque, uint8_t *data, long size, int width, int height);
+
+// composes the frames of several inputs into one canvas of columns x rows tiles. inputs
+// hand over frames from their own threads and never wait: a tile keeps only its newest
+// frame, so an input that falls behind or bursts drops frames instead of holding up the
+// wall. every tick the tiles with a new frame are scaled into the canvas on the pool,
+// one job per tile, and the canvas goes to output.
+typedef struct Compositor
+{
+  int width;
+  int height;
+  int format;
+  int columns;
+  int rows;
+  CompositorTile tiles[COMPOSITOR_MAX_TILES];
+  int nb_tiles;
+  uint8_t *data[4];
+  int line_size[4];
+  long size;
+
+  ThreadPool *pool;
+  int priority;
+  // tick period in microseconds
+  int64_t interval;
+  CompositorOutput output;
+  void *opaque;
+  long ticks;
+
+  pthread_t ticker;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  int quit;
+  int exited;
+} Compositor;
+
+// starts ticking fps times a second. the canvas is width x height of format and
+// black until the inputs deliver
+int compositor_create(Compositor **compositor, int width, int height, int format, int columns, int rows, int fps,
+                      ThreadPool *pool, int priority, CompositorOutput output, void *opaque);
+
+// stops the ticker and frees, once compositor_stop returned 0
+void compositor_free(Compositor **compositor);
+
+// ask the ticker to stop and wait for it up to timeout_ms, AVERROR(ETIMEDOUT) when it did not
+int compositor_stop(Compositor *compositor, int timeout_ms);
+
+// reserve tile for one input, AVERROR(EBUSY) when another input has it
+int compositor_attach(Compositor *compositor, int tile);
+
+// release tile, its last image stays on the canvas
+void compositor_detach(Compositor *compositor, int tile);
+
+// hand frame over to tile, a reference is kept until the next tick
+int compositor_submit(Compositor *compositor, int tile, const AVFrame *frame);
+
+// 1 when any tile is still attached
+int compositor_busy(Compositor *compositor);
+#endif
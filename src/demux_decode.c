@@ -1,5 +1,9 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <malloc.h>
+#include <math.h>
 #include <pthread.h>
 
 #include <emscripten.h>
@@ -10,51 +14,439 @@
 #include <libavformat/avio.h>
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
+#include <libavcodec/bsf.h>
 
 
 #include "memory_stream.h"
+#include "image_pool.h"
+#include "remux.h"
+#include "packet_batch.h"
+#include "filter_graph.h"
+#include "rendition_ladder.h"
+#include "thread_pool.h"
+#include "frame_cache.h"
+#include "thumbnailer.h"
+#include "compositor.h"
+#include "timeshift.h"
+#include "chunk_store.h"
+#include "segment_demuxer.h"
+#include "jitter_buffer.h"
+#include "ts_filter.h"
 
 #define IO_BUFFER_SIZE (MEMORY_PAGE * 3)
 #define STORE_SIZE (MEMORY_PAGE * 10)
 
+// video packets held back while audio is short, decoded once it caught up
+#define VIDEO_DEFER_MAX 32
+
+// default for how far ahead of the clock a paced session decodes
+#define DECODE_AHEAD_MS 500
+// longest sleep of a paced session before it looks at the clock again
+#define PACE_POLL_MS 10
+
+// playback rates from which video decodes without non-reference frames, and keyframes only
+#define TRICK_NONREF_RATE 2
+#define TRICK_KEYFRAME_RATE 4
+// decoded frames a reverse pass holds at most, and the memory they may take by default
+#define REVERSE_MAX_FRAMES 256
+#define REVERSE_BUFFER_SIZE (64 * 1024 * 1024)
+
+// dd_set_thumbnails defaults
+#define THUMBNAIL_INTERVAL_MS 10000
+#define THUMBNAIL_WIDTH 160
+#define THUMBNAIL_QUALITY 5
+
+// max idle sessions kept warm for the next open_dd
+#define POOL_SIZE 4
+
+// how long close_dd and drain_dd_pool wait for a session thread to stop
+#define CLOSE_TIMEOUT_MS 500
+#define CLOSE_POLL_MS 5
+
+typedef void (*VideoFrameParsedCallback)(uint8_t *ptr, long size, long width, long height);
+typedef void (*AudioFrameParsedCallback)(uint8_t *ptr, long size);
+// pts and duration in ms of stream time, pts is NaN when unknown
+typedef void (*TimedVideoFrameParsedCallback)(uint8_t *ptr, long size, long width, long height, double pts, double duration);
+typedef void (*TimedAudioFrameParsedCallback)(uint8_t *ptr, long size, double pts, double duration);
+typedef void (*SegmentParsedCallback)(uint8_t *ptr, long size, int is_init);
+// index is the one dd_add_rendition returned
+typedef void (*RenditionFrameParsedCallback)(int index, uint8_t *ptr, long size, long width, long height);
+// count PacketRecords, their offsets point into payload
+typedef void (*PacketsParsedCallback)(PacketRecord *records, int count, uint8_t *payload, long size);
+// extradata is avcC/hvcC/AudioSpecificConfig as found in the container, arg0/arg1 as in StreamInfoCallback
+typedef void (*CodecConfigCallback)(int index, int type, const char *codec, uint8_t *extradata, long size, long arg0, long arg1);
+// index counts the images of the input, pts in ms is the one of its first thumbnail
+typedef void (*ThumbnailParsedCallback)(int index, uint8_t *ptr, long size, double pts);
+// the WebVTT map of all thumbnails, once at the end of the input
+typedef void (*ThumbnailMapCallback)(char *vtt, long size);
+
+// session events, fired on the main thread before the first frame they apply to
+enum SessionEvent {
+  // arg0 width, arg1 height, arg2 AVPixelFormat
+  DD_EVENT_VIDEO_FORMAT_CHANGED = 1,
+  // arg0 sample rate, arg1 channels, arg2 AVSampleFormat
+  DD_EVENT_AUDIO_FORMAT_CHANGED = 2,
+  // arg0 number of streams, dd_get_stream_info works from now on
+  DD_EVENT_STREAMS_READY = 3,
+  // arg0 AVMediaType, arg1 new stream index or -1 on failure, arg2 error code
+  DD_EVENT_TRACK_SWITCHED = 4,
+  // arg0 AVMediaType, arg1 0 when the filter graph was (re)built or the error that
+  // made the session drop it and pass frames unfiltered
+  DD_EVENT_FILTERS_CONFIGURED = 5,
+  // arg0 1 when the frame at the target came from the frame cache, arg1 error code
+  DD_EVENT_SEEKED = 6,
+  // arg0 playback rate in percent now in effect, arg1 error code of the change
+  DD_EVENT_RATE_CHANGED = 7,
+};
+
+typedef void (*SessionEventCallback)(int event, long arg0, long arg1, long arg2);
+
+// counters for dd_get_stat
+enum SessionStat {
+  // audio delivered ahead of the playback clock, in ms
+  DD_STAT_AUDIO_BUFFERED = 1,
+  // times the delivered audio ran out before the playback clock
+  DD_STAT_AUDIO_UNDERRUNS = 2,
+  // times it fell below the minimum audio buffer
+  DD_STAT_AUDIO_LOW = 3,
+  // video packets held back to get to audio sooner
+  DD_STAT_VIDEO_DEFERRED = 4,
+  // video packets decoded with non-reference frames skipped
+  DD_STAT_VIDEO_DEGRADED = 5,
+  // video frames dropped because they were late for the clock
+  DD_STAT_VIDEO_LATE = 6,
+  // dd_seek targets served from the frame cache, and those that had to be decoded
+  DD_STAT_CACHE_HITS = 7,
+  DD_STAT_CACHE_MISSES = 8,
+  // memory held by the frame cache, in KB
+  DD_STAT_CACHE_SIZE = 9,
+  // video packets not decoded at all because of the playback rate
+  DD_STAT_VIDEO_SKIPPED = 10,
+  // reverse passes that decoded a gop again because it did not fit the buffer
+  DD_STAT_REVERSE_REDECODES = 11,
+  // stream time in ms of the oldest and newest packet in the timeshift buffer
+  DD_STAT_TIMESHIFT_START = 12,
+  DD_STAT_TIMESHIFT_END = 13,
+  // memory held by the timeshift buffer, in KB
+  DD_STAT_TIMESHIFT_SIZE = 14,
+  // input of a shared ingest not read by the session yet, in KB
+  DD_STAT_INGEST_LAG = 15,
+  // delay of the jitter buffer in ms, and packets that arrived later than it
+  DD_STAT_JITTER_DELAY = 16,
+  DD_STAT_JITTER_LATE = 17,
+  // packets the jitter buffer put back in dts order, and timestamp jumps it rebased
+  DD_STAT_JITTER_REORDERED = 18,
+  DD_STAT_DISCONTINUITIES = 19,
+  // ts packets written that the ts filter passed on to the store, and those it dropped
+  DD_STAT_TS_KEPT = 20,
+  DD_STAT_TS_DROPPED = 21,
+};
+
+// dd_set_pacing clocks
+enum SessionClock {
+  // frames go out as fast as they decode
+  DD_CLOCK_NONE = 0,
+  // the audio playback position, see dd_set_audio_clock, wall clock until audio starts
+  DD_CLOCK_AUDIO = 1,
+  // real time from the first packet
+  DD_CLOCK_WALL = 2,
+};
+
+// counters for dd_get_wall_stat, per tile
+enum WallStat {
+  // frames of the input that made it onto the wall
+  DD_WALL_STAT_COMPOSED = 1,
+  // frames replaced by a newer one of the same input before a tick took them
+  DD_WALL_STAT_DROPPED = 2,
+  // ticks that found no new frame of the input and showed its previous one again
+  DD_WALL_STAT_REPEATED = 3,
+};
+
+// a compositor and where its composed frames go, see dd_open_wall
+typedef struct VideoWall {
+  Compositor *compositor;
+  VideoFrameParsedCallback fireFrameComposed;
+  // set by dd_close_wall, composed frames are no longer handed to the callback
+  volatile int closing;
+} VideoWall;
+
+// arg0/arg1 are width/height for video and sample rate/channels for audio
+typedef void (*StreamInfoCallback)(int index, int type, const char *codec, const char *language, const char *title, long arg0, long arg1, int active);
+
+// what the consumer may learn about a stream, copied out of the format context
+typedef struct StreamInfo {
+  int type;
+  char codec[32];
+  char language[16];
+  char title[64];
+  long arg0;
+  long arg1;
+  int active;
+} StreamInfo;
+
+// open_dd flags. tracks a session demuxes and decodes, none set means all of them
+enum SessionTrack {
+  DD_TRACK_VIDEO = 1 << 0,
+  DD_TRACK_AUDIO = 1 << 1,
+};
+
+// open_dd flags. what the session does with the selected tracks, decoding by default
+enum SessionMode {
+  // no decoders, packets are remuxed to fragmented mp4 segments for mse
+  DD_MODE_REMUX = 1 << 8,
+  // no decoders, compressed packets are handed over in batches for an external decoder
+  DD_MODE_PACKETS = 1 << 9,
+  // video only, keyframes near every interval are encoded to thumbnails, see dd_set_thumbnails
+  DD_MODE_THUMBNAILS = 1 << 10,
+};
+
+// open_dd flags. where the input comes from, write_dd by default
+enum SessionInput {
+  // hls or dash segments handed over one by one with dd_write_segment, read like a stream
+  DD_INPUT_SEGMENTS = 1 << 16,
+};
+
+// dd_write_segment flags, from the playlist
+enum SegmentFlag {
+  // EXT-X-MAP or dash initialization, read before every media segment after it
+  DD_SEGMENT_INIT = SEGMENT_INIT,
+  // EXT-X-DISCONTINUITY, timestamps start over with this segment
+  DD_SEGMENT_DISCONTINUITY = SEGMENT_DISCONTINUITY,
+};
+
+// dd_set_priority levels, how a session's jobs rank on the shared thread pool
+enum SessionPriority {
+  DD_PRIORITY_LOW = THREAD_POOL_PRIORITY_LOW,
+  DD_PRIORITY_NORMAL = THREAD_POOL_PRIORITY_NORMAL,
+  DD_PRIORITY_HIGH = THREAD_POOL_PRIORITY_HIGH,
+};
+
+typedef struct Session {
+  // avio
+  uint8_t *io_buffer;
+  AVIOContext *io_ctx;
+  MemoryStream *store;
+  // where the session reads a shared ingest instead of store, NULL when it does not
+  ChunkCursor *ingest;
+  // segments of a DD_INPUT_SEGMENTS input, kept across inputs
+  SegmentDemuxer *segments;
+  int segment_input;
+  // drops the ts packets of unselected programs in write_dd, NULL when off
+  TsFilter *ts_filter;
+
+  // format & decode
+  AVPacket *pkt;
+  AVFrame *frame;
+  AVStream *video_stream;
+  AVStream *audio_stream;
+  // buffersink output, reused for every filtered frame
+  AVFrame *filt_frame;
+
+  AVFormatContext *fmt_ctx;
+  AVCodecContext *video_dec_ctx;
+  AVCodecContext *audio_dec_ctx;
+
+  // raw video buffers keyed by geometry and format, reallocated lazily on change
+  ImagePool *images;
+  int sample_rate;
+  int channels;
+  enum AVSampleFormat sample_fmt;
+
+  pthread_t demux_decode_t;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+
+  VideoFrameParsedCallback fireVideoFrameParsed;
+  AudioFrameParsedCallback fireAudioFrameParsed;
+  TimedVideoFrameParsedCallback fireTimedVideoFrameParsed;
+  TimedAudioFrameParsedCallback fireTimedAudioFrameParsed;
+  SessionEventCallback fireSessionEvent;
+  SegmentParsedCallback fireSegmentParsed;
+  RenditionFrameParsedCallback fireRenditionFrameParsed;
+  PacketsParsedCallback firePacketsParsed;
+  CodecConfigCallback fireCodecConfig;
+  ThumbnailParsedCallback fireThumbnailParsed;
+  ThumbnailMapCallback fireThumbnailMap;
+
+  // DD_TRACK_* selected at open
+  int tracks;
+  // DD_MODE_* selected at open
+  int mode;
+  // DD_PRIORITY_* of the jobs it puts on the shared thread pool
+  int priority;
+
+  // audio over video, off while min_audio_buffer is 0. times in microseconds
+  int64_t min_audio_buffer;
+  // end of the audio delivered so far, AV_NOPTS_VALUE before the first frame
+  int64_t audio_end;
+  // playback position reported by dd_set_audio_clock, or the first audio pts,
+  // at audio_clock_time on av_gettime_relative
+  int64_t audio_clock;
+  int64_t audio_clock_time;
+  int audio_low;
+  AVPacket *deferred[VIDEO_DEFER_MAX];
+  int nb_deferred;
+  long audio_underruns;
+  long audio_low_count;
+  long video_deferred;
+  long video_degraded;
+
+  // DD_CLOCK_* the session paces its output against, and how far ahead it decodes (us)
+  int clock;
+  int64_t decode_ahead;
+  // stream time of the first paced packet at wall_origin_time
+  int64_t wall_origin;
+  int64_t wall_origin_time;
+  long video_late;
+
+  // decoded video frames kept for scrubbing, NULL while cache_budget is 0
+  FrameCache *cache;
+  long cache_budget;
+  int cache_gop;
+  // pts of the last intra frame, groups cached frames by gop
+  int64_t gop_start;
+  // target of dd_seek in microseconds, taken over by the thread between two packets
+  int64_t seek_target;
+  volatile int seek_requested;
+  // frames ending before this are decoded but not output, AV_NOPTS_VALUE when none
+  int64_t seek_skip_until;
+  // target the input still has to be sought to after a seek the cache answered,
+  // AV_NOPTS_VALUE when none
+  int64_t pending_seek;
+  // pts of the last video frame output, where reverse play starts from
+  int64_t position;
+
+  // playback rate, negative plays backwards. rates other than 1 play no audio
+  double rate;
+  // set by dd_set_playback_rate, taken over by the thread between two packets
+  double pending_rate;
+  volatile int rate_changed;
+  long reverse_buffer;
+  long video_skipped;
+  long reverse_redecodes;
+
+  // demuxed packets of a live input kept for pause and seeking back, NULL while timeshift_budget is 0
+  Timeshift *timeshift;
+  long timeshift_budget;
+  int64_t timeshift_window;
+  // set by dd_pause, a paused timeshift session reads on but decodes nothing
+  volatile int paused;
+  int was_paused;
+  // set once the input has no more packets, the timeshift buffer may still have some
+  int live_ended;
+
+  // demuxed packets of a live input held for their delay, NULL while jitter_target is 0
+  JitterBuffer *jitter;
+  int64_t jitter_target;
+
+  Remuxer *remuxer;
+  // packets waiting for the next PacketsParsedCallback, kept across inputs
+  PacketBatch *packets;
+  int batch_size;
+  // bitstream filter chains per AVMediaType (video, audio) applied to output packets, NULL when none
+  char *bsf_names[2];
+  AVBSFContext *bsfs[2];
+
+  // filter graphs per AVMediaType (video, audio) between decoder and output, NULL when none
+  FilterGraph *filters[2];
+  // descriptions set by dd_set_filters, taken over by the thread between two packets
+  char *pending_filters[2];
+  volatile int filters_changed;
+
+  // DD_MODE_THUMBNAILS settings, interval in microseconds
+  int64_t thumb_interval;
+  int thumb_width;
+  int thumb_height;
+  int thumb_columns;
+  int thumb_rows;
+  int thumb_codec;
+  int thumb_quality;
+
+  // extra sizes every decoded video frame is scaled to, NULL when none
+  RenditionLadder *ladder;
+
+  // wall the decoded video goes to instead of the video callback, NULL when none
+  VideoWall *wall;
+  int wall_tile;
+
+  // probed streams, guarded by mutex
+  StreamInfo *streams;
+  int nb_streams;
+  // stream index requested by dd_select_stream per AVMediaType (video, audio), -1 when none
+  int pending_stream[2];
+  volatile int switch_requested;
+
+  // set by open_dd, cleared by close_dd or when the input ends
+  int opened;
+  // set by close_dd, makes blocked readers and ffmpeg io give up with AVERROR_EXIT
+  volatile int abort_request;
+  // set while the thread works on an input, close_dd waits for it to clear
+  int running;
+  // set when close_dd gave up waiting, the thread then hands the session back itself
+  int abandoned;
+  // set when the session leaves the pool for good
+  int retired;
+  // set when the thread has left its loop and may be joined
+  int exited;
+  // set when nobody will join the thread, it then frees the session itself
+  int orphaned;
+
+  // next idle session in the pool
+  struct Session *next;
+} Session;
+
 typedef struct CallbackContext {
+  Session *session;
+  int index;
   uint8_t *ptr;
   long size;
   long width;
   long height;
+  double pts;
+  double duration;
+  int is_init;
 } CallbackContext;
 
-typedef void (*VideoFrameParsedCallback)(uint8_t *ptr, long size, long width, long height);
-typedef void (*AudioFrameParsedCallback)(uint8_t *ptr, long size);
-
-// avio
-static uint8_t *io_buffer;
-static AVIOContext *io_ctx;
-static MemoryStream *store;
-
-// format & decode
-static AVPacket *pkt;
-static AVFrame *frame;
-static AVStream *video_stream;
-static AVStream *audio_stream;
+typedef struct PacketsContext {
+  Session *session;
+  PacketRecord *records;
+  int count;
+  uint8_t *payload;
+  long size;
+} PacketsContext;
 
-static AVFormatContext *fmt_ctx;
-static AVCodecContext *video_dec_ctx;
-static AVCodecContext *audio_dec_ctx;
+typedef struct CodecConfigContext {
+  Session *session;
+  AVStream *stream;
+  uint8_t *extradata;
+  long size;
+} CodecConfigContext;
 
-static uint8_t * video_frame_data[4] = { NULL };
-static int video_frame_line_size[4];
-static long video_frame_size;
-static enum AVPixelFormat pix_fmt;
+typedef struct WallContext {
+  VideoWall *wall;
+  uint8_t *ptr;
+  long size;
+  long width;
+  long height;
+} WallContext;
 
-static pthread_t demux_decode_main;
-static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+typedef struct EventContext {
+  Session *session;
+  int event;
+  long arg0;
+  long arg1;
+  long arg2;
+} EventContext;
 
-static VideoFrameParsedCallback fireVideoFrameParsed;
-static AudioFrameParsedCallback fireAudioFrameParsed;
+// warm sessions waiting for the next open_dd
+static Session *pool = NULL;
+static int pool_length = 0;
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+// every session alive, pooled or not
+static int live_sessions = 0;
 
-static int opened = 0;
+// scaling and filter slices of every session run on one set of workers
+static ThreadPool *workers = NULL;
 
 static pthread_t main;
 static em_proxying_queue *proxy_queue = NULL;
@@ -65,13 +457,86 @@ static em_proxying_queue *proxy_queue = NULL;
 static void invokeVideoFrameParsedCallback(void *arg)
 {
   CallbackContext *ctx = (CallbackContext *)arg;
-  (*fireVideoFrameParsed)(ctx->ptr, ctx->size, ctx->width, ctx->height);
+  if (ctx->session->abort_request) return;
+  if (ctx->session->fireTimedVideoFrameParsed)
+  {
+    (*ctx->session->fireTimedVideoFrameParsed)(ctx->ptr, ctx->size, ctx->width, ctx->height, ctx->pts, ctx->duration);
+    return;
+  }
+  (*ctx->session->fireVideoFrameParsed)(ctx->ptr, ctx->size, ctx->width, ctx->height);
+}
+
+static void invokeFrameComposedCallback(void *arg)
+{
+  WallContext *ctx = (WallContext *)arg;
+  if (ctx->wall->closing || !ctx->wall->fireFrameComposed) return;
+  (*ctx->wall->fireFrameComposed)(ctx->ptr, ctx->size, ctx->width, ctx->height);
+}
+
+static void invokeRenditionFrameParsedCallback(void *arg)
+{
+  CallbackContext *ctx = (CallbackContext *)arg;
+  if (ctx->session->abort_request || !ctx->session->fireRenditionFrameParsed) return;
+  (*ctx->session->fireRenditionFrameParsed)(ctx->index, ctx->ptr, ctx->size, ctx->width, ctx->height);
 }
 
 static void invokeAudioFrameParsedCallback(void *arg)
 {
   CallbackContext *ctx = (CallbackContext *)arg;
-  (*fireAudioFrameParsed)(ctx->ptr, ctx->size);
+  if (ctx->session->abort_request) return;
+  if (ctx->session->fireTimedAudioFrameParsed)
+  {
+    (*ctx->session->fireTimedAudioFrameParsed)(ctx->ptr, ctx->size, ctx->pts, ctx->duration);
+    return;
+  }
+  (*ctx->session->fireAudioFrameParsed)(ctx->ptr, ctx->size);
+}
+
+static void invokeThumbnailParsedCallback(void *arg)
+{
+  CallbackContext *ctx = (CallbackContext *)arg;
+  if (ctx->session->abort_request || !ctx->session->fireThumbnailParsed) return;
+  (*ctx->session->fireThumbnailParsed)(ctx->index, ctx->ptr, ctx->size, ctx->pts);
+}
+
+static void invokeThumbnailMapCallback(void *arg)
+{
+  CallbackContext *ctx = (CallbackContext *)arg;
+  if (ctx->session->abort_request || !ctx->session->fireThumbnailMap) return;
+  (*ctx->session->fireThumbnailMap)((char *)ctx->ptr, ctx->size);
+}
+
+static void invokeSegmentParsedCallback(void *arg)
+{
+  CallbackContext *ctx = (CallbackContext *)arg;
+  if (ctx->session->abort_request || !ctx->session->fireSegmentParsed) return;
+  (*ctx->session->fireSegmentParsed)(ctx->ptr, ctx->size, ctx->is_init);
+}
+
+static void invokePacketsParsedCallback(void *arg)
+{
+  PacketsContext *ctx = (PacketsContext *)arg;
+  if (ctx->session->abort_request || !ctx->session->firePacketsParsed) return;
+  (*ctx->session->firePacketsParsed)(ctx->records, ctx->count, ctx->payload, ctx->size);
+}
+
+static void invokeCodecConfigCallback(void *arg)
+{
+  CodecConfigContext *ctx = (CodecConfigContext *)arg;
+  AVCodecParameters *par = ctx->stream->codecpar;
+  int is_video = par->codec_type == AVMEDIA_TYPE_VIDEO;
+  if (ctx->session->abort_request || !ctx->session->fireCodecConfig) return;
+  (*ctx->session->fireCodecConfig)(ctx->stream->index, par->codec_type, avcodec_get_name(par->codec_id),
+                                   ctx->extradata, ctx->size,
+                                   is_video ? par->width : par->sample_rate,
+                                   is_video ? par->height : par->ch_layout.nb_channels);
+}
+
+static void invokeSessionEventCallback(void *arg)
+{
+  EventContext *ctx = (EventContext *)arg;
+  if (ctx->session->abort_request || !ctx->session->fireSessionEvent) return;
+  (*ctx->session->fireSessionEvent)(ctx->event, ctx->arg0, ctx->arg1, ctx->arg2);
 }
 
 /*************************************************/
@@ -79,29 +544,37 @@ static void invokeAudioFrameParsedCallback(void *arg)
 /*************************************************/
 static int read_file_store(void *opaque, uint8_t *buffer, int buffer_size)
 {
-  MemoryStream *ms = opaque;
+  Session *s = opaque;
+  MemoryStream *ms = s->store;
 
-  if (pthread_mutex_lock(&mutex) != 0)
+  if (pthread_mutex_lock(&s->mutex) != 0)
   {
     fprintf(stderr, "Failed to lock muted\n");
     return AVERROR(EINVAL);
   }
 
-  if (!ms->is_done)
+  while (!ms->is_done && !s->abort_request)
   {
-    if (pthread_cond_wait(&cond, &mutex) != 0)
+    if (pthread_cond_wait(&s->cond, &s->mutex) != 0)
     {
       fprintf(stderr, "Could not wait cond!\n");
+      pthread_mutex_unlock(&s->mutex);
       return AVERROR(EINVAL);
     }
   }
+  if (s->abort_request)
+  {
+    pthread_mutex_unlock(&s->mutex);
+    return AVERROR_EXIT;
+  }
   buffer_size = FFMIN(buffer_size, memory_stream_get_available(ms));
   if (buffer_size == 0)
   {
+    pthread_mutex_unlock(&s->mutex);
     return AVERROR_EOF;
   }
   int bytes_read = memory_stream_read(ms, buffer, buffer_size);
-  if (pthread_mutex_unlock(&mutex) != 0)
+  if (pthread_mutex_unlock(&s->mutex) != 0)
   {
     fprintf(stderr, "Failed to unlock mutex!\n");
     return AVERROR(EINVAL);
@@ -112,28 +585,42 @@ static int read_file_store(void *opaque, uint8_t *buffer, int buffer_size)
 static int read_stream_store(void *opaque, uint8_t *buffer, int buffer_size)
 {
   int ret;
-  MemoryStream *ms = opaque;
+  Session *s = opaque;
+  MemoryStream *ms = s->store;
 
-  if (pthread_mutex_lock(&mutex) != 0)
+  if (pthread_mutex_lock(&s->mutex) != 0)
   {
     fprintf(stderr, "Failed to lock muted\n");
     return AVERROR(EINVAL);
   }
-  buffer_size = FFMIN(buffer_size, memory_stream_get_available(ms));
-  if (buffer_size == 0)
+  while (!s->ingest && memory_stream_get_available(ms) == 0 && !ms->is_done && !s->abort_request)
   {
-    if (pthread_cond_wait(&cond, &mutex) != 0)
+    if (pthread_cond_wait(&s->cond, &s->mutex) != 0)
     {
       fprintf(stderr, "Could not wait cond!\n");
+      pthread_mutex_unlock(&s->mutex);
       return AVERROR(EINVAL);
     }
-    ret = 0;
+  }
+  if (s->ingest)
+  {
+    pthread_mutex_unlock(&s->mutex);
+    return chunk_store_read(s->ingest, buffer, buffer_size, &s->abort_request);
+  }
+  buffer_size = FFMIN(buffer_size, memory_stream_get_available(ms));
+  if (s->abort_request)
+  {
+    ret = AVERROR_EXIT;
+  }
+  else if (buffer_size == 0)
+  {
+    ret = AVERROR_EOF;
   }
   else
   {
     ret = memory_stream_read(ms, buffer, buffer_size);
   }
-  if (pthread_mutex_unlock(&mutex) != 0)
+  if (pthread_mutex_unlock(&s->mutex) != 0)
   {
     fprintf(stderr, "Failed to unlock mutex!\n");
     return AVERROR(EINVAL);
@@ -144,14 +631,15 @@ static int read_stream_store(void *opaque, uint8_t *buffer, int buffer_size)
 static int64_t seek_store(void *opaque, int64_t offset, int whence)
 {
   int ret = 0;
-  MemoryStream *ms = opaque;
-  if ((ret = pthread_mutex_lock(&mutex)) != 0)
+  Session *s = opaque;
+  if (s->abort_request) return AVERROR_EXIT;
+  if ((ret = pthread_mutex_lock(&s->mutex)) != 0)
   {
     fprintf(stderr, "Failed to lock mutex!\n");
     return AVERROR(EINVAL);
   }
-  ret = memory_stream_seek(ms, offset, whence);
-  if (pthread_mutex_unlock(&mutex) != 0)
+  ret = memory_stream_seek(s->store, offset, whence);
+  if (pthread_mutex_unlock(&s->mutex) != 0)
   {
     fprintf(stderr, "Failed to unlock mutex!\n");
     return AVERROR(EINVAL);
@@ -159,308 +647,2990 @@ static int64_t seek_store(void *opaque, int64_t offset, int whence)
   return ret;
 }
 
-static int open_codec_context(AVCodecContext **dec_ctx, AVStream **stream, AVFormatContext *fmt_ctx, enum AVMediaType type)
+static void deadline_after(struct timespec *ts, long ms)
 {
-  int ret;
-  AVStream *st;
-  const AVCodec *dec = NULL;
-  const char *type_name = av_get_media_type_string(type);
-  if((ret = av_find_best_stream(fmt_ctx, type, -1, -1, NULL, 0)) < 0)
-  {
-    fprintf(stderr, "Could not find %s stream in media!\n", type_name);
-    return ret;
-  } 
-  else
+  clock_gettime(CLOCK_REALTIME, ts);
+  ts->tv_sec += ms / 1000;
+  ts->tv_nsec += (ms % 1000) * 1000000;
+  if (ts->tv_nsec >= 1000000000)
   {
-    st = fmt_ctx->streams[ret];
-
-    if (!(dec = avcodec_find_decoder(st->codecpar->codec_id)))
-    {
-      fprintf(stderr, "Failed to find %s codec!\n", type_name);
-      return AVERROR(EINVAL);
-    }
-
-    if (!(*dec_ctx = avcodec_alloc_context3(dec)))
-    {
-      fprintf(stderr, "Failed to allocate the %s codec context\n", type_name);
-      return AVERROR(ENOMEM);
-    }
+    ts->tv_sec++;
+    ts->tv_nsec -= 1000000000;
+  }
+}
 
-    if ((ret = avcodec_parameters_to_context(*dec_ctx, st->codecpar)) < 0)
-    {
-      fprintf(stderr, "Failed to copy %s codec parameters to decoder context!\n", type_name);
-      return ret;
-    }
+static int deadline_passed(const struct timespec *deadline)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return now.tv_sec > deadline->tv_sec || (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec);
+}
 
-    if ((ret=avcodec_open2(*dec_ctx, dec, NULL)) < 0)
+// wait on the session cond until *flag equals value, pumping proxied callbacks
+// so a thread stuck in emscripten_proxy_sync can finish. caller holds the mutex.
+static int session_wait_flag(Session *s, int *flag, int value, const struct timespec *deadline)
+{
+  struct timespec slice;
+  while (*flag != value)
+  {
+    if (deadline_passed(deadline)) return AVERROR(ETIMEDOUT);
+    deadline_after(&slice, CLOSE_POLL_MS);
+    pthread_cond_timedwait(&s->cond, &s->mutex, &slice);
+    if (proxy_queue && pthread_equal(pthread_self(), main))
     {
-      fprintf(stderr, "Failed to open %s codec!\n", type_name);
-      return ret;
+      pthread_mutex_unlock(&s->mutex);
+      emscripten_proxy_execute_queue(proxy_queue);
+      pthread_mutex_lock(&s->mutex);
     }
-    *stream = st;
   }
-
   return 0;
 }
 
-static int output_video_frame(AVFrame *frame)
+static int decode_interrupt_cb(void *opaque)
 {
-  av_image_copy(video_frame_data, video_frame_line_size, 
-                (const uint8_t **)(frame->data), frame->linesize, 
-                pix_fmt, frame->width, frame->height);
-  CallbackContext ctx = {
-    .ptr = video_frame_data[0],
-    .size = video_frame_size,
-    .width = frame->width,
-    .height = frame->height,
-  };
-  emscripten_proxy_sync(proxy_queue, main, &invokeVideoFrameParsedCallback, &ctx);
-  printf("output video\n");
-  return 0;
+  Session *s = opaque;
+  return s->abort_request;
 }
 
-static int output_audio_frame(AVFrame *frame)
+// a warm decoder can be flushed and reused when the new stream would configure it identically
+static int codec_context_matches(const AVCodecContext *ctx, const AVCodecParameters *par)
 {
-  size_t unpadded_linesize = frame->nb_samples * av_get_bytes_per_sample(frame->format);
-  CallbackContext ctx = {
-    .ptr = frame->extended_data[0],
-    .size = unpadded_linesize,
-  };
-  emscripten_proxy_sync(proxy_queue, main, &invokeAudioFrameParsedCallback, &ctx);
-  printf("output audio\n");
-  return 0;
+  if (!ctx || ctx->codec_id != par->codec_id) return 0;
+  if (ctx->extradata_size != par->extradata_size) return 0;
+  if (par->extradata_size > 0 && memcmp(ctx->extradata, par->extradata, par->extradata_size) != 0) return 0;
+  if (par->codec_type == AVMEDIA_TYPE_VIDEO)
+  {
+    return ctx->width == par->width && ctx->height == par->height && ctx->pix_fmt == par->format;
+  }
+  return ctx->sample_rate == par->sample_rate && ctx->ch_layout.nb_channels == par->ch_layout.nb_channels;
 }
 
-static int decode_packet(AVCodecContext *ctx, AVPacket *pkt)
+// one execute or execute2 call of a session decoder
+typedef struct CodecJobs
 {
-  int ret = 0;
-  
-  if ((ret = avcodec_send_packet(ctx, pkt)) < 0)
-  {
-    fprintf(stderr, "Error submitting a packet for decoding (%s)\n", av_err2str(ret));
-    return ret;
-  }
+  AVCodecContext *ctx;
+  int (*func)(AVCodecContext *ctx, void *arg);
+  int (*func2)(AVCodecContext *ctx, void *arg, int job, int thread);
+  char *arg;
+  int size;
+  int *ret;
+} CodecJobs;
 
-  while (ret >= 0)
-  {
-    if ((ret = avcodec_receive_frame(ctx, frame)) < 0)
-    {
-      if (ret == AVERROR_EOF || ret == AVERROR(EAGAIN)) return 0;
-      fprintf(stderr, "Error during decoding (%s)\n", av_err2str(ret));
-      return ret;
-    }
+static void run_codec_job(void *arg, int index)
+{
+  CodecJobs *jobs = arg;
+  int ret = jobs->func2 ? (*jobs->func2)(jobs->ctx, jobs->arg, index, thread_pool_thread_index(workers)) :
+            (*jobs->func)(jobs->ctx, jobs->arg + (size_t)index * jobs->size);
+  if (jobs->ret) jobs->ret[index] = ret;
+}
 
-    if (ctx->codec->type == AVMEDIA_TYPE_VIDEO)
-    {
-      ret = output_video_frame(frame);
-    }
-    else if (ctx->codec->type == AVMEDIA_TYPE_AUDIO)
-    {
-      ret = output_audio_frame(frame);
-    }
-    av_frame_unref(frame);
-    if (ret < 0)
-      return ret;
-  }
+// libavcodec's slice threading, routed to the shared pool at the session's priority
+static int execute_codec_jobs(AVCodecContext *ctx, int (*func)(AVCodecContext *, void *), void *arg, int *ret, int count, int size)
+{
+  Session *s = ctx->opaque;
+  CodecJobs jobs = {
+    .ctx = ctx,
+    .func = func,
+    .arg = arg,
+    .size = size,
+    .ret = ret,
+  };
+  thread_pool_run(workers, &run_codec_job, &jobs, count, s->priority);
+  return 0;
+}
 
+static int execute2_codec_jobs(AVCodecContext *ctx, int (*func)(AVCodecContext *, void *, int, int), void *arg, int *ret, int count)
+{
+  Session *s = ctx->opaque;
+  CodecJobs jobs = {
+    .ctx = ctx,
+    .func2 = func,
+    .arg = arg,
+    .ret = ret,
+  };
+  thread_pool_run(workers, &run_codec_job, &jobs, count, s->priority);
   return 0;
 }
 
-static void *demux_decode(void *arg)
+// open a decoder for st, or flush and keep the warm one when it fits
+static int open_stream_decoder(Session *s, AVCodecContext **dec_ctx, AVStream *st)
 {
   int ret;
-  // avio
-  if (!(io_buffer = av_malloc(IO_BUFFER_SIZE)))
-  {
-    fprintf(stderr, "Could not allocate io buffer!\n");
-    ret = AVERROR(ENOMEM);
-    goto end;
-  }
+  const AVCodec *dec = NULL;
+  const char *type_name = av_get_media_type_string(st->codecpar->codec_type);
 
-  if (!(io_ctx = avio_alloc_context(io_buffer, IO_BUFFER_SIZE, 0, store,
-    store->is_stream ? &read_stream_store:&read_file_store, 
-    NULL, 
-    store->is_stream ? NULL : &seek_store)))
+  if (codec_context_matches(*dec_ctx, st->codecpar))
   {
-    fprintf(stderr, "Could not allocate io context!\n");
-    ret = AVERROR(ENOMEM);
-    goto end;
+    avcodec_flush_buffers(*dec_ctx);
+    (*dec_ctx)->pkt_timebase = st->time_base;
+    return 0;
   }
+  avcodec_free_context(dec_ctx);
 
-  // format
-  if (!(fmt_ctx = avformat_alloc_context()))
+  if (!(dec = avcodec_find_decoder(st->codecpar->codec_id)))
   {
-    fprintf(stderr, "Could not allocate format context!\n");
-    ret = AVERROR(ENOMEM);
-    goto end;
+    fprintf(stderr, "Failed to find %s codec!\n", type_name);
+    return AVERROR(EINVAL);
   }
-  fmt_ctx->pb = io_ctx;
 
-  if ((ret = avformat_open_input(&fmt_ctx, NULL, NULL, NULL)) != 0)
+  if (!(*dec_ctx = avcodec_alloc_context3(dec)))
   {
-    fprintf(stderr, "Could not open input!\n");
-    goto end;
+    fprintf(stderr, "Failed to allocate the %s codec context\n", type_name);
+    return AVERROR(ENOMEM);
   }
 
-  if ((ret = avformat_find_stream_info(fmt_ctx, NULL)) != 0)
+  if ((ret = avcodec_parameters_to_context(*dec_ctx, st->codecpar)) < 0)
   {
-    fprintf(stderr, "Could not find stream information!\n");
-    goto end;
+    fprintf(stderr, "Failed to copy %s codec parameters to decoder context!\n", type_name);
+    avcodec_free_context(dec_ctx);
+    return ret;
   }
+  (*dec_ctx)->pkt_timebase = st->time_base;
+  (*dec_ctx)->opaque = s;
+  // libavcodec only calls a custom execute once its own slice threading is on, so it
+  // gets one slice thread per pool thread and its jobs then go to the pool. execute2
+  // numbers them by thread_pool_thread_index, hence the caller's extra one
+  (*dec_ctx)->thread_type = FF_THREAD_SLICE;
+  (*dec_ctx)->thread_count = workers ? workers->nb_workers + 1 : 1;
 
-  if (open_codec_context(&video_dec_ctx, &video_stream, fmt_ctx, AVMEDIA_TYPE_VIDEO) >= 0)
+  if ((ret=avcodec_open2(*dec_ctx, dec, NULL)) < 0)
   {
-    int width = video_dec_ctx->width;
-    int height = video_dec_ctx->height;
-    pix_fmt = video_dec_ctx->pix_fmt;
-    if ((ret = av_image_alloc(video_frame_data, video_frame_line_size, width, height, pix_fmt, 1)) < 0)
-    {
-      fprintf(stderr, "Could not allocate raw video buffer\n");
-      goto end;
-    }
-    video_frame_size = ret;
+    fprintf(stderr, "Failed to open %s codec!\n", type_name);
+    avcodec_free_context(dec_ctx);
+    return ret;
   }
-
-  if (open_codec_context(&audio_dec_ctx, &audio_stream, fmt_ctx, AVMEDIA_TYPE_AUDIO) < 0)
+  if ((*dec_ctx)->active_thread_type & FF_THREAD_SLICE)
   {
-    goto end;
+    (*dec_ctx)->execute = &execute_codec_jobs;
+    (*dec_ctx)->execute2 = &execute2_codec_jobs;
   }
 
-  if (!video_stream && !audio_stream)
-  {
-    fprintf(stderr, "Could not find audio or video stream in the media, aborting\n");
-    ret = 1;
-    goto end;
-  }
+  return 0;
+}
 
-  if (!(frame = av_frame_alloc()))
+static int find_stream(AVStream **stream, AVFormatContext *fmt_ctx, enum AVMediaType type)
+{
+  int ret;
+  if((ret = av_find_best_stream(fmt_ctx, type, -1, -1, NULL, 0)) < 0)
   {
-    fprintf(stderr, "Could not allocate frame!\n");
-    ret = AVERROR(ENOMEM);
-    goto end;
+    fprintf(stderr, "Could not find %s stream in media!\n", av_get_media_type_string(type));
+    return ret;
   }
+  *stream = fmt_ctx->streams[ret];
+  return 0;
+}
 
-  if (!(pkt = av_packet_alloc()))
+static int open_codec_context(Session *s, AVCodecContext **dec_ctx, AVStream **stream, AVFormatContext *fmt_ctx, enum AVMediaType type)
+{
+  int ret;
+  AVStream *st;
+  if((ret = av_find_best_stream(fmt_ctx, type, -1, -1, NULL, 0)) < 0)
   {
-    fprintf(stderr, "Could not allocate pakcet!\n");
-    ret = AVERROR(ENOMEM);
-    goto end;
+    fprintf(stderr, "Could not find %s stream in media!\n", av_get_media_type_string(type));
+    return ret;
   }
-
-  while(av_read_frame(fmt_ctx, pkt) >=0)
+  st = fmt_ctx->streams[ret];
+  if ((ret = open_stream_decoder(s, dec_ctx, st)) < 0)
   {
-    if (!opened)
-    {
-      av_packet_unref(pkt);
-      goto end;
-    }
-    if(pkt->stream_index == video_stream->index)
-    {
-      ret = decode_packet(video_dec_ctx, pkt);
-    }
-    else if (pkt->stream_index == audio_stream->index)
-    {
-      ret = decode_packet(audio_dec_ctx, pkt);
-    }
-    av_packet_unref(pkt);
-    if (ret < 0)
-      break;
+    return ret;
   }
+  *stream = st;
 
-end:
-  avcodec_free_context(&video_dec_ctx);
-  avcodec_free_context(&audio_dec_ctx);
-  avformat_close_input(&fmt_ctx);
-  av_packet_free(&pkt);
-  av_frame_free(&frame);
-  av_free(video_frame_data[0]);
-  memory_stream_free(&store);
-  pthread_mutex_destroy(&mutex);
-  pthread_cond_destroy(&cond);
-  opened = 0;
-  pthread_exit(NULL);
-  return NULL;
+  return 0;
 }
 
-/*************************************************/
-/*** api section *********************************/
-/*************************************************/
-EMSCRIPTEN_KEEPALIVE
-void hello_wasm()
+static void fire_session_event(Session *s, int event, long arg0, long arg1, long arg2)
 {
-  printf("hello webassembly from demux decode for web media\n");
+  EventContext ctx = {
+    .session = s,
+    .event = event,
+    .arg0 = arg0,
+    .arg1 = arg1,
+    .arg2 = arg2,
+  };
+  emscripten_proxy_sync(proxy_queue, main, &invokeSessionEventCallback, &ctx);
 }
 
-EMSCRIPTEN_KEEPALIVE
-int open_dd(int is_stream, VideoFrameParsedCallback on_video_frame_parsed, AudioFrameParsedCallback on_audio_frame_parsed)
+static void output_segment(void *opaque, uint8_t *ptr, size_t size, int is_init)
 {
-  int ret;
-  if (opened) return 0;
-
-  opened = 1;
-  
-  fireVideoFrameParsed = on_video_frame_parsed;
-  fireAudioFrameParsed = on_audio_frame_parsed;
-
-  main = pthread_self();
-  proxy_queue = em_proxying_queue_create();
+  Session *s = opaque;
+  CallbackContext ctx = {
+    .session = s,
+    .ptr = ptr,
+    .size = size,
+    .is_init = is_init,
+  };
+  emscripten_proxy_sync(proxy_queue, main, &invokeSegmentParsedCallback, &ctx);
+}
 
-  // memory stream
-  if ((ret = memory_stream_create(&store, STORE_SIZE, is_stream)) != 0)
-  {
-    fprintf(stderr, "Could not aloocate store!\n");
-    return ret;
-  }
+// hand the pending packets over in one call, the batch is reused afterwards
+static void output_packets(Session *s)
+{
+  PacketBatch *batch = s->packets;
+  if (batch->count == 0) return;
+  PacketsContext ctx = {
+    .session = s,
+    .records = batch->records,
+    .count = batch->count,
+    .payload = batch->payload->data,
+    .size = batch->payload->length,
+  };
+  emscripten_proxy_sync(proxy_queue, main, &invokePacketsParsedCallback, &ctx);
+  packet_batch_reset(batch);
+}
 
-  // create thread
-  if ((ret = pthread_create(&demux_decode_main, NULL, &demux_decode, NULL)) != 0)
-  {
-    fprintf(stderr, "Could not open demux decode thread\n!");
-    return ret;
-  }
+static void output_codec_config(Session *s, AVStream *st, uint8_t *extradata, long size)
+{
+  CodecConfigContext ctx = {
+    .session = s,
+    .stream = st,
+    .extradata = extradata,
+    .size = size,
+  };
+  emscripten_proxy_sync(proxy_queue, main, &invokeCodecConfigCallback, &ctx);
+}
 
-  return 0;
+// the consumer sees the codec parameters after the bitstream filters, e.g. annex b
+// parameter sets instead of avcC once h264_mp4toannexb is in the chain
+static void output_stream_config(Session *s, AVStream *st)
+{
+  AVBSFContext *bsf = s->bsfs[st->codecpar->codec_type];
+  AVCodecParameters *par = bsf ? bsf->par_out : st->codecpar;
+  output_codec_config(s, st, par->extradata, par->extradata_size);
 }
 
-EMSCRIPTEN_KEEPALIVE
-int write_dd( size_t length, MemoryStreamWriteCallback did_write)
+// set up the bitstream filter chain configured for the type of st, if any
+static int open_stream_bsf(Session *s, AVStream *st)
 {
   int ret;
-  if ((ret = pthread_mutex_lock(&mutex)) != 0)
+  int type = st->codecpar->codec_type;
+  AVBSFContext **bsf = &s->bsfs[type];
+
+  av_bsf_free(bsf);
+  if (!s->bsf_names[type]) return 0;
+
+  if ((ret = av_bsf_list_parse_str(s->bsf_names[type], bsf)) < 0)
   {
-    fprintf(stderr, "Could not lock mutex!\n");
+    fprintf(stderr, "Could not parse bitstream filters '%s' (%s)\n", s->bsf_names[type], av_err2str(ret));
     return ret;
   }
-  memory_stream_write_callback(store, NULL, length, did_write);
-  if ((ret = pthread_mutex_unlock(&mutex)) != 0)
+  if ((ret = avcodec_parameters_copy((*bsf)->par_in, st->codecpar)) < 0)
   {
-    fprintf(stderr, "Could not unlock mutex!\n");
+    av_bsf_free(bsf);
     return ret;
   }
-  if (store->is_stream)
+  (*bsf)->time_base_in = st->time_base;
+  if ((ret = av_bsf_init(*bsf)) < 0)
   {
-    if ((ret = pthread_cond_signal(&cond)) != 0)
+    fprintf(stderr, "Could not init bitstream filters '%s' (%s)\n", s->bsf_names[type], av_err2str(ret));
+    av_bsf_free(bsf);
+    return ret;
+  }
+  return 0;
+}
+
+static void snapshot_streams(Session *s)
+{
+  StreamInfo *streams;
+  AVDictionaryEntry *tag;
+  int nb_streams = s->fmt_ctx->nb_streams;
+
+  if (!(streams = av_calloc(nb_streams, sizeof(StreamInfo))))
+  {
+    fprintf(stderr, "Could not allocate stream info!\n");
+    return;
+  }
+  for (int i = 0; i < nb_streams; i++)
+  {
+    AVStream *st = s->fmt_ctx->streams[i];
+    AVCodecParameters *par = st->codecpar;
+    StreamInfo *info = &streams[i];
+    info->type = par->codec_type;
+    av_strlcpy(info->codec, avcodec_get_name(par->codec_id), sizeof(info->codec));
+    if ((tag = av_dict_get(st->metadata, "language", NULL, 0))) av_strlcpy(info->language, tag->value, sizeof(info->language));
+    if ((tag = av_dict_get(st->metadata, "title", NULL, 0))) av_strlcpy(info->title, tag->value, sizeof(info->title));
+    info->arg0 = par->codec_type == AVMEDIA_TYPE_VIDEO ? par->width : par->sample_rate;
+    info->arg1 = par->codec_type == AVMEDIA_TYPE_VIDEO ? par->height : par->ch_layout.nb_channels;
+    info->active = st == s->video_stream || st == s->audio_stream;
+  }
+
+  pthread_mutex_lock(&s->mutex);
+  av_free(s->streams);
+  s->streams = streams;
+  s->nb_streams = nb_streams;
+  pthread_mutex_unlock(&s->mutex);
+
+  fire_session_event(s, DD_EVENT_STREAMS_READY, nb_streams, 0, 0);
+}
+
+// switch to the streams asked for by dd_select_stream. only the decoder of the
+// affected type is flushed or reopened, the old stream goes back to AVDISCARD_ALL.
+static void apply_stream_switches(Session *s)
+{
+  int ret;
+  int index[2];
+
+  pthread_mutex_lock(&s->mutex);
+  for (int type = AVMEDIA_TYPE_VIDEO; type <= AVMEDIA_TYPE_AUDIO; type++)
+  {
+    index[type] = s->pending_stream[type];
+    s->pending_stream[type] = -1;
+  }
+  s->switch_requested = 0;
+  pthread_mutex_unlock(&s->mutex);
+
+  for (int type = AVMEDIA_TYPE_VIDEO; type <= AVMEDIA_TYPE_AUDIO; type++)
+  {
+    AVStream **current = type == AVMEDIA_TYPE_VIDEO ? &s->video_stream : &s->audio_stream;
+    AVCodecContext **dec_ctx = type == AVMEDIA_TYPE_VIDEO ? &s->video_dec_ctx : &s->audio_dec_ctx;
+    AVStream *st;
+
+    if (index[type] < 0) continue;
+    st = s->fmt_ctx->streams[index[type]];
+    if (st == *current) continue;
+
+    if (*current) (*current)->discard = AVDISCARD_ALL;
+    // an external decoder is reconfigured from the codec config of the new stream
+    if ((ret = (s->mode & DD_MODE_PACKETS) ? open_stream_bsf(s, st) : open_stream_decoder(s, dec_ctx, st)) < 0)
+    {
+      fprintf(stderr, "Could not switch to stream %d (%s)\n", st->index, av_err2str(ret));
+      *current = NULL;
+    }
+    else
+    {
+      st->discard = AVDISCARD_DEFAULT;
+      *current = st;
+      // cached frames belong to the old stream
+      if (type == AVMEDIA_TYPE_VIDEO && s->cache) frame_cache_clear(s->cache);
+      s->tracks |= type == AVMEDIA_TYPE_VIDEO ? DD_TRACK_VIDEO : DD_TRACK_AUDIO;
+    }
+
+    pthread_mutex_lock(&s->mutex);
+    for (int i = 0; i < s->nb_streams; i++)
+    {
+      if (s->streams[i].type == type) s->streams[i].active = *current && i == (*current)->index;
+    }
+    pthread_mutex_unlock(&s->mutex);
+
+    fire_session_event(s, DD_EVENT_TRACK_SWITCHED, type, *current ? st->index : -1, ret < 0 ? ret : 0);
+    if (*current && (s->mode & DD_MODE_PACKETS))
+    {
+      output_stream_config(s, st);
+    }
+  }
+}
+
+static int64_t to_microseconds(int64_t ts, AVRational time_base)
+{
+  return ts == AV_NOPTS_VALUE ? AV_NOPTS_VALUE : av_rescale_q(ts, time_base, AV_TIME_BASE_Q);
+}
+
+static int64_t frame_duration(Session *s, AVFrame *frame, AVRational time_base)
+{
+  AVRational rate;
+  if (frame->duration > 0) return av_rescale_q(frame->duration, time_base, AV_TIME_BASE_Q);
+  if (frame->sample_rate > 0) return av_rescale(frame->nb_samples, AV_TIME_BASE, frame->sample_rate);
+  rate = s->video_stream ? s->video_stream->avg_frame_rate : (AVRational){ 0, 1 };
+  return rate.num > 0 ? av_rescale(AV_TIME_BASE, rate.den, rate.num) : 0;
+}
+
+// presentation time of the output, caller holds the mutex. AV_NOPTS_VALUE until it started
+static int64_t clock_now(Session *s)
+{
+  int64_t now = av_gettime_relative();
+  if (s->clock == DD_CLOCK_AUDIO && s->audio_end != AV_NOPTS_VALUE)
+  {
+    return s->audio_clock + (now - s->audio_clock_time);
+  }
+  if (s->wall_origin == AV_NOPTS_VALUE) return AV_NOPTS_VALUE;
+  return s->wall_origin + (int64_t)((now - s->wall_origin_time) * fabs(s->rate));
+}
+
+// what video can leave out at rate, in either direction
+static enum AVDiscard trick_discard(double rate)
+{
+  rate = fabs(rate);
+  if (rate >= TRICK_KEYFRAME_RATE) return AVDISCARD_NONKEY;
+  if (rate >= TRICK_NONREF_RATE) return AVDISCARD_NONREF;
+  return AVDISCARD_DEFAULT;
+}
+
+// hold the reader while pkt is more than decode_ahead ahead of the clock, so the
+// consumer never has to buffer more than that
+static void pace_packet(Session *s, AVPacket *pkt)
+{
+  int64_t ts = to_microseconds(pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts, pkt->time_base);
+  int64_t now, wait;
+  struct timespec deadline;
+
+  if (s->clock == DD_CLOCK_NONE || ts == AV_NOPTS_VALUE) return;
+
+  pthread_mutex_lock(&s->mutex);
+  if (s->wall_origin == AV_NOPTS_VALUE)
+  {
+    s->wall_origin = ts;
+    s->wall_origin_time = av_gettime_relative();
+  }
+  while (!s->abort_request && !s->seek_requested && !s->rate_changed && s->clock != DD_CLOCK_NONE && (now = clock_now(s)) != AV_NOPTS_VALUE &&
+         (wait = ts - now - s->decode_ahead) > 0)
+  {
+    deadline_after(&deadline, FFMIN(wait / 1000 + 1, PACE_POLL_MS));
+    pthread_cond_timedwait(&s->cond, &s->mutex, &deadline);
+  }
+  pthread_mutex_unlock(&s->mutex);
+}
+
+// a paced video frame whose display time has passed is dropped before any conversion
+static int video_frame_is_late(Session *s, AVFrame *frame, AVRational time_base)
+{
+  int64_t now;
+  int64_t pts = to_microseconds(frame->best_effort_timestamp, time_base);
+
+  if (s->clock == DD_CLOCK_NONE || pts == AV_NOPTS_VALUE) return 0;
+  pthread_mutex_lock(&s->mutex);
+  now = clock_now(s);
+  pthread_mutex_unlock(&s->mutex);
+  return now != AV_NOPTS_VALUE && pts + frame_duration(s, frame, time_base) < now;
+}
+
+static double to_milliseconds(int64_t us)
+{
+  return us == AV_NOPTS_VALUE ? NAN : us / 1000.0;
+}
+
+// the frame is decoded once and scaled to all renditions in parallel
+static int output_renditions(Session *s, AVFrame *frame)
+{
+  int ret;
+  if ((ret = rendition_ladder_scale(s->ladder, frame, workers, s->priority)) < 0)
+  {
+    fprintf(stderr, "Error scaling renditions (%s)\n", av_err2str(ret));
+    return ret;
+  }
+  for (int i = 0; i < s->ladder->nb_renditions; i++)
+  {
+    ImageBuffer *image = s->ladder->renditions[i].image;
+    CallbackContext ctx = {
+      .session = s,
+      .index = i,
+      .ptr = image->data[0],
+      .size = image->size,
+      .width = image->width,
+      .height = image->height,
+    };
+    emscripten_proxy_sync(proxy_queue, main, &invokeRenditionFrameParsedCallback, &ctx);
+  }
+  return 0;
+}
+
+static int output_video_frame(Session *s, AVFrame *frame, AVRational time_base)
+{
+  int ret;
+  ImageBuffer *image;
+  if (s->abort_request) return AVERROR_EXIT;
+  if (s->wall)
+  {
+    return compositor_submit(s->wall->compositor, s->wall_tile, frame);
+  }
+  // abr renditions switch geometry mid stream, follow them instead of failing
+  if ((ret = image_pool_get(s->images, &image, frame->width, frame->height, frame->format)) < 0)
+  {
+    return ret;
+  }
+  if (ret > 0)
+  {
+    fire_session_event(s, DD_EVENT_VIDEO_FORMAT_CHANGED, frame->width, frame->height, frame->format);
+  }
+  av_image_copy(image->data, image->line_size,
+                (const uint8_t **)(frame->data), frame->linesize,
+                frame->format, frame->width, frame->height);
+  CallbackContext ctx = {
+    .session = s,
+    .ptr = image->data[0],
+    .size = image->size,
+    .width = frame->width,
+    .height = frame->height,
+    .pts = to_milliseconds(to_microseconds(frame->best_effort_timestamp, time_base)),
+    .duration = frame_duration(s, frame, time_base) / 1000.0,
+  };
+  emscripten_proxy_sync(proxy_queue, main, &invokeVideoFrameParsedCallback, &ctx);
+  return s->ladder ? output_renditions(s, frame) : 0;
+}
+
+static int output_audio_frame(Session *s, AVFrame *frame, AVRational time_base)
+{
+  if (s->abort_request) return AVERROR_EXIT;
+  if (frame->sample_rate != s->sample_rate || frame->ch_layout.nb_channels != s->channels || frame->format != s->sample_fmt)
+  {
+    s->sample_rate = frame->sample_rate;
+    s->channels = frame->ch_layout.nb_channels;
+    s->sample_fmt = frame->format;
+    fire_session_event(s, DD_EVENT_AUDIO_FORMAT_CHANGED, s->sample_rate, s->channels, s->sample_fmt);
+  }
+  size_t unpadded_linesize = frame->nb_samples * av_get_bytes_per_sample(frame->format);
+  CallbackContext ctx = {
+    .session = s,
+    .ptr = frame->extended_data[0],
+    .size = unpadded_linesize,
+    .pts = to_milliseconds(to_microseconds(frame->best_effort_timestamp, time_base)),
+    .duration = frame_duration(s, frame, time_base) / 1000.0,
+  };
+  emscripten_proxy_sync(proxy_queue, main, &invokeAudioFrameParsedCallback, &ctx);
+  return 0;
+}
+
+// swap in the filter graphs asked for by dd_set_filters, they are built on the next frame
+static void apply_filter_changes(Session *s)
+{
+  char *descriptions[2];
+
+  pthread_mutex_lock(&s->mutex);
+  for (int type = AVMEDIA_TYPE_VIDEO; type <= AVMEDIA_TYPE_AUDIO; type++)
+  {
+    descriptions[type] = s->pending_filters[type];
+    s->pending_filters[type] = NULL;
+  }
+  s->filters_changed = 0;
+  pthread_mutex_unlock(&s->mutex);
+
+  for (int type = AVMEDIA_TYPE_VIDEO; type <= AVMEDIA_TYPE_AUDIO; type++)
+  {
+    filter_graph_free(&s->filters[type]);
+    if (descriptions[type] && filter_graph_create(&s->filters[type], type, descriptions[type], workers, s->priority) < 0)
+    {
+      fprintf(stderr, "Could not allocate %s filter graph!\n", av_get_media_type_string(type));
+    }
+    av_free(descriptions[type]);
+  }
+}
+
+static int output_frame(Session *s, enum AVMediaType type, AVFrame *frame, AVRational time_base)
+{
+  return type == AVMEDIA_TYPE_VIDEO ? output_video_frame(s, frame, time_base) : output_audio_frame(s, frame, time_base);
+}
+
+// pass a decoded frame through the filter graph of its type, if any. a graph that
+// cannot be built for the frame is dropped so playback goes on unfiltered.
+static int filter_frame(Session *s, AVCodecContext *ctx, AVFrame *frame)
+{
+  int ret;
+  enum AVMediaType type = ctx->codec->type;
+  FilterGraph *graph = s->filters[type];
+
+  if (!graph)
+  {
+    return output_frame(s, type, frame, ctx->pkt_timebase);
+  }
+
+  graph->priority = s->priority;
+  if ((ret = filter_graph_send_frame(graph, frame, ctx->pkt_timebase)) < 0)
+  {
+    filter_graph_free(&s->filters[type]);
+    fire_session_event(s, DD_EVENT_FILTERS_CONFIGURED, type, ret, 0);
+    return output_frame(s, type, frame, ctx->pkt_timebase);
+  }
+  if (ret > 0)
+  {
+    fire_session_event(s, DD_EVENT_FILTERS_CONFIGURED, type, 0, 0);
+  }
+
+  while ((ret = filter_graph_receive_frame(graph, s->filt_frame)) >= 0)
+  {
+    ret = output_frame(s, type, s->filt_frame, filter_graph_time_base(graph));
+    av_frame_unref(s->filt_frame);
+    if (ret < 0)
+      return ret;
+  }
+  return (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) ? 0 : ret;
+}
+
+// how far the delivered audio is ahead of the playback clock
+static int64_t audio_buffered(Session *s)
+{
+  int64_t position;
+  if (s->audio_end == AV_NOPTS_VALUE) return 0;
+  pthread_mutex_lock(&s->mutex);
+  position = s->audio_clock + (av_gettime_relative() - s->audio_clock_time);
+  pthread_mutex_unlock(&s->mutex);
+  return s->audio_end - position;
+}
+
+static void note_audio_frame(Session *s, AVFrame *frame)
+{
+  int64_t pts = frame->best_effort_timestamp;
+  if (pts == AV_NOPTS_VALUE || frame->sample_rate <= 0) return;
+  pts = av_rescale_q(pts, s->audio_stream->time_base, AV_TIME_BASE_Q);
+  if (s->audio_end == AV_NOPTS_VALUE)
+  {
+    // playback starts with the first audio unless the consumer reports otherwise
+    pthread_mutex_lock(&s->mutex);
+    s->audio_clock = pts;
+    s->audio_clock_time = av_gettime_relative();
+    pthread_mutex_unlock(&s->mutex);
+  }
+  s->audio_end = pts + av_rescale(frame->nb_samples, AV_TIME_BASE, frame->sample_rate);
+}
+
+// whether audio runs short. video then skips non-reference frames until it recovers
+static int audio_is_low(Session *s)
+{
+  int64_t buffered;
+  int low;
+
+  if (!s->min_audio_buffer || !s->audio_stream || !s->video_dec_ctx || s->rate != 1) return 0;
+
+  buffered = audio_buffered(s);
+  low = s->audio_end == AV_NOPTS_VALUE || buffered < s->min_audio_buffer;
+  if (low && !s->audio_low)
+  {
+    s->audio_low_count++;
+    if (s->audio_end != AV_NOPTS_VALUE && buffered <= 0) s->audio_underruns++;
+  }
+  s->audio_low = low;
+  s->video_dec_ctx->skip_frame = low ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+  return low;
+}
+
+// whether frame ends before the target of the last dd_seek, it is then decoded
+// only to get there
+static int frame_before_seek(Session *s, AVFrame *frame, AVRational time_base)
+{
+  int64_t pts = to_microseconds(frame->best_effort_timestamp, time_base);
+  if (s->seek_skip_until == AV_NOPTS_VALUE || pts == AV_NOPTS_VALUE) return 0;
+  return pts + frame_duration(s, frame, time_base) <= s->seek_skip_until;
+}
+
+// the cache is best effort, a frame it cannot take is simply not cached
+static void cache_video_frame(Session *s, AVFrame *frame, AVRational time_base)
+{
+  int64_t pts = to_microseconds(frame->best_effort_timestamp, time_base);
+  if (frame->pict_type == AV_PICTURE_TYPE_I || s->gop_start == AV_NOPTS_VALUE) s->gop_start = pts;
+  frame_cache_put(s->cache, frame, pts, frame_duration(s, frame, time_base), s->gop_start);
+}
+
+static int decode_packet(Session *s, AVCodecContext *ctx, AVPacket *pkt)
+{
+  int ret = 0;
+  int skip;
+
+  if ((ret = avcodec_send_packet(ctx, pkt)) < 0)
+  {
+    fprintf(stderr, "Error submitting a packet for decoding (%s)\n", av_err2str(ret));
+    return ret;
+  }
+
+  while (ret >= 0)
+  {
+    if ((ret = avcodec_receive_frame(ctx, s->frame)) < 0)
+    {
+      if (ret == AVERROR_EOF || ret == AVERROR(EAGAIN)) return 0;
+      fprintf(stderr, "Error during decoding (%s)\n", av_err2str(ret));
+      return ret;
+    }
+
+    skip = frame_before_seek(s, s->frame, ctx->pkt_timebase);
+    if (ctx->codec->type == AVMEDIA_TYPE_VIDEO && s->cache && (!skip || s->cache_gop))
+    {
+      cache_video_frame(s, s->frame, ctx->pkt_timebase);
+    }
+    if (skip)
+    {
+      av_frame_unref(s->frame);
+      continue;
+    }
+
+    if (ctx->codec->type == AVMEDIA_TYPE_AUDIO)
+    {
+      note_audio_frame(s, s->frame);
+    }
+    else if (video_frame_is_late(s, s->frame, ctx->pkt_timebase))
+    {
+      s->video_late++;
+      av_frame_unref(s->frame);
+      continue;
+    }
+    else
+    {
+      s->position = to_microseconds(s->frame->best_effort_timestamp, ctx->pkt_timebase);
+    }
+    ret = filter_frame(s, ctx, s->frame);
+    av_frame_unref(s->frame);
+    if (ret < 0)
+      return ret;
+  }
+
+  return 0;
+}
+
+static int decode_video_packet(Session *s, AVPacket *pkt)
+{
+  if (s->video_dec_ctx->skip_frame != trick_discard(s->rate)) s->video_degraded++;
+  // at keyframe rates the rest is not even sent to the decoder
+  if (s->video_dec_ctx->skip_frame == AVDISCARD_NONKEY && !(pkt->flags & AV_PKT_FLAG_KEY))
+  {
+    s->video_skipped++;
+    return 0;
+  }
+  return decode_packet(s, s->video_dec_ctx, pkt);
+}
+
+// hold a video packet back so the reader gets to the next audio packet sooner
+static int defer_video_packet(Session *s, AVPacket *pkt)
+{
+  AVPacket **slot = &s->deferred[s->nb_deferred];
+  if (!*slot && !(*slot = av_packet_alloc()))
+  {
+    return AVERROR(ENOMEM);
+  }
+  av_packet_move_ref(*slot, pkt);
+  s->nb_deferred++;
+  s->video_deferred++;
+  return 0;
+}
+
+// decode the held back video packets in order, drop them when decode is false
+static int flush_deferred_video(Session *s, int decode)
+{
+  int ret = 0;
+  int i;
+  for (i = 0; i < s->nb_deferred; i++)
+  {
+    if (decode && ret >= 0 && !s->abort_request)
+    {
+      ret = decode_video_packet(s, s->deferred[i]);
+    }
+    av_packet_unref(s->deferred[i]);
+  }
+  s->nb_deferred = 0;
+  return ret;
+}
+
+// seek the input itself and drop what the decoders hold from before
+static int seek_input(Session *s, int64_t target)
+{
+  int ret;
+
+  if (s->timeshift)
+  {
+    // a live input seeks within what the timeshift buffer holds, nothing is read again
+    pthread_mutex_lock(&s->mutex);
+    ret = timeshift_seek(s->timeshift, target);
+    pthread_mutex_unlock(&s->mutex);
+  }
+  else
+  {
+    ret = avformat_seek_file(s->fmt_ctx, -1, INT64_MIN, target, target, 0);
+  }
+  if (ret < 0)
+  {
+    fprintf(stderr, "Could not seek to %" PRId64 " (%s)\n", target, av_err2str(ret));
+    s->seek_skip_until = AV_NOPTS_VALUE;
+    return ret;
+  }
+  if (s->video_dec_ctx) avcodec_flush_buffers(s->video_dec_ctx);
+  if (s->audio_dec_ctx) avcodec_flush_buffers(s->audio_dec_ctx);
+  s->gop_start = AV_NOPTS_VALUE;
+  return 0;
+}
+
+// go to the target of dd_seek. a frame the cache holds for it goes out right away and
+// the input stays where it is until playback goes on from there, see resume_seek.
+// otherwise decoding catches up from the previous keyframe without output up to there.
+static int apply_seek(Session *s)
+{
+  int ret = 0;
+  int64_t target;
+  CachedFrame *cached = NULL;
+
+  pthread_mutex_lock(&s->mutex);
+  target = s->seek_target;
+  s->seek_requested = 0;
+  pthread_mutex_unlock(&s->mutex);
+
+  flush_deferred_video(s, 0);
+
+  if (s->cache && s->video_dec_ctx && (cached = frame_cache_get(s->cache, target)))
+  {
+    s->seek_skip_until = cached->pts + cached->duration;
+    if ((ret = av_frame_ref(s->frame, cached->frame)) < 0)
+      return ret;
+    ret = filter_frame(s, s->video_dec_ctx, s->frame);
+    av_frame_unref(s->frame);
+    if (ret < 0)
+      return ret;
+    s->pending_seek = target;
+  }
+  else
+  {
+    s->seek_skip_until = target;
+    s->pending_seek = AV_NOPTS_VALUE;
+    ret = seek_input(s, target);
+  }
+  if (ret >= 0)
+  {
+    s->position = target;
+    // the clocks start over from the target
+    pthread_mutex_lock(&s->mutex);
+    s->audio_end = AV_NOPTS_VALUE;
+    s->wall_origin = cached ? cached->pts : AV_NOPTS_VALUE;
+    s->wall_origin_time = av_gettime_relative();
+    pthread_mutex_unlock(&s->mutex);
+  }
+  fire_session_event(s, DD_EVENT_SEEKED, cached != NULL, ret < 0 ? ret : 0, 0);
+  return 0;
+}
+
+// after a seek the cache answered, hold the input until the frame shown ran out on
+// the clock, then seek it for real. seeks meanwhile are taken here, those the cache
+// answers as well need no decoding at all.
+static int resume_seek(Session *s)
+{
+  int ret;
+  int hold;
+  int64_t now, wait = 0;
+  struct timespec deadline;
+
+  while (s->pending_seek != AV_NOPTS_VALUE)
+  {
+    if (s->abort_request) return AVERROR_EXIT;
+    if (s->seek_requested)
+    {
+      if ((ret = apply_seek(s)) < 0) return ret;
+      continue;
+    }
+    pthread_mutex_lock(&s->mutex);
+    hold = !s->rate_changed && s->clock != DD_CLOCK_NONE && (now = clock_now(s)) != AV_NOPTS_VALUE &&
+           (wait = s->seek_skip_until - now) > 0;
+    if (hold && !s->seek_requested && !s->abort_request)
+    {
+      deadline_after(&deadline, FFMIN(wait / 1000 + 1, PACE_POLL_MS));
+      pthread_cond_timedwait(&s->cond, &s->mutex, &deadline);
+    }
+    pthread_mutex_unlock(&s->mutex);
+    if (hold) continue;
+
+    // a failed seek plays on from where the input was
+    seek_input(s, s->pending_seek);
+    s->pending_seek = AV_NOPTS_VALUE;
+  }
+  return 0;
+}
+
+// switch to the rate asked for by dd_set_playback_rate. the clocks start over at
+// the new rate, reverse play needs video.
+static void apply_rate_change(Session *s)
+{
+  double rate;
+
+  pthread_mutex_lock(&s->mutex);
+  rate = s->pending_rate;
+  s->rate_changed = 0;
+  pthread_mutex_unlock(&s->mutex);
+
+  if (rate < 0 && !s->video_dec_ctx)
+  {
+    fire_session_event(s, DD_EVENT_RATE_CHANGED, (long)(s->rate * 100), AVERROR(ENOSYS), 0);
+    return;
+  }
+  s->rate = rate;
+  if (s->video_dec_ctx) s->video_dec_ctx->skip_frame = trick_discard(rate);
+  s->audio_end = AV_NOPTS_VALUE;
+  s->wall_origin = AV_NOPTS_VALUE;
+  fire_session_event(s, DD_EVENT_RATE_CHANGED, (long)(rate * 100), 0, 0);
+}
+
+static long frame_size(const AVFrame *frame)
+{
+  long size = 0;
+  for (int i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; i++)
+  {
+    size += frame->buf[i]->size;
+  }
+  return size;
+}
+
+// the next packet of the input into pkt, from the segment demuxer for segment input.
+// pkt->time_base is set to its stream's
+static int demux_packet(Session *s, AVPacket *pkt)
+{
+  int ret;
+  if (s->segment_input) return segment_demuxer_read(s->segments, pkt, &s->abort_request);
+  if ((ret = av_read_frame(s->fmt_ctx, pkt)) >= 0 && (unsigned)pkt->stream_index < s->fmt_ctx->nb_streams)
+  {
+    pkt->time_base = s->fmt_ctx->streams[pkt->stream_index]->time_base;
+  }
+  return ret;
+}
+
+// decode what shows before end, starting from the keyframe before it, into frames.
+// when they outgrow the buffer the earliest go, the caller gets back to those in the
+// next pass.
+static int reverse_fill(Session *s, AVFrame **frames, int *nb_frames, int64_t end)
+{
+  int ret;
+  int done = 0;
+  int overflowed = 0;
+  long size = 0;
+  AVStream *st = s->video_stream;
+  AVCodecContext *ctx = s->video_dec_ctx;
+  int64_t ts = av_rescale_q(end, AV_TIME_BASE_Q, st->time_base) - 1;
+
+  *nb_frames = 0;
+  // nothing left before end
+  if (avformat_seek_file(s->fmt_ctx, st->index, INT64_MIN, ts, ts, 0) < 0) return 0;
+  avcodec_flush_buffers(ctx);
+
+  while (!done && !s->abort_request)
+  {
+    if ((ret = demux_packet(s, s->pkt)) >= 0)
+    {
+      if (s->pkt->stream_index != st->index ||
+          (ctx->skip_frame == AVDISCARD_NONKEY && !(s->pkt->flags & AV_PKT_FLAG_KEY)))
+      {
+        av_packet_unref(s->pkt);
+        continue;
+      }
+      // keyframes only needs just the first one
+      done = ctx->skip_frame == AVDISCARD_NONKEY;
+      ret = avcodec_send_packet(ctx, s->pkt);
+      av_packet_unref(s->pkt);
+      if (ret < 0)
+        return ret;
+    }
+    if (ret == AVERROR_EOF || done)
+    {
+      avcodec_send_packet(ctx, NULL);
+      done = 1;
+    }
+    else if (ret < 0)
+    {
+      return ret;
+    }
+
+    while ((ret = avcodec_receive_frame(ctx, s->frame)) >= 0)
+    {
+      int64_t pts = to_microseconds(s->frame->best_effort_timestamp, ctx->pkt_timebase);
+      if (pts == AV_NOPTS_VALUE)
+      {
+        av_frame_unref(s->frame);
+        continue;
+      }
+      // frames come in pts order, the rest shows at end or later
+      if (pts >= end)
+      {
+        av_frame_unref(s->frame);
+        done = 1;
+        break;
+      }
+      while (*nb_frames && (*nb_frames == REVERSE_MAX_FRAMES || size + frame_size(s->frame) > s->reverse_buffer))
+      {
+        size -= frame_size(frames[0]);
+        av_frame_free(&frames[0]);
+        memmove(frames, frames + 1, --(*nb_frames) * sizeof(*frames));
+        overflowed = 1;
+      }
+      if (!(frames[*nb_frames] = av_frame_alloc()))
+      {
+        av_frame_unref(s->frame);
+        return AVERROR(ENOMEM);
+      }
+      av_frame_move_ref(frames[*nb_frames], s->frame);
+      size += frame_size(frames[(*nb_frames)++]);
+    }
+    if (ret != AVERROR(EAGAIN) && ret != AVERROR_EOF && ret < 0)
+      return ret;
+  }
+  s->reverse_redecodes += overflowed;
+  return 0;
+}
+
+// sleep until a reverse frame gap (us of stream time) after the previous one is due,
+// or the consumer wants something else
+static void pace_reverse(Session *s, int64_t *due, int64_t gap)
+{
+  int64_t wait;
+  struct timespec deadline;
+
+  if (s->clock == DD_CLOCK_NONE) return;
+
+  *due += (int64_t)(gap / fabs(s->rate));
+  pthread_mutex_lock(&s->mutex);
+  while (!s->abort_request && !s->seek_requested && !s->rate_changed && (wait = *due - av_gettime_relative()) > 0)
+  {
+    deadline_after(&deadline, FFMIN(wait / 1000 + 1, PACE_POLL_MS));
+    pthread_cond_timedwait(&s->cond, &s->mutex, &deadline);
+  }
+  pthread_mutex_unlock(&s->mutex);
+  // no catching up after a stall
+  *due = FFMAX(*due, av_gettime_relative());
+}
+
+// play video backwards from the current position a gop at a time: each is decoded
+// into a bounded buffer and output backwards. a gop larger than the buffer is decoded
+// again for each part that fits. stays on the first frame until the rate changes.
+static int reverse_run(Session *s)
+{
+  int ret = 0;
+  int nb_frames = 0;
+  int64_t due = av_gettime_relative();
+  AVFrame **frames;
+
+  if (!(frames = av_calloc(REVERSE_MAX_FRAMES, sizeof(*frames))))
+  {
+    return AVERROR(ENOMEM);
+  }
+
+  while (!s->abort_request && s->rate < 0)
+  {
+    if (s->rate_changed)
+    {
+      apply_rate_change(s);
+      continue;
+    }
+    if (s->seek_requested)
+    {
+      pthread_mutex_lock(&s->mutex);
+      s->position = s->seek_target;
+      s->seek_requested = 0;
+      pthread_mutex_unlock(&s->mutex);
+      fire_session_event(s, DD_EVENT_SEEKED, 0, 0, 0);
+    }
+
+    if (s->position == AV_NOPTS_VALUE ||
+        (ret = reverse_fill(s, frames, &nb_frames, s->position)) < 0 || !nb_frames)
+    {
+      if (ret < 0)
+        break;
+      // at the start, hold the last frame
+      pthread_mutex_lock(&s->mutex);
+      while (!s->abort_request && !s->seek_requested && !s->rate_changed)
+      {
+        pthread_cond_wait(&s->cond, &s->mutex);
+      }
+      pthread_mutex_unlock(&s->mutex);
+      continue;
+    }
+
+    for (int i = nb_frames - 1; i >= 0 && ret >= 0; i--)
+    {
+      AVRational time_base = s->video_dec_ctx->pkt_timebase;
+      int64_t pts = to_microseconds(frames[i]->best_effort_timestamp, time_base);
+      if (s->abort_request || s->seek_requested || s->rate_changed) break;
+      // a frame shows until the later one shown before it
+      pace_reverse(s, &due, s->position > pts ? s->position - pts : frame_duration(s, frames[i], time_base));
+      s->position = pts;
+      ret = filter_frame(s, s->video_dec_ctx, frames[i]);
+    }
+    for (int i = 0; i < nb_frames; i++)
+    {
+      av_frame_free(&frames[i]);
+    }
+    nb_frames = 0;
+    if (ret < 0)
+      break;
+  }
+
+  for (int i = 0; i < nb_frames; i++)
+  {
+    av_frame_free(&frames[i]);
+  }
+  av_free(frames);
+  if (s->abort_request)
+    return 0;
+  if (ret < 0)
+    return ret;
+
+  // forward play goes on from where reverse stopped
+  pthread_mutex_lock(&s->mutex);
+  if (!s->seek_requested)
+  {
+    s->seek_target = s->position;
+    s->seek_requested = 1;
+  }
+  pthread_mutex_unlock(&s->mutex);
+  return 0;
+}
+
+// pick the streams to work on. unselected tracks never get a decoder, a warm one
+// is released to give the memory back. remuxing and packet output need no decoder
+// at all and leave the warm ones untouched for the next input.
+static void select_streams(Session *s)
+{
+  if (s->mode & (DD_MODE_REMUX | DD_MODE_PACKETS))
+  {
+    if (s->tracks & DD_TRACK_VIDEO) find_stream(&s->video_stream, s->fmt_ctx, AVMEDIA_TYPE_VIDEO);
+    if (s->tracks & DD_TRACK_AUDIO) find_stream(&s->audio_stream, s->fmt_ctx, AVMEDIA_TYPE_AUDIO);
+    return;
+  }
+
+  if (s->tracks & DD_TRACK_VIDEO)
+  {
+    open_codec_context(s, &s->video_dec_ctx, &s->video_stream, s->fmt_ctx, AVMEDIA_TYPE_VIDEO);
+  }
+  else
+  {
+    avcodec_free_context(&s->video_dec_ctx);
+  }
+  if (s->tracks & DD_TRACK_AUDIO)
+  {
+    open_codec_context(s, &s->audio_dec_ctx, &s->audio_stream, s->fmt_ctx, AVMEDIA_TYPE_AUDIO);
+  }
+  else
+  {
+    avcodec_free_context(&s->audio_dec_ctx);
+  }
+}
+
+// packets go straight from the demuxer into the fragmented mp4 muxer
+static int remux_run(Session *s)
+{
+  int ret;
+  AVStream *streams[2] = { s->video_stream, s->audio_stream };
+
+  if ((ret = remuxer_create(&s->remuxer, streams, 2, s->fmt_ctx->nb_streams, &output_segment, s)) < 0)
+  {
+    fprintf(stderr, "Could not create remuxer!\n");
+    return ret;
+  }
+
+  while (demux_packet(s, s->pkt) >= 0)
+  {
+    if (s->abort_request)
+    {
+      av_packet_unref(s->pkt);
+      return 0;
+    }
+    ret = remuxer_write(s->remuxer, s->pkt);
+    av_packet_unref(s->pkt);
+    if (ret < 0)
+      return ret;
+  }
+
+  return remuxer_finish(s->remuxer);
+}
+
+static void output_thumbnail(Session *s, Thumbnailer *thumbnailer)
+{
+  CallbackContext ctx = {
+    .session = s,
+    .index = thumbnailer->nb_images - 1,
+    .ptr = thumbnailer->pkt->data,
+    .size = thumbnailer->pkt->size,
+    .pts = thumbnailer->image_pts / 1000.0,
+  };
+  emscripten_proxy_sync(proxy_queue, main, &invokeThumbnailParsedCallback, &ctx);
+}
+
+// decode the next keyframe of the video stream into s->frame, 0 at the end of the input
+static int decode_keyframe(Session *s, AVCodecContext *ctx)
+{
+  int ret;
+
+  avcodec_flush_buffers(ctx);
+  while (demux_packet(s, s->pkt) >= 0)
+  {
+    if (s->abort_request)
+    {
+      av_packet_unref(s->pkt);
+      return 0;
+    }
+    if (s->pkt->stream_index != s->video_stream->index || !(s->pkt->flags & AV_PKT_FLAG_KEY))
+    {
+      av_packet_unref(s->pkt);
+      continue;
+    }
+    ret = avcodec_send_packet(ctx, s->pkt);
+    av_packet_unref(s->pkt);
+    if (ret < 0)
+      return ret;
+    // a keyframe decodes on its own, draining gets it out of decoders that hold frames back
+    avcodec_send_packet(ctx, NULL);
+    if ((ret = avcodec_receive_frame(ctx, s->frame)) >= 0)
+      return 1;
+    if (ret != AVERROR_EOF && ret != AVERROR(EAGAIN))
+      return ret;
+    avcodec_flush_buffers(ctx);
+  }
+  return 0;
+}
+
+// one keyframe per interval is decoded and encoded to a thumbnail. a file input seeks
+// to the keyframe nearest each interval, a stream is read through with every other
+// packet dropped before the decoder.
+static int thumbnails_run(Session *s)
+{
+  int ret;
+  int seekable = !s->store->is_stream;
+  int64_t pts, last = AV_NOPTS_VALUE;
+  int64_t next = 0;
+  AVStream *st = s->video_stream;
+  AVCodecContext *ctx = s->video_dec_ctx;
+  Thumbnailer *thumbnailer;
+  CallbackContext map = { .session = s };
+
+  if (!ctx)
+  {
+    fprintf(stderr, "Could not find a video stream for thumbnails\n");
+    return AVERROR_STREAM_NOT_FOUND;
+  }
+  if ((ret = thumbnailer_create(&thumbnailer, s->thumb_width, s->thumb_height, s->thumb_columns, s->thumb_rows,
+                                s->thumb_codec, s->thumb_quality)) < 0)
+  {
+    return ret;
+  }
+  ctx->skip_frame = AVDISCARD_NONKEY;
+  if (st->start_time != AV_NOPTS_VALUE) next = to_microseconds(st->start_time, st->time_base);
+
+  while (!s->abort_request)
+  {
+    if (seekable)
+    {
+      int64_t ts = av_rescale_q(next, AV_TIME_BASE_Q, st->time_base);
+      int64_t min_ts = last == AV_NOPTS_VALUE ? INT64_MIN : av_rescale_q(last, AV_TIME_BASE_Q, st->time_base) + 1;
+      // the keyframe nearest to next that comes after the previous thumbnail
+      if (avformat_seek_file(s->fmt_ctx, st->index, min_ts, ts, INT64_MAX, 0) < 0)
+        break;
+    }
+    if ((ret = decode_keyframe(s, ctx)) <= 0)
+      break;
+
+    pts = to_microseconds(s->frame->best_effort_timestamp, ctx->pkt_timebase);
+    if (pts == AV_NOPTS_VALUE) pts = next;
+    if (last != AV_NOPTS_VALUE && pts <= last)
+    {
+      // a demuxer that cannot seek precisely is read through from here instead
+      seekable = 0;
+    }
+    if (last != AV_NOPTS_VALUE && pts < next)
+    {
+      av_frame_unref(s->frame);
+      continue;
+    }
+
+    ret = thumbnailer_add(thumbnailer, s->frame, pts);
+    av_frame_unref(s->frame);
+    if (ret < 0)
+      break;
+    if (ret > 0)
+      output_thumbnail(s, thumbnailer);
+    last = pts;
+    while (next <= pts) next += s->thumb_interval;
+  }
+
+  if (ret >= 0 && (ret = thumbnailer_flush(thumbnailer, next)) > 0)
+  {
+    output_thumbnail(s, thumbnailer);
+  }
+  if (ret >= 0)
+  {
+    map.ptr = (uint8_t *)thumbnailer_vtt(thumbnailer, &map.size);
+    emscripten_proxy_sync(proxy_queue, main, &invokeThumbnailMapCallback, &map);
+  }
+  thumbnailer_free(&thumbnailer);
+  return ret < 0 ? ret : 0;
+}
+
+// gops of the timeshift buffer follow the video keyframes, or every audio packet without video
+static int starts_gop(Session *s, AVPacket *pkt)
+{
+  if (!(pkt->flags & AV_PKT_FLAG_KEY)) return 0;
+  return !s->video_stream || pkt->stream_index == s->video_stream->index;
+}
+
+// whether the next packet of the input can be read without waiting long for write_dd
+static int live_data_ready(Session *s)
+{
+  int ready;
+  if (s->segment_input) return segment_demuxer_ready(s->segments);
+  if (s->io_ctx->buf_ptr < s->io_ctx->buf_end) return 1;
+  if (s->ingest) return chunk_store_lag(s->ingest) > 0 || s->ingest->store->is_done;
+  pthread_mutex_lock(&s->mutex);
+  ready = memory_stream_get_available(s->store) > 0 || s->store->is_done;
+  pthread_mutex_unlock(&s->mutex);
+  return ready;
+}
+
+static int read_live_packet(Session *s)
+{
+  int ret;
+  int64_t pts = AV_NOPTS_VALUE;
+
+  if ((ret = demux_packet(s, s->pkt)) < 0)
+  {
+    return ret;
+  }
+  if ((unsigned)s->pkt->stream_index < s->fmt_ctx->nb_streams)
+  {
+    AVRational time_base = s->fmt_ctx->streams[s->pkt->stream_index]->time_base;
+    pts = to_microseconds(s->pkt->pts != AV_NOPTS_VALUE ? s->pkt->pts : s->pkt->dts, time_base);
+  }
+  pthread_mutex_lock(&s->mutex);
+  ret = timeshift_put(s->timeshift, s->pkt, pts, starts_gop(s, s->pkt));
+  pthread_mutex_unlock(&s->mutex);
+  av_packet_unref(s->pkt);
+  return ret;
+}
+
+// the next packet to decode from the jitter buffer. the input is read into it while
+// some is buffered, or while nothing is held anyway, otherwise the session sleeps until
+// write_dd brings more or the earliest packet is due. what is left goes out right away
+// once the input ended
+static int read_jittered_packet(Session *s)
+{
+  int ret;
+  int64_t wait;
+  struct timespec deadline;
+
+  for (;;)
+  {
+    if (s->abort_request) return AVERROR_EXIT;
+    pthread_mutex_lock(&s->mutex);
+    ret = s->live_ended ? jitter_buffer_flush(s->jitter, s->pkt) : jitter_buffer_get(s->jitter, s->pkt, av_gettime_relative(), &wait);
+    pthread_mutex_unlock(&s->mutex);
+    if (ret != 0) return ret < 0 ? ret : 0;
+    if (s->live_ended) return AVERROR_EOF;
+
+    if (wait < 0 || live_data_ready(s))
+    {
+      if ((ret = demux_packet(s, s->pkt)) == AVERROR_EOF)
+      {
+        s->live_ended = 1;
+        continue;
+      }
+      if (ret < 0) return ret;
+      pthread_mutex_lock(&s->mutex);
+      ret = jitter_buffer_put(s->jitter, s->pkt, s->pkt->time_base.num ? s->pkt->time_base : AV_TIME_BASE_Q, av_gettime_relative());
+      pthread_mutex_unlock(&s->mutex);
+      av_packet_unref(s->pkt);
+      if (ret < 0) return ret;
+      continue;
+    }
+    // a shared ingest does not signal the session, it is looked at every PACE_POLL_MS
+    deadline_after(&deadline, s->ingest ? FFMIN(wait / 1000 + 1, PACE_POLL_MS) : wait / 1000 + 1);
+    pthread_mutex_lock(&s->mutex);
+    pthread_cond_timedwait(&s->cond, &s->mutex, &deadline);
+    pthread_mutex_unlock(&s->mutex);
+  }
+}
+
+// the next packet to decode. with a timeshift buffer every demuxed packet goes into it
+// and the one decoded is taken at its cursor, behind the live edge after a pause or a
+// seek back. the input is read on meanwhile, so live data never piles up in the store.
+static int read_packet(Session *s)
+{
+  int ret;
+  int behind;
+
+  if ((ret = resume_seek(s)) < 0) return ret;
+  if (s->jitter) return read_jittered_packet(s);
+  if (!s->timeshift) return demux_packet(s, s->pkt);
+  for (;;)
+  {
+    if (s->abort_request) return AVERROR_EXIT;
+    if (s->seek_requested && (ret = apply_seek(s)) < 0) return ret;
+    if ((ret = resume_seek(s)) < 0) return ret;
+    // the clock starts over where playback resumes
+    if (s->was_paused && !s->paused) s->wall_origin = AV_NOPTS_VALUE;
+    s->was_paused = s->paused;
+
+    pthread_mutex_lock(&s->mutex);
+    behind = !s->paused && timeshift_behind(s->timeshift);
+    pthread_mutex_unlock(&s->mutex);
+    if (!s->live_ended && (!behind || live_data_ready(s)))
+    {
+      if ((ret = read_live_packet(s)) == AVERROR_EOF) s->live_ended = 1;
+      else if (ret < 0) return ret;
+      if (!behind) continue;
+    }
+    if (behind)
+    {
+      pthread_mutex_lock(&s->mutex);
+      ret = timeshift_next(s->timeshift, s->pkt);
+      pthread_mutex_unlock(&s->mutex);
+      if (ret != 0) return ret < 0 ? ret : 0;
+      continue;
+    }
+    if (!s->paused) return AVERROR_EOF;
+    // paused after the input ended, the buffer is all there is left to play
+    pthread_mutex_lock(&s->mutex);
+    while (s->paused && !s->abort_request && !s->seek_requested)
+    {
+      pthread_cond_wait(&s->cond, &s->mutex);
+    }
+    pthread_mutex_unlock(&s->mutex);
+  }
+}
+
+// whether the demuxer has consumed everything written so far, a partial batch is
+// handed over then instead of waiting for packets that are not there yet
+static int store_is_drained(Session *s)
+{
+  int drained;
+  if (s->segment_input) return !segment_demuxer_ready(s->segments);
+  if (s->ingest) return chunk_store_lag(s->ingest) == 0;
+  pthread_mutex_lock(&s->mutex);
+  drained = memory_stream_get_available(s->store) == 0;
+  pthread_mutex_unlock(&s->mutex);
+  return drained;
+}
+
+// queue one output packet of st, flushing first when it carries new extradata
+static int batch_packet(Session *s, AVStream *st, AVPacket *pkt, AVRational time_base)
+{
+  size_t size;
+  uint8_t *extradata;
+
+  if ((extradata = av_packet_get_side_data(pkt, AV_PKT_DATA_NEW_EXTRADATA, &size)))
+  {
+    output_packets(s);
+    output_codec_config(s, st, extradata, size);
+  }
+  pkt->stream_index = st->index;
+  if (packet_batch_is_full(s->packets))
+  {
+    output_packets(s);
+  }
+  return packet_batch_add(s->packets, pkt, time_base);
+}
+
+// run pkt of st through its bitstream filters into the batch. a NULL pkt drains
+// the filters at the end of the input.
+static int emit_packet(Session *s, AVStream *st, AVPacket *pkt)
+{
+  int ret;
+  AVBSFContext *bsf = s->bsfs[st->codecpar->codec_type];
+
+  if (!bsf)
+  {
+    return pkt ? batch_packet(s, st, pkt, st->time_base) : 0;
+  }
+
+  if ((ret = av_bsf_send_packet(bsf, pkt)) < 0)
+  {
+    fprintf(stderr, "Error submitting a packet for filtering (%s)\n", av_err2str(ret));
+    return ret;
+  }
+  while ((ret = av_bsf_receive_packet(bsf, s->pkt)) >= 0)
+  {
+    ret = batch_packet(s, st, s->pkt, bsf->time_base_out);
+    av_packet_unref(s->pkt);
+    if (ret < 0)
+      return ret;
+  }
+  return (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) ? 0 : ret;
+}
+
+// compressed packets go to the consumer through the configured bitstream filters,
+// batched to keep the number of main thread round trips low. every selected stream
+// reports its codec config first and again whenever the container carries new extradata.
+static int packets_run(Session *s)
+{
+  int ret;
+  AVStream *st;
+
+  if (s->packets && s->packets->capacity != s->batch_size)
+  {
+    packet_batch_free(&s->packets);
+  }
+  if (!s->packets && (ret = packet_batch_create(&s->packets, s->batch_size)) < 0)
+  {
+    fprintf(stderr, "Could not allocate packet batch!\n");
+    return ret;
+  }
+  packet_batch_reset(s->packets);
+
+  for (int type = AVMEDIA_TYPE_VIDEO; type <= AVMEDIA_TYPE_AUDIO; type++)
+  {
+    st = type == AVMEDIA_TYPE_VIDEO ? s->video_stream : s->audio_stream;
+    if (!st) continue;
+    if ((ret = open_stream_bsf(s, st)) < 0)
+      return ret;
+    output_stream_config(s, st);
+  }
+
+  while (demux_packet(s, s->pkt) >= 0)
+  {
+    if (s->abort_request)
+    {
+      av_packet_unref(s->pkt);
+      return 0;
+    }
+    if (s->switch_requested)
+    {
+      // packets of the old stream go out before the new codec config
+      output_packets(s);
+      apply_stream_switches(s);
+    }
+    st = s->fmt_ctx->streams[s->pkt->stream_index];
+    if (st != s->video_stream && st != s->audio_stream)
+    {
+      av_packet_unref(s->pkt);
+      continue;
+    }
+    ret = emit_packet(s, st, s->pkt);
+    av_packet_unref(s->pkt);
+    if (ret < 0)
+      return ret;
+    if (store_is_drained(s))
+    {
+      output_packets(s);
+    }
+  }
+
+  if (s->video_stream && (ret = emit_packet(s, s->video_stream, NULL)) < 0)
+    return ret;
+  if (s->audio_stream && (ret = emit_packet(s, s->audio_stream, NULL)) < 0)
+    return ret;
+  output_packets(s);
+  return 0;
+}
+
+// open the input written to the store, or read through the ingest
+static int open_store_input(Session *s)
+{
+  int ret;
+
+  // avio
+  if (!(s->io_buffer = av_malloc(IO_BUFFER_SIZE)))
+  {
+    fprintf(stderr, "Could not allocate io buffer!\n");
+    return AVERROR(ENOMEM);
+  }
+
+  if (!(s->io_ctx = avio_alloc_context(s->io_buffer, IO_BUFFER_SIZE, 0, s,
+    s->store->is_stream ? &read_stream_store:&read_file_store,
+    NULL,
+    s->store->is_stream ? NULL : &seek_store)))
+  {
+    fprintf(stderr, "Could not allocate io context!\n");
+    av_freep(&s->io_buffer);
+    return AVERROR(ENOMEM);
+  }
+
+  // format
+  if (!(s->fmt_ctx = avformat_alloc_context()))
+  {
+    fprintf(stderr, "Could not allocate format context!\n");
+    return AVERROR(ENOMEM);
+  }
+  s->fmt_ctx->pb = s->io_ctx;
+  s->fmt_ctx->interrupt_callback.callback = &decode_interrupt_cb;
+  s->fmt_ctx->interrupt_callback.opaque = s;
+
+  if ((ret = avformat_open_input(&s->fmt_ctx, NULL, NULL, NULL)) != 0)
+  {
+    fprintf(stderr, "Could not open input!\n");
+    return ret;
+  }
+
+  if ((ret = avformat_find_stream_info(s->fmt_ctx, NULL)) != 0)
+  {
+    fprintf(stderr, "Could not find stream information!\n");
+    return ret;
+  }
+
+  return 0;
+}
+
+static int demux_decode_run(Session *s)
+{
+  int ret;
+  s->video_stream = NULL;
+  s->audio_stream = NULL;
+
+  // every input starts with a format notification
+  image_pool_reset(s->images);
+  s->sample_rate = 0;
+  s->channels = 0;
+  s->sample_fmt = AV_SAMPLE_FMT_NONE;
+
+  s->audio_end = AV_NOPTS_VALUE;
+  s->audio_low = 0;
+  s->audio_underruns = 0;
+  s->audio_low_count = 0;
+  s->video_deferred = 0;
+  s->video_degraded = 0;
+  s->video_late = 0;
+  s->wall_origin = AV_NOPTS_VALUE;
+  if (s->video_dec_ctx) s->video_dec_ctx->skip_frame = AVDISCARD_DEFAULT;
+
+  s->gop_start = AV_NOPTS_VALUE;
+  s->seek_skip_until = AV_NOPTS_VALUE;
+  s->pending_seek = AV_NOPTS_VALUE;
+  s->position = AV_NOPTS_VALUE;
+  s->rate = 1;
+  s->video_skipped = 0;
+  s->reverse_redecodes = 0;
+  s->was_paused = 0;
+  s->live_ended = 0;
+
+  if (s->segment_input)
+  {
+    // the first segment's format context, owned by the demuxer
+    if ((ret = segment_demuxer_open(s->segments, &s->fmt_ctx, &s->abort_request)) < 0)
+    {
+      fprintf(stderr, "Could not open segments!\n");
+      return ret;
+    }
+  }
+  else if ((ret = open_store_input(s)) != 0)
+  {
+    return ret;
+  }
+
+  // only now, probing waits for the first write_dd so the setters called before it
+  // have all been seen
+  pthread_mutex_lock(&s->mutex);
+  if (s->cache_budget && (ret = frame_cache_create(&s->cache, s->cache_budget, s->cache_gop)) < 0)
+  {
+    pthread_mutex_unlock(&s->mutex);
+    return ret;
+  }
+  if (s->timeshift_budget && (ret = timeshift_create(&s->timeshift, s->timeshift_budget, s->timeshift_window)) < 0)
+  {
+    pthread_mutex_unlock(&s->mutex);
+    return ret;
+  }
+  if (s->jitter_target && (ret = jitter_buffer_create(&s->jitter, s->jitter_target)) < 0)
+  {
+    pthread_mutex_unlock(&s->mutex);
+    return ret;
+  }
+  pthread_mutex_unlock(&s->mutex);
+
+  select_streams(s);
+
+  // the demuxer skips payloads of every stream we do not decode
+  for (unsigned int i = 0; i < s->fmt_ctx->nb_streams; i++)
+  {
+    AVStream *st = s->fmt_ctx->streams[i];
+    st->discard = (st == s->video_stream || st == s->audio_stream) ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+  }
+
+  if (!s->video_stream && !s->audio_stream)
+  {
+    fprintf(stderr, "Could not find audio or video stream in the media, aborting\n");
+    return 1;
+  }
+
+  snapshot_streams(s);
+
+  if (s->mode & DD_MODE_REMUX)
+  {
+    return remux_run(s);
+  }
+
+  if (s->mode & DD_MODE_PACKETS)
+  {
+    return packets_run(s);
+  }
+
+  if (s->mode & DD_MODE_THUMBNAILS)
+  {
+    return thumbnails_run(s);
+  }
+
+  while(read_packet(s) >=0)
+  {
+    if (s->abort_request)
+    {
+      av_packet_unref(s->pkt);
+      return 0;
+    }
+    if (s->switch_requested)
+    {
+      // held back packets belong to the stream being replaced
+      flush_deferred_video(s, 0);
+      apply_stream_switches(s);
+    }
+    if (s->filters_changed)
+    {
+      apply_filter_changes(s);
+    }
+    if (s->rate_changed)
+    {
+      apply_rate_change(s);
+    }
+    if (s->rate < 0)
+    {
+      av_packet_unref(s->pkt);
+      if ((ret = reverse_run(s)) < 0)
+        return ret;
+      continue;
+    }
+    // by the time base demux_packet put on it
+    if (s->pkt->time_base.num)
+    {
+      pace_packet(s, s->pkt);
+    }
+    if (s->seek_requested)
+    {
+      // the packet read before the seek is stale
+      av_packet_unref(s->pkt);
+      if ((ret = apply_seek(s)) < 0)
+        return ret;
+      continue;
+    }
+    ret = 0;
+    if(s->video_stream && s->pkt->stream_index == s->video_stream->index)
+    {
+      if (audio_is_low(s) && s->nb_deferred < VIDEO_DEFER_MAX)
+      {
+        ret = defer_video_packet(s, s->pkt);
+      }
+      else if ((ret = flush_deferred_video(s, 1)) >= 0)
+      {
+        ret = decode_video_packet(s, s->pkt);
+      }
+    }
+    else if (s->audio_stream && s->pkt->stream_index == s->audio_stream->index && s->rate == 1)
+    {
+      ret = decode_packet(s, s->audio_dec_ctx, s->pkt);
+      if (ret >= 0 && s->nb_deferred && !audio_is_low(s))
+      {
+        ret = flush_deferred_video(s, 1);
+      }
+    }
+    av_packet_unref(s->pkt);
+    if (ret < 0)
+      return ret;
+  }
+
+  return flush_deferred_video(s, 1);
+}
+
+// back to the pool once the owner let go of it and the thread is parked, or retired
+// when the pool is full
+static void session_release(Session *s)
+{
+  pthread_mutex_lock(&pool_mutex);
+  if (pool_length < POOL_SIZE)
+  {
+    s->next = pool;
+    pool = s;
+    pool_length++;
+    pthread_mutex_unlock(&pool_mutex);
+    return;
+  }
+  pthread_mutex_unlock(&pool_mutex);
+
+  // nobody holds this session anymore, so nobody will join its thread
+  pthread_mutex_lock(&s->mutex);
+  s->retired = 1;
+  s->orphaned = 1;
+  pthread_cond_broadcast(&s->cond);
+  pthread_mutex_unlock(&s->mutex);
+  pthread_detach(s->demux_decode_t);
+}
+
+// drop per-input state but keep the thread, store, packet, frame and decoders warm.
+// the session then parks with its owner, who may still call into it, until close_dd
+static void session_recycle(Session *s)
+{
+  int release;
+  ChunkCursor *ingest;
+
+  if (s->wall)
+  {
+    compositor_detach(s->wall->compositor, s->wall_tile);
+    s->wall = NULL;
+  }
+  // the ingest may drop what only this session still needed
+  pthread_mutex_lock(&s->mutex);
+  ingest = s->ingest;
+  s->ingest = NULL;
+  pthread_mutex_unlock(&s->mutex);
+  chunk_store_close_cursor(&ingest);
+  remuxer_free(&s->remuxer);
+  av_bsf_free(&s->bsfs[AVMEDIA_TYPE_VIDEO]);
+  av_bsf_free(&s->bsfs[AVMEDIA_TYPE_AUDIO]);
+  filter_graph_free(&s->filters[AVMEDIA_TYPE_VIDEO]);
+  filter_graph_free(&s->filters[AVMEDIA_TYPE_AUDIO]);
+  rendition_ladder_free(&s->ladder);
+  pthread_mutex_lock(&s->mutex);
+  frame_cache_free(&s->cache);
+  timeshift_free(&s->timeshift);
+  jitter_buffer_free(&s->jitter);
+  ts_filter_free(&s->ts_filter);
+  pthread_mutex_unlock(&s->mutex);
+  if (s->segment_input)
+  {
+    // the demuxer closes its own format context
+    s->fmt_ctx = NULL;
+    segment_demuxer_reset(s->segments, -1, SEGMENT_AHEAD, DD_PRIORITY_NORMAL);
+  }
+  avformat_close_input(&s->fmt_ctx);
+  if (s->io_ctx)
+  {
+    av_freep(&s->io_ctx->buffer);
+    avio_context_free(&s->io_ctx);
+  }
+  else
+  {
+    av_freep(&s->io_buffer);
+  }
+  s->io_buffer = NULL;
+  s->video_stream = NULL;
+  s->audio_stream = NULL;
+  flush_deferred_video(s, 0);
+
+  pthread_mutex_lock(&s->mutex);
+  s->opened = 0;
+  s->running = 0;
+  av_freep(&s->streams);
+  s->nb_streams = 0;
+  s->pending_stream[AVMEDIA_TYPE_VIDEO] = -1;
+  s->pending_stream[AVMEDIA_TYPE_AUDIO] = -1;
+  s->switch_requested = 0;
+  memory_stream_reset(s->store, s->store->is_stream);
+  release = s->abandoned;
+  pthread_cond_broadcast(&s->cond);
+  pthread_mutex_unlock(&s->mutex);
+
+  // its owner is gone already, otherwise close_dd does this
+  if (release) session_release(s);
+}
+
+static void session_free(Session *s)
+{
+  avcodec_free_context(&s->video_dec_ctx);
+  avcodec_free_context(&s->audio_dec_ctx);
+  av_packet_free(&s->pkt);
+  av_frame_free(&s->frame);
+  av_freep(&s->streams);
+  image_pool_free(&s->images);
+  packet_batch_free(&s->packets);
+  av_bsf_free(&s->bsfs[AVMEDIA_TYPE_VIDEO]);
+  av_bsf_free(&s->bsfs[AVMEDIA_TYPE_AUDIO]);
+  av_freep(&s->bsf_names[AVMEDIA_TYPE_VIDEO]);
+  av_freep(&s->bsf_names[AVMEDIA_TYPE_AUDIO]);
+  filter_graph_free(&s->filters[AVMEDIA_TYPE_VIDEO]);
+  filter_graph_free(&s->filters[AVMEDIA_TYPE_AUDIO]);
+  av_freep(&s->pending_filters[AVMEDIA_TYPE_VIDEO]);
+  av_freep(&s->pending_filters[AVMEDIA_TYPE_AUDIO]);
+  av_frame_free(&s->filt_frame);
+  rendition_ladder_free(&s->ladder);
+  frame_cache_free(&s->cache);
+  timeshift_free(&s->timeshift);
+  jitter_buffer_free(&s->jitter);
+  ts_filter_free(&s->ts_filter);
+  segment_demuxer_free(&s->segments);
+  for (int i = 0; i < VIDEO_DEFER_MAX; i++)
+  {
+    av_packet_free(&s->deferred[i]);
+  }
+  memory_stream_free(&s->store);
+  pthread_mutex_destroy(&s->mutex);
+  pthread_cond_destroy(&s->cond);
+  free(s);
+
+  pthread_mutex_lock(&pool_mutex);
+  live_sessions--;
+  pthread_mutex_unlock(&pool_mutex);
+}
+
+// park until open_dd hands over a new input, returns 0 once the session is retired
+static int session_wait_open(Session *s)
+{
+  int opened;
+  pthread_mutex_lock(&s->mutex);
+  while (!s->opened && !s->retired)
+  {
+    pthread_cond_wait(&s->cond, &s->mutex);
+  }
+  opened = !s->retired;
+  s->running = opened;
+  pthread_mutex_unlock(&s->mutex);
+  return opened;
+}
+
+static void *demux_decode(void *arg)
+{
+  Session *s = arg;
+
+  int orphaned;
+
+  while (session_wait_open(s))
+  {
+    demux_decode_run(s);
+    session_recycle(s);
+  }
+
+  pthread_mutex_lock(&s->mutex);
+  s->exited = 1;
+  orphaned = s->orphaned;
+  pthread_cond_broadcast(&s->cond);
+  pthread_mutex_unlock(&s->mutex);
+
+  // otherwise the joiner frees the session
+  if (orphaned) session_free(s);
+  pthread_exit(NULL);
+  return NULL;
+}
+
+// join the session thread within the deadline, or leave it to free itself
+static int session_join(Session *s, const struct timespec *deadline)
+{
+  int ret;
+  pthread_mutex_lock(&s->mutex);
+  s->retired = 1;
+  pthread_cond_broadcast(&s->cond);
+  if ((ret = session_wait_flag(s, &s->exited, 1, deadline)) < 0)
+  {
+    s->orphaned = 1;
+    pthread_mutex_unlock(&s->mutex);
+    pthread_detach(s->demux_decode_t);
+    return ret;
+  }
+  pthread_mutex_unlock(&s->mutex);
+  pthread_join(s->demux_decode_t, NULL);
+  session_free(s);
+  return 0;
+}
+
+static int session_create(Session **session)
+{
+  int ret;
+  Session *s;
+
+  if (!(s = calloc(1, sizeof(Session))))
+  {
+    fprintf(stderr, "Could not allocate session!\n");
+    return AVERROR(ENOMEM);
+  }
+
+  if ((ret = pthread_mutex_init(&s->mutex, NULL)) != 0)
+  {
+    fprintf(stderr, "Could not init mutex!\n");
+    free(s);
+    return ret;
+  }
+  if ((ret = pthread_cond_init(&s->cond, NULL)) != 0)
+  {
+    fprintf(stderr, "Could not init cond!\n");
+    pthread_mutex_destroy(&s->mutex);
+    free(s);
+    return ret;
+  }
+
+  s->pending_stream[AVMEDIA_TYPE_VIDEO] = -1;
+  s->pending_stream[AVMEDIA_TYPE_AUDIO] = -1;
+
+  pthread_mutex_lock(&pool_mutex);
+  live_sessions++;
+  pthread_mutex_unlock(&pool_mutex);
+
+  // memory stream
+  if ((ret = memory_stream_create(&s->store, STORE_SIZE, 0)) != 0)
+  {
+    fprintf(stderr, "Could not aloocate store!\n");
+    goto fail;
+  }
+
+  if (!(s->frame = av_frame_alloc()))
+  {
+    fprintf(stderr, "Could not allocate frame!\n");
+    ret = AVERROR(ENOMEM);
+    goto fail;
+  }
+
+  if (!(s->filt_frame = av_frame_alloc()))
+  {
+    fprintf(stderr, "Could not allocate filter frame!\n");
+    ret = AVERROR(ENOMEM);
+    goto fail;
+  }
+
+  if (!(s->pkt = av_packet_alloc()))
+  {
+    fprintf(stderr, "Could not allocate pakcet!\n");
+    ret = AVERROR(ENOMEM);
+    goto fail;
+  }
+
+  if ((ret = image_pool_create(&s->images)) != 0)
+  {
+    fprintf(stderr, "Could not allocate image pool!\n");
+    goto fail;
+  }
+
+  if ((ret = segment_demuxer_create(&s->segments, workers)) != 0)
+  {
+    fprintf(stderr, "Could not allocate segment demuxer!\n");
+    goto fail;
+  }
+
+  // create thread
+  if ((ret = pthread_create(&s->demux_decode_t, NULL, &demux_decode, s)) != 0)
+  {
+    fprintf(stderr, "Could not open demux decode thread\n!");
+    goto fail;
+  }
+
+  *session = s;
+  return 0;
+
+fail:
+  session_free(s);
+  return ret;
+}
+
+/*************************************************/
+/*** api section *********************************/
+/*************************************************/
+EMSCRIPTEN_KEEPALIVE
+void hello_wasm()
+{
+  printf("hello webassembly from demux decode for web media\n");
+}
+
+EMSCRIPTEN_KEEPALIVE
+Session *open_dd(int is_stream, int flags, VideoFrameParsedCallback on_video_frame_parsed, AudioFrameParsedCallback on_audio_frame_parsed, SessionEventCallback on_session_event)
+{
+  Session *s;
+
+  if (!proxy_queue)
+  {
+    main = pthread_self();
+    proxy_queue = em_proxying_queue_create();
+  }
+  if (!workers)
+  {
+    workers = thread_pool_shared();
+  }
+
+  // prefer a warm session from the pool
+  pthread_mutex_lock(&pool_mutex);
+  if ((s = pool))
+  {
+    pool = s->next;
+    pool_length--;
+    s->next = NULL;
+  }
+  pthread_mutex_unlock(&pool_mutex);
+
+  if (!s && session_create(&s) != 0)
+  {
+    return NULL;
+  }
+
+  pthread_mutex_lock(&s->mutex);
+  // segments are read like a stream, in order and without seeking
+  s->segment_input = !!(flags & DD_INPUT_SEGMENTS);
+  memory_stream_reset(s->store, is_stream || s->segment_input);
+  s->fireVideoFrameParsed = on_video_frame_parsed;
+  s->fireAudioFrameParsed = on_audio_frame_parsed;
+  s->fireTimedVideoFrameParsed = NULL;
+  s->fireTimedAudioFrameParsed = NULL;
+  s->fireSessionEvent = on_session_event;
+  s->tracks = flags & (DD_TRACK_VIDEO | DD_TRACK_AUDIO);
+  if (!s->tracks) s->tracks = DD_TRACK_VIDEO | DD_TRACK_AUDIO;
+  s->priority = DD_PRIORITY_NORMAL;
+  s->min_audio_buffer = 0;
+  s->cache_budget = 0;
+  s->cache_gop = 0;
+  s->timeshift_budget = 0;
+  s->timeshift_window = 0;
+  s->jitter_target = 0;
+  s->paused = 0;
+  s->seek_requested = 0;
+  s->rate_changed = 0;
+  s->reverse_buffer = REVERSE_BUFFER_SIZE;
+  s->clock = DD_CLOCK_NONE;
+  s->decode_ahead = (int64_t)DECODE_AHEAD_MS * 1000;
+  s->mode = flags & (DD_MODE_REMUX | DD_MODE_PACKETS | DD_MODE_THUMBNAILS);
+  // remuxing wins when several are asked for, then packets
+  if (s->mode & DD_MODE_REMUX) s->mode = DD_MODE_REMUX;
+  else if (s->mode & DD_MODE_PACKETS) s->mode = DD_MODE_PACKETS;
+  if (s->mode & DD_MODE_THUMBNAILS) s->tracks = DD_TRACK_VIDEO;
+  s->thumb_interval = (int64_t)THUMBNAIL_INTERVAL_MS * 1000;
+  s->thumb_width = THUMBNAIL_WIDTH;
+  s->thumb_height = 0;
+  s->thumb_columns = 0;
+  s->thumb_rows = 0;
+  s->thumb_codec = AV_CODEC_ID_MJPEG;
+  s->thumb_quality = THUMBNAIL_QUALITY;
+  s->fireThumbnailParsed = NULL;
+  s->fireThumbnailMap = NULL;
+  s->fireSegmentParsed = NULL;
+  s->fireRenditionFrameParsed = NULL;
+  s->firePacketsParsed = NULL;
+  s->fireCodecConfig = NULL;
+  s->batch_size = PACKET_BATCH_COUNT;
+  av_freep(&s->bsf_names[AVMEDIA_TYPE_VIDEO]);
+  av_freep(&s->bsf_names[AVMEDIA_TYPE_AUDIO]);
+  av_freep(&s->pending_filters[AVMEDIA_TYPE_VIDEO]);
+  av_freep(&s->pending_filters[AVMEDIA_TYPE_AUDIO]);
+  s->filters_changed = 0;
+  s->abort_request = 0;
+  s->abandoned = 0;
+  s->opened = 1;
+  pthread_cond_broadcast(&s->cond);
+  pthread_mutex_unlock(&s->mutex);
+
+  return s;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int write_dd(Session *s, size_t length, MemoryStreamWriteCallback did_write)
+{
+  int ret;
+  if ((ret = pthread_mutex_lock(&s->mutex)) != 0)
+  {
+    fprintf(stderr, "Could not lock mutex!\n");
+    return ret;
+  }
+  if (s->ts_filter)
+  {
+    // written behind the carried bytes of a split packet, then filtered in place
+    uint8_t *dest = memory_stream_ensure_write(s->store, s->ts_filter->carry_length + length);
+    did_write(NULL, dest + s->ts_filter->carry_length, length);
+    memory_stream_did_write(s->store, ts_filter_apply(s->ts_filter, dest, length));
+  }
+  else
+  {
+    memory_stream_write_callback(s->store, NULL, length, did_write);
+  }
+  if ((ret = pthread_mutex_unlock(&s->mutex)) != 0)
+  {
+    fprintf(stderr, "Could not unlock mutex!\n");
+    return ret;
+  }
+  if (s->store->is_stream)
+  {
+    if ((ret = pthread_cond_broadcast(&s->cond)) != 0)
+    {
+      fprintf(stderr, "Could signal cond!\n");
+      return ret;
+    }
+  }
+  return 0;
+}
+
+EMSCRIPTEN_KEEPALIVE
+void write_is_done(Session *s)
+{
+  pthread_mutex_lock(&s->mutex);
+  s->store->is_done = 1;
+  pthread_cond_broadcast(&s->cond);
+  pthread_mutex_unlock(&s->mutex);
+  if (s->segment_input) segment_demuxer_done(s->segments);
+}
+
+// one input shared by several sessions, e.g. one decoding for display and one remuxing
+// to a recording. it is written once, each session reads it at its own cursor.
+EMSCRIPTEN_KEEPALIVE
+ChunkStore *dd_open_ingest()
+{
+  ChunkStore *store;
+  if (chunk_store_create(&store) < 0) return NULL;
+  return store;
+}
+
+// AVERROR(EBUSY) while a session still reads it, close those first
+EMSCRIPTEN_KEEPALIVE
+int dd_close_ingest(ChunkStore *store)
+{
+  int busy;
+  pthread_mutex_lock(&store->mutex);
+  busy = store->nb_cursors > 0;
+  pthread_mutex_unlock(&store->mutex);
+  if (busy) return AVERROR(EBUSY);
+  chunk_store_free(&store);
+  return 0;
+}
+
+// like write_dd, did_write fills a new chunk of length bytes the sessions then share
+EMSCRIPTEN_KEEPALIVE
+int dd_write_ingest(ChunkStore *store, size_t length, MemoryStreamWriteCallback did_write)
+{
+  AVBufferRef *buf;
+  if (!(buf = av_buffer_alloc(length)))
+  {
+    fprintf(stderr, "Could not allocate ingest chunk\n");
+    return AVERROR(ENOMEM);
+  }
+  did_write(NULL, buf->data, length);
+  return chunk_store_append(store, buf);
+}
+
+EMSCRIPTEN_KEEPALIVE
+void dd_ingest_done(ChunkStore *store)
+{
+  chunk_store_done(store);
+}
+
+// read the input of a stream session from store instead of write_dd, starting at the
+// oldest data it still holds. same timing rule as the setters below, the cursor is
+// released when the input ends.
+EMSCRIPTEN_KEEPALIVE
+int dd_set_ingest(Session *s, ChunkStore *store)
+{
+  int ret;
+  ChunkCursor *cursor;
+
+  if (!s->store->is_stream || s->segment_input) return AVERROR(ENOSYS);
+  if ((ret = chunk_store_open_cursor(store, &cursor)) < 0)
+  {
+    return ret;
+  }
+  pthread_mutex_lock(&s->mutex);
+  if (s->ingest)
+  {
+    pthread_mutex_unlock(&s->mutex);
+    chunk_store_close_cursor(&cursor);
+    return AVERROR(EBUSY);
+  }
+  s->ingest = cursor;
+  // a reader already waiting on the store moves over
+  pthread_cond_broadcast(&s->cond);
+  pthread_mutex_unlock(&s->mutex);
+  return 0;
+}
+
+// where a DD_INPUT_SEGMENTS session starts, the media sequence of its first segment from
+// the playlist, and how many downloaded segments are demuxed at once on the shared
+// thread pool ahead of playback, 0 for SEGMENT_AHEAD. until it is called playback waits
+// for write_is_done and starts at the lowest segment written. same timing rule as the
+// setters below, AVERROR(EBUSY) once playback found the streams.
+EMSCRIPTEN_KEEPALIVE
+int dd_set_segment_playlist(Session *s, int first_sequence, int ahead)
+{
+  if (!s->segment_input) return AVERROR(ENOSYS);
+  if (first_sequence < 0 || ahead < 0 || ahead > SEGMENT_MAX_AHEAD) return AVERROR(EINVAL);
+  return segment_demuxer_start(s->segments, first_sequence, ahead ? ahead : SEGMENT_AHEAD, s->priority);
+}
+
+// hand over one downloaded segment of a DD_INPUT_SEGMENTS session, in any order, with
+// its media sequence number, DD_SEGMENT_* flags and playlist duration. did_write fills
+// length bytes like for write_dd. gaps in the sequence are waited for until write_is_done.
+EMSCRIPTEN_KEEPALIVE
+int dd_write_segment(Session *s, int sequence, int flags, double duration_ms, size_t length, MemoryStreamWriteCallback did_write)
+{
+  int ret;
+  AVBufferRef *buf;
+
+  if (!s->segment_input) return AVERROR(ENOSYS);
+  if (!(buf = av_buffer_alloc(length)))
+  {
+    fprintf(stderr, "Could not allocate segment\n");
+    return AVERROR(ENOMEM);
+  }
+  did_write(NULL, buf->data, length);
+  if ((ret = segment_demuxer_add(s->segments, sequence, flags, (int64_t)(duration_ms * 1000), buf)) < 0)
+  {
+    return ret;
+  }
+  // a jitter buffer session may be sleeping until new input
+  pthread_mutex_lock(&s->mutex);
+  pthread_cond_broadcast(&s->cond);
+  pthread_mutex_unlock(&s->mutex);
+  return 0;
+}
+
+// drop the packets of every program of an mpeg-ts input but program (0 for the first one
+// of the pat) in write_dd, before they are stored, so neither memory nor the demuxer
+// spend anything on them. the demuxer gets a pat listing that program alone. input that
+// does not start with a ts packet passes as it is. same timing rule as the setters below,
+// the filter is dropped when the input ends.
+EMSCRIPTEN_KEEPALIVE
+int dd_set_ts_filter(Session *s, int program)
+{
+  int ret;
+  TsFilter *filter;
+
+  if (program < 0 || program > 0xFFFF) return AVERROR(EINVAL);
+  if (s->segment_input) return AVERROR(ENOSYS);
+  if ((ret = ts_filter_create(&filter, program)) < 0)
+  {
+    return ret;
+  }
+  pthread_mutex_lock(&s->mutex);
+  ts_filter_free(&s->ts_filter);
+  s->ts_filter = filter;
+  pthread_mutex_unlock(&s->mutex);
+  return 0;
+}
+
+// keep only the elementary streams of the program added here, by pid, and the pmt the
+// demuxer gets lists only those. call it after dd_set_ts_filter, once per pid.
+EMSCRIPTEN_KEEPALIVE
+int dd_add_ts_pid(Session *s, int pid)
+{
+  int ret;
+  pthread_mutex_lock(&s->mutex);
+  ret = s->ts_filter ? ts_filter_add_pid(s->ts_filter, pid) : AVERROR(EINVAL);
+  pthread_mutex_unlock(&s->mutex);
+  return ret;
+}
+
+// wakes the session thread wherever it blocks, waits up to CLOSE_TIMEOUT_MS for it
+// to stop and hands the session back to the pool, s is not to be used anymore. returns
+// AVERROR(ETIMEDOUT) if it did not make it, the thread then hands it back itself as
+// soon as it notices the abort.
+EMSCRIPTEN_KEEPALIVE
+int close_dd(Session *s)
+{
+  int ret;
+  int release;
+  struct timespec deadline;
+
+  deadline_after(&deadline, CLOSE_TIMEOUT_MS);
+  pthread_mutex_lock(&s->mutex);
+  s->abort_request = 1;
+  s->opened = 0;
+  pthread_cond_broadcast(&s->cond);
+  if (s->ingest) chunk_store_wake(s->ingest->store);
+  if (s->segment_input) segment_demuxer_wake(s->segments);
+  ret = session_wait_flag(s, &s->running, 0, &deadline);
+  // parked, after its input ended or before the thread even took it up
+  if (ret < 0) s->abandoned = 1;
+  release = ret >= 0;
+  pthread_mutex_unlock(&s->mutex);
+  if (ret < 0)
+  {
+    fprintf(stderr, "Session did not stop within %d ms\n", CLOSE_TIMEOUT_MS);
+  }
+  if (release) session_release(s);
+  return ret;
+}
+
+// receive the init and media segments of a DD_MODE_REMUX session. call it right
+// after open_dd, before the first write_dd, the session cannot probe without data.
+EMSCRIPTEN_KEEPALIVE
+void dd_set_segment_callback(Session *s, SegmentParsedCallback on_segment_parsed)
+{
+  pthread_mutex_lock(&s->mutex);
+  s->fireSegmentParsed = on_segment_parsed;
+  pthread_mutex_unlock(&s->mutex);
+}
+
+// receive the codec config and packet batches of a DD_MODE_PACKETS session, up to
+// batch_size packets per call, 0 for the default. same timing rule as above.
+EMSCRIPTEN_KEEPALIVE
+void dd_set_packet_callback(Session *s, CodecConfigCallback on_codec_config, PacketsParsedCallback on_packets_parsed, int batch_size)
+{
+  pthread_mutex_lock(&s->mutex);
+  s->fireCodecConfig = on_codec_config;
+  s->firePacketsParsed = on_packets_parsed;
+  s->batch_size = batch_size > 0 ? batch_size : PACKET_BATCH_COUNT;
+  pthread_mutex_unlock(&s->mutex);
+}
+
+// configure a DD_MODE_THUMBNAILS session, same timing rule as above. one thumbnail of
+// width x height (a side <= 0 follows the aspect ratio) every interval_ms, encoded
+// by codec_id (AV_CODEC_ID_MJPEG, or any still image encoder of the build) at
+// quality 2 (best) to 31. with columns set they are tiled columns x rows per image.
+EMSCRIPTEN_KEEPALIVE
+int dd_set_thumbnails(Session *s, int interval_ms, int width, int height, int columns, int rows, int codec_id, int quality,
+                      ThumbnailParsedCallback on_thumbnail_parsed, ThumbnailMapCallback on_thumbnail_map)
+{
+  if (interval_ms <= 0 || columns < 0 || rows < 0) return AVERROR(EINVAL);
+  if (!avcodec_find_encoder(codec_id)) return AVERROR(ENOSYS);
+  pthread_mutex_lock(&s->mutex);
+  s->thumb_interval = (int64_t)interval_ms * 1000;
+  s->thumb_width = width;
+  s->thumb_height = height;
+  s->thumb_columns = columns;
+  s->thumb_rows = rows;
+  s->thumb_codec = codec_id;
+  s->thumb_quality = quality > 0 ? quality : THUMBNAIL_QUALITY;
+  s->fireThumbnailParsed = on_thumbnail_parsed;
+  s->fireThumbnailMap = on_thumbnail_map;
+  pthread_mutex_unlock(&s->mutex);
+  return 0;
+}
+
+// bitstream filters for the packets of a DD_MODE_PACKETS session, in av_bsf_list_parse_str
+// syntax, e.g. "h264_mp4toannexb" or "aac_adtstoasc", NULL or "" for none. same timing
+// rule as above, the chains are built when the streams are known and after each switch.
+EMSCRIPTEN_KEEPALIVE
+int dd_set_bitstream_filters(Session *s, const char *video_filters, const char *audio_filters)
+{
+  char *names[2] = { NULL, NULL };
+
+  if ((video_filters && *video_filters && !(names[AVMEDIA_TYPE_VIDEO] = av_strdup(video_filters))) ||
+      (audio_filters && *audio_filters && !(names[AVMEDIA_TYPE_AUDIO] = av_strdup(audio_filters))))
+  {
+    av_free(names[AVMEDIA_TYPE_VIDEO]);
+    return AVERROR(ENOMEM);
+  }
+
+  pthread_mutex_lock(&s->mutex);
+  for (int type = AVMEDIA_TYPE_VIDEO; type <= AVMEDIA_TYPE_AUDIO; type++)
+  {
+    av_free(s->bsf_names[type]);
+    s->bsf_names[type] = names[type];
+  }
+  pthread_mutex_unlock(&s->mutex);
+  return 0;
+}
+
+// libavfilter graphs for decoded video and audio frames, e.g. "yadif,scale=640:-2" or
+// "loudnorm", NULL or "" for none. may be called at any time, the graphs are swapped
+// between two packets and DD_EVENT_FILTERS_CONFIGURED reports the outcome.
+EMSCRIPTEN_KEEPALIVE
+int dd_set_filters(Session *s, const char *video_filters, const char *audio_filters)
+{
+  char *descriptions[2] = { NULL, NULL };
+
+  if ((video_filters && *video_filters && !(descriptions[AVMEDIA_TYPE_VIDEO] = av_strdup(video_filters))) ||
+      (audio_filters && *audio_filters && !(descriptions[AVMEDIA_TYPE_AUDIO] = av_strdup(audio_filters))))
+  {
+    av_free(descriptions[AVMEDIA_TYPE_VIDEO]);
+    return AVERROR(ENOMEM);
+  }
+
+  pthread_mutex_lock(&s->mutex);
+  for (int type = AVMEDIA_TYPE_VIDEO; type <= AVMEDIA_TYPE_AUDIO; type++)
+  {
+    av_free(s->pending_filters[type]);
+    s->pending_filters[type] = descriptions[type];
+  }
+  s->filters_changed = 1;
+  pthread_mutex_unlock(&s->mutex);
+  return 0;
+}
+
+// scale every decoded video frame to width x height in pix_fmt as well, a side <= 0
+// follows the source aspect ratio. returns the rendition index passed to
+// on_rendition_frame_parsed. call it before the first write_dd, once per rendition.
+EMSCRIPTEN_KEEPALIVE
+int dd_add_rendition(Session *s, int width, int height, int pix_fmt, RenditionFrameParsedCallback on_rendition_frame_parsed)
+{
+  int ret;
+  pthread_mutex_lock(&s->mutex);
+  if (!s->ladder && (ret = rendition_ladder_create(&s->ladder)) < 0)
+  {
+    pthread_mutex_unlock(&s->mutex);
+    return ret;
+  }
+  if ((ret = rendition_ladder_add(s->ladder, width, height, pix_fmt)) >= 0)
+  {
+    s->fireRenditionFrameParsed = on_rendition_frame_parsed;
+  }
+  pthread_mutex_unlock(&s->mutex);
+  return ret;
+}
+
+// rank the session's scaling and filter jobs on the shared thread pool, e.g. the
+// focused tile of a wall above the others. takes effect for jobs started afterwards.
+EMSCRIPTEN_KEEPALIVE
+int dd_set_priority(Session *s, int priority)
+{
+  if (priority < DD_PRIORITY_LOW || priority > DD_PRIORITY_HIGH) return AVERROR(EINVAL);
+  pthread_mutex_lock(&s->mutex);
+  s->priority = priority;
+  pthread_mutex_unlock(&s->mutex);
+  pthread_mutex_lock(&s->segments->mutex);
+  s->segments->priority = priority;
+  pthread_mutex_unlock(&s->segments->mutex);
+  return 0;
+}
+
+// decode audio ahead of video so at least ms of audio is delivered ahead of the
+// playback clock. below that video packets are held back and decoded without
+// non-reference frames until audio recovers. 0 turns it off, the default.
+EMSCRIPTEN_KEEPALIVE
+void dd_set_min_audio_buffer(Session *s, int ms)
+{
+  pthread_mutex_lock(&s->mutex);
+  s->min_audio_buffer = (int64_t)FFMAX(ms, 0) * 1000;
+  pthread_mutex_unlock(&s->mutex);
+}
+
+// the playback position of the consumer's audio output, in ms of stream time.
+// without it playback is assumed to run in real time from the first audio frame.
+EMSCRIPTEN_KEEPALIVE
+void dd_set_audio_clock(Session *s, double ms)
+{
+  pthread_mutex_lock(&s->mutex);
+  s->audio_clock = (int64_t)(ms * 1000);
+  s->audio_clock_time = av_gettime_relative();
+  // a paced reader may now be allowed further
+  pthread_cond_broadcast(&s->cond);
+  pthread_mutex_unlock(&s->mutex);
+}
+
+// release frames against clock, one of DD_CLOCK_*, decoding at most ahead_ms in
+// front of it. video frames that are late for the clock are dropped before conversion.
+EMSCRIPTEN_KEEPALIVE
+int dd_set_pacing(Session *s, int clock, int ahead_ms)
+{
+  if (clock < DD_CLOCK_NONE || clock > DD_CLOCK_WALL || ahead_ms < 0) return AVERROR(EINVAL);
+  pthread_mutex_lock(&s->mutex);
+  s->clock = clock;
+  s->decode_ahead = (int64_t)ahead_ms * 1000;
+  pthread_cond_broadcast(&s->cond);
+  pthread_mutex_unlock(&s->mutex);
+  return 0;
+}
+
+// deliver frames with their pts and duration in ms instead of through the callbacks
+// given to open_dd. call before the first write_dd.
+EMSCRIPTEN_KEEPALIVE
+void dd_set_timed_frame_callbacks(Session *s, TimedVideoFrameParsedCallback on_video_frame_parsed, TimedAudioFrameParsedCallback on_audio_frame_parsed)
+{
+  pthread_mutex_lock(&s->mutex);
+  s->fireTimedVideoFrameParsed = on_video_frame_parsed;
+  s->fireTimedAudioFrameParsed = on_audio_frame_parsed;
+  pthread_mutex_unlock(&s->mutex);
+}
+
+// keep up to budget_mb of decoded video frames so dd_seek back into recently
+// decoded ranges shows the target frame right away and needs no decoding. the input
+// is only sought once playback goes on past that frame, decoding from the keyframe
+// before it without output, so scrubbing within cached ranges decodes nothing. with
+// gop set the frames skipped on the way to a seek target are kept as
+// well, and evicted a whole gop at a time. 0 turns it off, the default. takes effect
+// with the next input.
+EMSCRIPTEN_KEEPALIVE
+int dd_set_frame_cache(Session *s, int budget_mb, int gop)
+{
+  if (budget_mb < 0) return AVERROR(EINVAL);
+  pthread_mutex_lock(&s->mutex);
+  s->cache_budget = (long)budget_mb * 1024 * 1024;
+  s->cache_gop = gop;
+  pthread_mutex_unlock(&s->mutex);
+  return 0;
+}
+
+// continue from the frame showing at ms of stream time, DD_EVENT_SEEKED reports the
+// outcome. only inputs written as a file can seek, and stream inputs within their
+// timeshift buffer once the input is probed, see dd_set_timeshift.
+EMSCRIPTEN_KEEPALIVE
+int dd_seek(Session *s, double ms)
+{
+  int ret = 0;
+  pthread_mutex_lock(&s->mutex);
+  if ((s->store->is_stream && !s->timeshift) || (s->mode & (DD_MODE_REMUX | DD_MODE_PACKETS | DD_MODE_THUMBNAILS)))
+  {
+    ret = AVERROR(ENOSYS);
+  }
+  else
+  {
+    s->seek_target = (int64_t)(ms * 1000);
+    s->seek_requested = 1;
+    // a paced reader must not sleep on the old position
+    pthread_cond_broadcast(&s->cond);
+  }
+  pthread_mutex_unlock(&s->mutex);
+  return ret;
+}
+
+// play at rate, negative plays backwards. from TRICK_NONREF_RATE on video skips
+// non-reference frames, from TRICK_KEYFRAME_RATE on it decodes keyframes only. reverse
+// play decodes a gop at a time into at most reverse_buffer_mb (0 for the default) and
+// needs an input written as a file. rates other than 1 play no audio.
+// DD_EVENT_RATE_CHANGED reports when the change took effect.
+EMSCRIPTEN_KEEPALIVE
+int dd_set_playback_rate(Session *s, double rate, int reverse_buffer_mb)
+{
+  int ret = 0;
+  if (rate == 0 || isnan(rate) || reverse_buffer_mb < 0) return AVERROR(EINVAL);
+  pthread_mutex_lock(&s->mutex);
+  if ((s->mode & (DD_MODE_REMUX | DD_MODE_PACKETS | DD_MODE_THUMBNAILS)) || (rate < 0 && s->store->is_stream))
+  {
+    ret = AVERROR(ENOSYS);
+  }
+  else
+  {
+    s->pending_rate = rate;
+    s->reverse_buffer = reverse_buffer_mb ? (long)reverse_buffer_mb * 1024 * 1024 : REVERSE_BUFFER_SIZE;
+    s->rate_changed = 1;
+    pthread_cond_broadcast(&s->cond);
+  }
+  pthread_mutex_unlock(&s->mutex);
+  return ret;
+}
+
+// keep the last window_s seconds of a live input, up to budget_mb of packets, so it
+// can be paused and dd_seek can go back within them without reading anything again.
+// stream input in decoding mode only, not together with a jitter buffer, same timing
+// rule as above. 0 for the defaults.
+EMSCRIPTEN_KEEPALIVE
+int dd_set_timeshift(Session *s, int window_s, int budget_mb)
+{
+  int ret = 0;
+  if (window_s < 0 || budget_mb < 0) return AVERROR(EINVAL);
+  pthread_mutex_lock(&s->mutex);
+  if (!s->store->is_stream || (s->mode & (DD_MODE_REMUX | DD_MODE_PACKETS | DD_MODE_THUMBNAILS)))
+  {
+    ret = AVERROR(ENOSYS);
+  }
+  else if (s->jitter_target)
+  {
+    ret = AVERROR(EINVAL);
+  }
+  else
+  {
+    s->timeshift_budget = budget_mb ? (long)budget_mb * 1024 * 1024 : TIMESHIFT_BUDGET;
+    s->timeshift_window = (int64_t)window_s * 1000000;
+  }
+  pthread_mutex_unlock(&s->mutex);
+  return ret;
+}
+
+// hold the packets of a live input for up to target_ms (0 for JITTER_TARGET) and hand
+// them to the decoders in dts order at the pace of their timestamps, rebasing them when
+// they jump. the delay shrinks while the input arrives steadily and grows back to
+// target_ms when a packet comes later than that. stream input in decoding mode only,
+// not together with a timeshift buffer, same timing rule as above.
+EMSCRIPTEN_KEEPALIVE
+int dd_set_jitter_buffer(Session *s, int target_ms)
+{
+  int ret = 0;
+  if (target_ms < 0) return AVERROR(EINVAL);
+  pthread_mutex_lock(&s->mutex);
+  if (!s->store->is_stream || (s->mode & (DD_MODE_REMUX | DD_MODE_PACKETS | DD_MODE_THUMBNAILS)))
+  {
+    ret = AVERROR(ENOSYS);
+  }
+  else if (s->timeshift_budget)
+  {
+    ret = AVERROR(EINVAL);
+  }
+  else
+  {
+    s->jitter_target = target_ms ? (int64_t)target_ms * 1000 : JITTER_TARGET;
+  }
+  pthread_mutex_unlock(&s->mutex);
+  return ret;
+}
+
+// stop decoding a timeshift session while its input is still read into the buffer,
+// 0 to resume from where it stopped. playback falls behind the live edge meanwhile.
+// the buffer is there once the input is probed, ENOSYS before.
+EMSCRIPTEN_KEEPALIVE
+int dd_pause(Session *s, int paused)
+{
+  int ret = 0;
+  pthread_mutex_lock(&s->mutex);
+  if (!s->timeshift)
+  {
+    ret = AVERROR(ENOSYS);
+  }
+  else
+  {
+    s->paused = paused;
+    pthread_cond_broadcast(&s->cond);
+  }
+  pthread_mutex_unlock(&s->mutex);
+  return ret;
+}
+
+static long timeshift_stat(Session *s, int stat)
+{
+  long ret = 0;
+  int64_t pts;
+  pthread_mutex_lock(&s->mutex);
+  if (s->timeshift)
+  {
+    if (stat == DD_STAT_TIMESHIFT_SIZE)
     {
-      fprintf(stderr, "Could signal cond!\n");
-      return ret;
+      ret = s->timeshift->bytes / 1024;
+    }
+    else
+    {
+      pts = stat == DD_STAT_TIMESHIFT_START ? timeshift_start(s->timeshift) : timeshift_end(s->timeshift);
+      ret = pts == AV_NOPTS_VALUE ? 0 : pts / 1000;
     }
   }
+  pthread_mutex_unlock(&s->mutex);
+  return ret;
+}
+
+static long cache_stat(Session *s, int stat)
+{
+  long ret = 0;
+  pthread_mutex_lock(&s->mutex);
+  if (s->cache)
+  {
+    ret = stat == DD_STAT_CACHE_HITS ? s->cache->hits :
+          stat == DD_STAT_CACHE_MISSES ? s->cache->misses : s->cache->bytes / 1024;
+  }
+  pthread_mutex_unlock(&s->mutex);
+  return ret;
+}
+
+static long jitter_stat(Session *s, int stat)
+{
+  long ret = 0;
+  pthread_mutex_lock(&s->mutex);
+  if (s->jitter)
+  {
+    ret = stat == DD_STAT_JITTER_DELAY ? s->jitter->delay / 1000 :
+          stat == DD_STAT_JITTER_LATE ? s->jitter->late :
+          stat == DD_STAT_JITTER_REORDERED ? s->jitter->reordered : s->jitter->discontinuities;
+  }
+  pthread_mutex_unlock(&s->mutex);
+  return ret;
+}
+
+static long ts_filter_stat(Session *s, int stat)
+{
+  long ret = 0;
+  pthread_mutex_lock(&s->mutex);
+  if (s->ts_filter)
+  {
+    ret = stat == DD_STAT_TS_KEPT ? s->ts_filter->kept : s->ts_filter->dropped;
+  }
+  pthread_mutex_unlock(&s->mutex);
+  return ret;
+}
+
+static int64_t ingest_lag(Session *s)
+{
+  int64_t lag = 0;
+  pthread_mutex_lock(&s->mutex);
+  if (s->ingest) lag = chunk_store_lag(s->ingest);
+  pthread_mutex_unlock(&s->mutex);
+  return lag;
+}
+
+// DD_STAT_* counters of the current input
+EMSCRIPTEN_KEEPALIVE
+long dd_get_stat(Session *s, int stat)
+{
+  switch (stat)
+  {
+    case DD_STAT_AUDIO_BUFFERED: return audio_buffered(s) / 1000;
+    case DD_STAT_AUDIO_UNDERRUNS: return s->audio_underruns;
+    case DD_STAT_AUDIO_LOW: return s->audio_low_count;
+    case DD_STAT_VIDEO_DEFERRED: return s->video_deferred;
+    case DD_STAT_VIDEO_DEGRADED: return s->video_degraded;
+    case DD_STAT_VIDEO_LATE: return s->video_late;
+    case DD_STAT_CACHE_HITS:
+    case DD_STAT_CACHE_MISSES:
+    case DD_STAT_CACHE_SIZE:
+      return cache_stat(s, stat);
+    case DD_STAT_VIDEO_SKIPPED: return s->video_skipped;
+    case DD_STAT_REVERSE_REDECODES: return s->reverse_redecodes;
+    case DD_STAT_TIMESHIFT_START:
+    case DD_STAT_TIMESHIFT_END:
+    case DD_STAT_TIMESHIFT_SIZE:
+      return timeshift_stat(s, stat);
+    case DD_STAT_INGEST_LAG: return ingest_lag(s) / 1024;
+    case DD_STAT_JITTER_DELAY:
+    case DD_STAT_JITTER_LATE:
+    case DD_STAT_JITTER_REORDERED:
+    case DD_STAT_DISCONTINUITIES:
+      return jitter_stat(s, stat);
+    case DD_STAT_TS_KEPT:
+    case DD_STAT_TS_DROPPED:
+      return ts_filter_stat(s, stat);
+  }
+  return AVERROR(EINVAL);
+}
+
+// number of streams in the input, AVERROR(EAGAIN) until DD_EVENT_STREAMS_READY
+EMSCRIPTEN_KEEPALIVE
+int dd_get_stream_count(Session *s)
+{
+  int ret;
+  pthread_mutex_lock(&s->mutex);
+  ret = s->streams ? s->nb_streams : AVERROR(EAGAIN);
+  pthread_mutex_unlock(&s->mutex);
+  return ret;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int dd_get_stream_info(Session *s, int index, StreamInfoCallback on_stream_info)
+{
+  StreamInfo info;
+  pthread_mutex_lock(&s->mutex);
+  if (!s->streams || index < 0 || index >= s->nb_streams)
+  {
+    pthread_mutex_unlock(&s->mutex);
+    return AVERROR(EINVAL);
+  }
+  info = s->streams[index];
+  pthread_mutex_unlock(&s->mutex);
+
+  (*on_stream_info)(index, info.type, info.codec, info.language, info.title, info.arg0, info.arg1, info.active);
+  return 0;
+}
+
+// make the video or audio stream at index the active one of its type. the switch
+// happens between two packets and is reported with DD_EVENT_TRACK_SWITCHED.
+EMSCRIPTEN_KEEPALIVE
+int dd_select_stream(Session *s, int index)
+{
+  int type;
+  pthread_mutex_lock(&s->mutex);
+  if (!s->streams || index < 0 || index >= s->nb_streams)
+  {
+    pthread_mutex_unlock(&s->mutex);
+    return AVERROR(EINVAL);
+  }
+  type = s->streams[index].type;
+  // the remux muxer has its streams fixed by the init segment
+  if (s->mode & DD_MODE_REMUX)
+  {
+    pthread_mutex_unlock(&s->mutex);
+    return AVERROR(ENOSYS);
+  }
+  if (type != AVMEDIA_TYPE_VIDEO && type != AVMEDIA_TYPE_AUDIO)
+  {
+    pthread_mutex_unlock(&s->mutex);
+    return AVERROR(EINVAL);
+  }
+  s->pending_stream[type] = index;
+  s->switch_requested = 1;
+  pthread_mutex_unlock(&s->mutex);
   return 0;
 }
 
+// retire and join every idle session, bounded by CLOSE_TIMEOUT_MS in total
+EMSCRIPTEN_KEEPALIVE
+int drain_dd_pool()
+{
+  int ret = 0;
+  Session *s, *idle;
+  struct timespec deadline;
+
+  pthread_mutex_lock(&pool_mutex);
+  idle = pool;
+  pool = NULL;
+  pool_length = 0;
+  pthread_mutex_unlock(&pool_mutex);
+
+  deadline_after(&deadline, CLOSE_TIMEOUT_MS);
+  while ((s = idle))
+  {
+    idle = s->next;
+    if (session_join(s, &deadline) < 0) ret = AVERROR(ETIMEDOUT);
+  }
+  return ret;
+}
+
+// runs on the compositor thread, the canvas is not touched again until the callback returned
+static void output_composed_frame(void *opaque, uint8_t *data, long size, int width, int height)
+{
+  VideoWall *wall = opaque;
+  WallContext ctx = {
+    .wall = wall,
+    .ptr = data,
+    .size = size,
+    .width = width,
+    .height = height,
+  };
+  if (wall->closing) return;
+  emscripten_proxy_sync(proxy_queue, main, &invokeFrameComposedCallback, &ctx);
+}
+
+// a video wall of columns x rows tiles composed into one width x height frame of
+// format (AVPixelFormat) fps times a second, handed to on_frame_composed. sessions
+// join it with dd_set_wall_tile, their frames are scaled into the tiles on the shared
+// thread pool, one job per tile, and a tile only keeps the newest frame of its input.
+EMSCRIPTEN_KEEPALIVE
+VideoWall *dd_open_wall(int width, int height, int format, int columns, int rows, int fps, VideoFrameParsedCallback on_frame_composed)
+{
+  VideoWall *wall;
+
+  if (!proxy_queue)
+  {
+    main = pthread_self();
+    proxy_queue = em_proxying_queue_create();
+  }
+  if (!workers)
+  {
+    workers = thread_pool_shared();
+  }
+  if (!(wall = calloc(1, sizeof(VideoWall))))
+  {
+    return NULL;
+  }
+  wall->fireFrameComposed = on_frame_composed;
+  if (compositor_create(&wall->compositor, width, height, format, columns, rows, fps, workers, DD_PRIORITY_HIGH,
+                        &output_composed_frame, wall) < 0)
+  {
+    free(wall);
+    return NULL;
+  }
+  return wall;
+}
+
+// AVERROR(EBUSY) while a session still has a tile, close those first
 EMSCRIPTEN_KEEPALIVE
-void write_is_done()
+int dd_close_wall(VideoWall *wall)
 {
-  store->is_done = 1;
-  if (!store->is_stream)
+  int ret;
+  struct timespec deadline;
+
+  if (compositor_busy(wall->compositor)) return AVERROR(EBUSY);
+  wall->closing = 1;
+  deadline_after(&deadline, CLOSE_TIMEOUT_MS);
+  // the compositor thread may be waiting on a callback of this thread
+  while ((ret = compositor_stop(wall->compositor, CLOSE_POLL_MS)) < 0 && !deadline_passed(&deadline))
+  {
+    if (proxy_queue && pthread_equal(pthread_self(), main)) emscripten_proxy_execute_queue(proxy_queue);
+  }
+  if (ret < 0)
   {
-    pthread_cond_signal(&cond);
-  } 
+    fprintf(stderr, "Video wall did not stop within %d ms\n", CLOSE_TIMEOUT_MS);
+    return ret;
+  }
+  compositor_free(&wall->compositor);
+  free(wall);
+  return 0;
 }
 
+// send the decoded video of s to tile (0 to columns x rows - 1, row by row) of wall
+// instead of the video callback, NULL wall to leave it. same timing rule as above, the
+// tile is released when the input ends. pace the session with DD_CLOCK_WALL so an input
+// that falls behind drops its late frames before they are even handed over.
 EMSCRIPTEN_KEEPALIVE
-int close_dd()
+int dd_set_wall_tile(Session *s, VideoWall *wall, int tile)
 {
-  opened = 0;
+  int ret;
+
+  if (wall && (ret = compositor_attach(wall->compositor, tile)) < 0)
+  {
+    return ret;
+  }
+  pthread_mutex_lock(&s->mutex);
+  if (s->wall) compositor_detach(s->wall->compositor, s->wall_tile);
+  s->wall = wall;
+  s->wall_tile = tile;
+  pthread_mutex_unlock(&s->mutex);
   return 0;
 }
+
+EMSCRIPTEN_KEEPALIVE
+long dd_get_wall_stat(VideoWall *wall, int tile, int stat)
+{
+  long value = AVERROR(EINVAL);
+  Compositor *c = wall->compositor;
+
+  if (tile < 0 || tile >= c->nb_tiles) return AVERROR(EINVAL);
+  pthread_mutex_lock(&c->mutex);
+  switch (stat)
+  {
+    case DD_WALL_STAT_COMPOSED: value = c->tiles[tile].composed; break;
+    case DD_WALL_STAT_DROPPED: value = c->tiles[tile].dropped; break;
+    case DD_WALL_STAT_REPEATED: value = c->tiles[tile].repeated; break;
+  }
+  pthread_mutex_unlock(&c->mutex);
+  return value;
+}
+
+// sessions alive, pooled or running, for leak checks
+EMSCRIPTEN_KEEPALIVE
+int dd_live_sessions()
+{
+  int n;
+  pthread_mutex_lock(&pool_mutex);
+  n = live_sessions;
+  pthread_mutex_unlock(&pool_mutex);
+  return n;
+}
+
+// bytes currently allocated on the heap, for leak checks. emscripten's dlmalloc has
+// mallinfo only, not glibc's mallinfo2
+EMSCRIPTEN_KEEPALIVE
+long dd_heap_used()
+{
+  struct mallinfo info = mallinfo();
+  return info.uordblks;
+}
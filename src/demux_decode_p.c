@@ -10,6 +10,7 @@
 #include <libavcodec/avcodec.h>
 
 #include "memory_stream.h"
+#include "image_pool.h"
 
 #define IO_BUFFER_SIZE 4096
 
@@ -39,9 +40,7 @@ static int audio_frame_count = 0;
 static int width;
 static int height;
 static enum AVPixelFormat pix_fmt;
-static uint8_t *video_dst_data[4] = { NULL };
-static int video_dst_linesize[4];
-static int video_dst_bufsize;
+static ImagePool *video_dst_images = NULL;
 
 static MemoryStream *memory_stream = NULL;
 
@@ -87,19 +86,20 @@ static int open_decoder(AVStream *stream, enum AVMediaType type)
 
 static int output_video_frame(AVFrame *frame)
 {
-  if (frame->width != width || frame->height != height ||
-      frame->format != pix_fmt) {
-      /* To handle this change, one could call av_image_alloc again and
-        * decode the following frames into another rawvideo file. */
-      fprintf(stderr, "Error: Width, height and pixel format have to be "
-              "constant in a rawvideo file, but the width, height or "
-              "pixel format of the input video changed:\n"
-              "old: width = %d, height = %d, format = %s\n"
-              "new: width = %d, height = %d, format = %s\n",
-              width, height, av_get_pix_fmt_name(pix_fmt),
-              frame->width, frame->height,
-              av_get_pix_fmt_name(frame->format));
-      return -1;
+  int ret;
+  ImageBuffer *image;
+
+  /* the buffer follows the frame, a new one is allocated lazily when
+    * width, height or pixel format change mid stream */
+  if ((ret = image_pool_get(video_dst_images, &image, frame->width, frame->height, frame->format)) < 0)
+  {
+    return ret;
+  }
+  if (ret > 0 && video_frame_count > 0)
+  {
+    fprintf(stderr, "Video format changed at frame %d: width = %d, height = %d, format = %s\n",
+            video_frame_count, frame->width, frame->height,
+            av_get_pix_fmt_name(frame->format));
   }
 
   printf("video_frame n:%d\n",
@@ -107,12 +107,12 @@ static int output_video_frame(AVFrame *frame)
 
   /* copy decoded frame to destination buffer:
     * this is required since rawvideo expects non aligned data */
-  av_image_copy(video_dst_data, video_dst_linesize,
+  av_image_copy(image->data, image->line_size,
                 (const uint8_t **)(frame->data), frame->linesize,
-                pix_fmt, width, height);
+                frame->format, frame->width, frame->height);
 
   /* write to rawvideo file */
-  fwrite(video_dst_data[0], 1, video_dst_bufsize, video_dst_file);
+  fwrite(image->data[0], 1, image->size, video_dst_file);
   return 0;
 }
 
@@ -273,17 +273,16 @@ static int demux_thread()
       ret = 1;
       goto end;
     }
-    // allocate image where the decoded image will be put
+    // images where the decoded frames will be put, allocated on first use
     width = video_dec_ctx->width;
     height = video_dec_ctx->height;
     pix_fmt = video_dec_ctx->pix_fmt;
-    ret = av_image_alloc(video_dst_data, video_dst_linesize, width, height, pix_fmt, 1);
+    ret = image_pool_create(&video_dst_images);
     if (ret < 0)
     {
       fprintf(stderr, "Could not allocate raw video buffer\n");
       goto end;
     }
-    video_dst_bufsize = ret;
   }
 
   // open audio decode context
@@ -444,7 +443,7 @@ end:
       fclose(audio_dst_file);
   av_packet_free(&pkt);
   av_frame_free(&frame);
-  av_free(video_dst_data[0]);
+  image_pool_free(&video_dst_images);
 
   return ret;
 }
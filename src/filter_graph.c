@@ -0,0 +1,216 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <libavutil/avutil.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/pixdesc.h>
+#include <libavutil/samplefmt.h>
+#include <libavfilter/avfilter.h>
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
+
+#include "filter_graph.h"
+
+typedef struct FilterJobs
+{
+  AVFilterContext *ctx;
+  avfilter_action_func *func;
+  void *arg;
+  int *ret;
+  int nb_jobs;
+} FilterJobs;
+
+static void run_filter_job(void *arg, int index)
+{
+  FilterJobs *jobs = arg;
+  int ret = (*jobs->func)(jobs->ctx, jobs->arg, index, jobs->nb_jobs);
+  if (jobs->ret) jobs->ret[index] = ret;
+}
+
+// libavfilter's slice threading, routed to the shared pool instead of threads of its own
+static int execute_filter_jobs(AVFilterContext *ctx, avfilter_action_func *func, void *arg, int *ret, int nb_jobs)
+{
+  FilterGraph *fg = ctx->graph->opaque;
+  FilterJobs jobs = {
+    .ctx = ctx,
+    .func = func,
+    .arg = arg,
+    .ret = ret,
+    .nb_jobs = nb_jobs,
+  };
+  thread_pool_run(fg->pool, &run_filter_job, &jobs, nb_jobs, fg->priority);
+  return 0;
+}
+
+int filter_graph_create(FilterGraph **filter_graph, enum AVMediaType type, const char *description, ThreadPool *pool, int priority)
+{
+  FilterGraph *fg;
+
+  if (!(fg = av_mallocz(sizeof(FilterGraph))))
+  {
+    return AVERROR(ENOMEM);
+  }
+  if (!(fg->description = av_strdup(description)))
+  {
+    av_free(fg);
+    return AVERROR(ENOMEM);
+  }
+  fg->type = type;
+  fg->pool = pool;
+  fg->priority = priority;
+  fg->format = -1;
+
+  *filter_graph = fg;
+  return 0;
+}
+
+void filter_graph_free(FilterGraph **filter_graph)
+{
+  FilterGraph *fg = *filter_graph;
+  if (fg == NULL) return;
+  avfilter_graph_free(&fg->graph);
+  av_channel_layout_uninit(&fg->ch_layout);
+  av_free(fg->description);
+  av_freep(filter_graph);
+}
+
+static int frame_matches(FilterGraph *fg, const AVFrame *frame, AVRational time_base)
+{
+  if (!fg->graph || frame->format != fg->format) return 0;
+  if (av_cmp_q(time_base, fg->time_base) != 0) return 0;
+  if (fg->type == AVMEDIA_TYPE_VIDEO)
+  {
+    return frame->width == fg->width && frame->height == fg->height &&
+           av_cmp_q(frame->sample_aspect_ratio, fg->sample_aspect_ratio) == 0;
+  }
+  return frame->sample_rate == fg->sample_rate && av_channel_layout_compare(&frame->ch_layout, &fg->ch_layout) == 0;
+}
+
+// buffer source -> description -> buffer sink, configured for frame
+static int configure(FilterGraph *fg, const AVFrame *frame, AVRational time_base)
+{
+  int ret;
+  char args[512];
+  char layout[64];
+  int is_video = fg->type == AVMEDIA_TYPE_VIDEO;
+  AVFilterInOut *outputs = NULL;
+  AVFilterInOut *inputs = NULL;
+
+  avfilter_graph_free(&fg->graph);
+  if (!(fg->graph = avfilter_graph_alloc()))
+  {
+    return AVERROR(ENOMEM);
+  }
+  fg->graph->opaque = fg;
+  if (fg->pool)
+  {
+    fg->graph->nb_threads = fg->pool->nb_workers;
+    fg->graph->execute = &execute_filter_jobs;
+  }
+  else
+  {
+    fg->graph->nb_threads = 1;
+  }
+
+  if (is_video)
+  {
+    snprintf(args, sizeof(args), "video_size=%dx%d:pix_fmt=%d:time_base=%d/%d:pixel_aspect=%d/%d",
+             frame->width, frame->height, frame->format, time_base.num, time_base.den,
+             frame->sample_aspect_ratio.num, FFMAX(frame->sample_aspect_ratio.den, 1));
+  }
+  else
+  {
+    av_channel_layout_describe(&frame->ch_layout, layout, sizeof(layout));
+    snprintf(args, sizeof(args), "time_base=%d/%d:sample_rate=%d:sample_fmt=%s:channel_layout=%s",
+             time_base.num, time_base.den, frame->sample_rate,
+             av_get_sample_fmt_name(frame->format), layout);
+  }
+
+  if ((ret = avfilter_graph_create_filter(&fg->src, avfilter_get_by_name(is_video ? "buffer" : "abuffer"),
+                                          "in", args, NULL, fg->graph)) < 0)
+  {
+    fprintf(stderr, "Could not create buffer source (%s)\n", av_err2str(ret));
+    goto end;
+  }
+  if ((ret = avfilter_graph_create_filter(&fg->sink, avfilter_get_by_name(is_video ? "buffersink" : "abuffersink"),
+                                          "out", NULL, NULL, fg->graph)) < 0)
+  {
+    fprintf(stderr, "Could not create buffer sink (%s)\n", av_err2str(ret));
+    goto end;
+  }
+
+  if (!(outputs = avfilter_inout_alloc()) || !(inputs = avfilter_inout_alloc()))
+  {
+    ret = AVERROR(ENOMEM);
+    goto end;
+  }
+  outputs->name = av_strdup("in");
+  outputs->filter_ctx = fg->src;
+  outputs->pad_idx = 0;
+  outputs->next = NULL;
+  inputs->name = av_strdup("out");
+  inputs->filter_ctx = fg->sink;
+  inputs->pad_idx = 0;
+  inputs->next = NULL;
+
+  if ((ret = avfilter_graph_parse_ptr(fg->graph, fg->description, &inputs, &outputs, NULL)) < 0)
+  {
+    fprintf(stderr, "Could not parse filters '%s' (%s)\n", fg->description, av_err2str(ret));
+    goto end;
+  }
+  if ((ret = avfilter_graph_config(fg->graph, NULL)) < 0)
+  {
+    fprintf(stderr, "Could not configure filters '%s' (%s)\n", fg->description, av_err2str(ret));
+    goto end;
+  }
+
+  fg->format = frame->format;
+  fg->width = frame->width;
+  fg->height = frame->height;
+  fg->sample_aspect_ratio = frame->sample_aspect_ratio;
+  fg->sample_rate = frame->sample_rate;
+  fg->time_base = time_base;
+  av_channel_layout_uninit(&fg->ch_layout);
+  ret = av_channel_layout_copy(&fg->ch_layout, &frame->ch_layout);
+
+end:
+  avfilter_inout_free(&inputs);
+  avfilter_inout_free(&outputs);
+  if (ret < 0)
+  {
+    avfilter_graph_free(&fg->graph);
+    fg->format = -1;
+  }
+  return ret;
+}
+
+int filter_graph_send_frame(FilterGraph *filter_graph, AVFrame *frame, AVRational time_base)
+{
+  int ret;
+  int configured = 0;
+
+  if (!frame_matches(filter_graph, frame, time_base))
+  {
+    if ((ret = configure(filter_graph, frame, time_base)) < 0)
+      return ret;
+    configured = 1;
+  }
+  // the frame reference moves into the graph, no copy
+  if ((ret = av_buffersrc_add_frame_flags(filter_graph->src, frame, 0)) < 0)
+  {
+    fprintf(stderr, "Error feeding the filter graph (%s)\n", av_err2str(ret));
+    return ret;
+  }
+  return configured;
+}
+
+AVRational filter_graph_time_base(FilterGraph *filter_graph)
+{
+  return filter_graph->graph ? av_buffersink_get_time_base(filter_graph->sink) : filter_graph->time_base;
+}
+
+int filter_graph_receive_frame(FilterGraph *filter_graph, AVFrame *frame)
+{
+  if (!filter_graph->graph) return AVERROR(EAGAIN);
+  return av_buffersink_get_frame(filter_graph->sink, frame);
+}
@@ -0,0 +1,45 @@
+#ifndef FILTER_GRAPH_H
+#define FILTER_GRAPH_H
+
+#include <libavutil/frame.h>
+#include <libavfilter/avfilter.h>
+
+#include "thread_pool.h"
+
+// a libavfilter graph between a decoder and the frame output, described by a
+// filter string like "yadif,scale=640:-2" or "loudnorm". the graph is built from
+// the first frame and rebuilt whenever the decoded frames change format.
+typedef struct FilterGraph
+{
+  AVFilterGraph *graph;
+  AVFilterContext *src;
+  AVFilterContext *sink;
+  char *description;
+  enum AVMediaType type;
+  // filters that slice their work run the slices on pool, NULL for one thread
+  ThreadPool *pool;
+  int priority;
+
+  // input the graph is configured for
+  int width;
+  int height;
+  int format;
+  AVRational sample_aspect_ratio;
+  int sample_rate;
+  AVChannelLayout ch_layout;
+  AVRational time_base;
+} FilterGraph;
+
+int filter_graph_create(FilterGraph **filter_graph, enum AVMediaType type, const char *description, ThreadPool *pool, int priority);
+
+void filter_graph_free(FilterGraph **filter_graph);
+
+// move frame into the graph. returns 1 when the graph was (re)built for it, 0 when not, < 0 on error
+int filter_graph_send_frame(FilterGraph *filter_graph, AVFrame *frame, AVRational time_base);
+
+// time base of the frames filter_graph_receive_frame returns
+AVRational filter_graph_time_base(FilterGraph *filter_graph);
+
+// AVERROR(EAGAIN) when the graph needs more input
+int filter_graph_receive_frame(FilterGraph *filter_graph, AVFrame *frame);
+#endif
@@ -0,0 +1,149 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <libavutil/avutil.h>
+#include <libavutil/frame.h>
+
+#include "frame_cache.h"
+
+int frame_cache_create(FrameCache **frame_cache, long budget, int gop)
+{
+  FrameCache *cache;
+
+  if (!(cache = calloc(1, sizeof(FrameCache))))
+  {
+    return AVERROR(ENOMEM);
+  }
+  cache->budget = budget > 0 ? budget : FRAME_CACHE_BUDGET;
+  cache->gop = gop;
+
+  *frame_cache = cache;
+
+  return 0;
+}
+
+void frame_cache_free(FrameCache **frame_cache)
+{
+  FrameCache *cache = *frame_cache;
+  if (cache == NULL) return;
+  frame_cache_clear(cache);
+  av_freep(&cache->entries);
+  free(cache);
+  *frame_cache = NULL;
+}
+
+void frame_cache_clear(FrameCache *frame_cache)
+{
+  for (int i = 0; i < frame_cache->length; i++)
+  {
+    av_frame_free(&frame_cache->entries[i].frame);
+  }
+  frame_cache->length = 0;
+  frame_cache->bytes = 0;
+}
+
+static long frame_bytes(const AVFrame *frame)
+{
+  long bytes = 0;
+  for (int i = 0; i < AV_NUM_DATA_POINTERS && frame->buf[i]; i++)
+  {
+    bytes += frame->buf[i]->size;
+  }
+  return bytes;
+}
+
+static void frame_cache_remove(FrameCache *frame_cache, int index)
+{
+  CachedFrame *entry = &frame_cache->entries[index];
+  frame_cache->bytes -= entry->bytes;
+  av_frame_free(&entry->frame);
+  *entry = frame_cache->entries[--frame_cache->length];
+}
+
+// drop the least recently used frame, or its whole gop
+static void frame_cache_evict(FrameCache *frame_cache)
+{
+  int victim = 0;
+  int64_t gop;
+
+  for (int i = 1; i < frame_cache->length; i++)
+  {
+    if (frame_cache->entries[i].last_used < frame_cache->entries[victim].last_used) victim = i;
+  }
+  if (!frame_cache->gop)
+  {
+    frame_cache_remove(frame_cache, victim);
+    return;
+  }
+  gop = frame_cache->entries[victim].gop;
+  for (int i = frame_cache->length - 1; i >= 0; i--)
+  {
+    if (frame_cache->entries[i].gop == gop) frame_cache_remove(frame_cache, i);
+  }
+}
+
+static CachedFrame *frame_cache_find(FrameCache *frame_cache, int64_t pts)
+{
+  for (int i = 0; i < frame_cache->length; i++)
+  {
+    CachedFrame *entry = &frame_cache->entries[i];
+    if (pts >= entry->pts && pts < entry->pts + FFMAX(entry->duration, 1)) return entry;
+  }
+  return NULL;
+}
+
+int frame_cache_put(FrameCache *frame_cache, const AVFrame *frame, int64_t pts, int64_t duration, int64_t gop)
+{
+  CachedFrame *entry;
+  long bytes = frame_bytes(frame);
+
+  if (pts == AV_NOPTS_VALUE || bytes > frame_cache->budget) return 0;
+
+  // decoding through a cached range again only refreshes it
+  if ((entry = frame_cache_find(frame_cache, pts)) && entry->pts == pts)
+  {
+    entry->last_used = ++frame_cache->clock;
+    return 0;
+  }
+
+  while (frame_cache->length && frame_cache->bytes + bytes > frame_cache->budget)
+  {
+    frame_cache_evict(frame_cache);
+  }
+
+  if (frame_cache->length == frame_cache->capacity)
+  {
+    int capacity = FFMAX(frame_cache->capacity * 2, 16);
+    CachedFrame *entries = av_realloc_array(frame_cache->entries, capacity, sizeof(CachedFrame));
+    if (!entries) return AVERROR(ENOMEM);
+    frame_cache->entries = entries;
+    frame_cache->capacity = capacity;
+  }
+
+  entry = &frame_cache->entries[frame_cache->length];
+  if (!(entry->frame = av_frame_clone(frame)))
+  {
+    return AVERROR(ENOMEM);
+  }
+  entry->pts = pts;
+  entry->duration = duration;
+  entry->gop = gop;
+  entry->bytes = bytes;
+  entry->last_used = ++frame_cache->clock;
+  frame_cache->length++;
+  frame_cache->bytes += bytes;
+  return 0;
+}
+
+CachedFrame *frame_cache_get(FrameCache *frame_cache, int64_t pts)
+{
+  CachedFrame *entry = frame_cache_find(frame_cache, pts);
+  if (!entry)
+  {
+    frame_cache->misses++;
+    return NULL;
+  }
+  frame_cache->hits++;
+  entry->last_used = ++frame_cache->clock;
+  return entry;
+}
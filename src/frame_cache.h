@@ -0,0 +1,50 @@
+#ifndef FRAME_CACHE_H
+#define FRAME_CACHE_H
+
+#include <stdint.h>
+
+#include <libavutil/frame.h>
+
+// memory a frame cache may hold unless configured otherwise
+#define FRAME_CACHE_BUDGET (64 * 1024 * 1024)
+
+// a decoded frame kept for scrubbing. times are microseconds.
+typedef struct CachedFrame
+{
+  AVFrame *frame;
+  int64_t pts;
+  int64_t duration;
+  // pts of the intra frame that starts the frame's gop
+  int64_t gop;
+  long bytes;
+  long last_used;
+} CachedFrame;
+
+// decoded frames by pts, least recently used go first once over budget.
+// with gop set frames are evicted a whole gop at a time.
+typedef struct FrameCache
+{
+  CachedFrame *entries;
+  int length;
+  int capacity;
+  long budget;
+  long bytes;
+  int gop;
+  long clock;
+  long hits;
+  long misses;
+} FrameCache;
+
+int frame_cache_create(FrameCache **frame_cache, long budget, int gop);
+
+void frame_cache_free(FrameCache **frame_cache);
+
+// drop every frame, the stats are kept
+void frame_cache_clear(FrameCache *frame_cache);
+
+// keep a reference to frame, which shows from pts for duration
+int frame_cache_put(FrameCache *frame_cache, const AVFrame *frame, int64_t pts, int64_t duration, int64_t gop);
+
+// the frame showing at pts, NULL on a miss
+CachedFrame *frame_cache_get(FrameCache *frame_cache, int64_t pts);
+#endif
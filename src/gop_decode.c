@@ -0,0 +1,531 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <libavutil/avutil.h>
+#include <libavutil/imgutils.h>
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+
+#include "image_pool.h"
+
+// decode a seekable file with one decoder per core. the video stream is cut at
+// its keyframes, every gop is decoded on its own by whichever worker is free and
+// the frames are written in presentation order.
+
+#define MAX_THREADS 16
+// gops decoded ahead of the one being written, per worker, bounds the frames held in memory
+#define INFLIGHT_PER_THREAD 2
+
+typedef struct GopRange
+{
+  // dts of the keyframe the gop starts with, from the index
+  int64_t key_dts;
+  AVFrame **frames;
+  int nb_frames;
+  int capacity;
+  int done;
+} GopRange;
+
+typedef struct GopDecoder
+{
+  const char *file_name;
+  int stream_index;
+  int nb_threads;
+
+  GopRange *ranges;
+  int nb_ranges;
+  // next gop to hand out and next gop to write
+  int next_range;
+  int next_emit;
+  int emitting;
+  int ret;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+
+  FILE *output;
+  ImagePool *images;
+  int64_t frame_count;
+  // over the pts order and a sample of every frame, equal for every thread count
+  uint64_t checksum;
+} GopDecoder;
+
+static double now_seconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t fnv1a(uint64_t hash, const uint8_t *data, size_t size)
+{
+  for (size_t i = 0; i < size; i++)
+  {
+    hash = (hash ^ data[i]) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+static int open_input(AVFormatContext **fmt_ctx, const char *file_name)
+{
+  int ret;
+  if ((ret = avformat_open_input(fmt_ctx, file_name, NULL, NULL)) < 0)
+  {
+    fprintf(stderr, "Could not open source file %s\n", file_name);
+    return ret;
+  }
+  if ((ret = avformat_find_stream_info(*fmt_ctx, NULL)) < 0)
+  {
+    fprintf(stderr, "Could not find streams\n");
+    return ret;
+  }
+  return 0;
+}
+
+static int add_range(GopDecoder *d, int64_t key_dts, int *capacity)
+{
+  if (d->nb_ranges == *capacity)
+  {
+    GopRange *ranges;
+    *capacity = FFMAX(64, *capacity * 2);
+    if (!(ranges = av_realloc_array(d->ranges, *capacity, sizeof(GopRange))))
+    {
+      return AVERROR(ENOMEM);
+    }
+    d->ranges = ranges;
+  }
+  memset(&d->ranges[d->nb_ranges], 0, sizeof(GopRange));
+  d->ranges[d->nb_ranges++].key_dts = key_dts;
+  return 0;
+}
+
+// keyframes from the container index, or from a packet scan when the container
+// has none (mpeg-ts, raw elementary streams)
+static int find_gops(GopDecoder *d)
+{
+  int ret;
+  int capacity = 0;
+  AVStream *st;
+  AVPacket *pkt = NULL;
+  AVFormatContext *fmt_ctx = NULL;
+
+  if ((ret = open_input(&fmt_ctx, d->file_name)) < 0)
+    goto end;
+  if ((ret = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, NULL, 0)) < 0)
+  {
+    fprintf(stderr, "Could not find video stream in input file\n");
+    goto end;
+  }
+  d->stream_index = ret;
+  st = fmt_ctx->streams[d->stream_index];
+
+  for (int i = 0; i < avformat_index_get_entries_count(st); i++)
+  {
+    const AVIndexEntry *entry = avformat_index_get_entry(st, i);
+    if ((entry->flags & AVINDEX_KEYFRAME) && (ret = add_range(d, entry->timestamp, &capacity)) < 0)
+      goto end;
+  }
+
+  if (d->nb_ranges == 0)
+  {
+    if (!(pkt = av_packet_alloc()))
+    {
+      ret = AVERROR(ENOMEM);
+      goto end;
+    }
+    for (unsigned int i = 0; i < fmt_ctx->nb_streams; i++)
+    {
+      if ((int)i != d->stream_index) fmt_ctx->streams[i]->discard = AVDISCARD_ALL;
+    }
+    while (av_read_frame(fmt_ctx, pkt) >= 0)
+    {
+      ret = 0;
+      if (pkt->stream_index == d->stream_index && (pkt->flags & AV_PKT_FLAG_KEY) && pkt->dts != AV_NOPTS_VALUE)
+      {
+        ret = add_range(d, pkt->dts, &capacity);
+      }
+      av_packet_unref(pkt);
+      if (ret < 0)
+        goto end;
+    }
+  }
+  ret = d->nb_ranges > 0 ? 0 : AVERROR_INVALIDDATA;
+
+end:
+  av_packet_free(&pkt);
+  avformat_close_input(&fmt_ctx);
+  return ret;
+}
+
+static int64_t packet_ts(const AVPacket *pkt)
+{
+  return pkt->pts != AV_NOPTS_VALUE ? pkt->pts : pkt->dts;
+}
+
+static int keep_frame(GopRange *range, AVFrame *frame)
+{
+  AVFrame **frames;
+  if (range->nb_frames == range->capacity)
+  {
+    int capacity = FFMAX(32, range->capacity * 2);
+    if (!(frames = av_realloc_array(range->frames, capacity, sizeof(AVFrame *))))
+    {
+      return AVERROR(ENOMEM);
+    }
+    range->frames = frames;
+    range->capacity = capacity;
+  }
+  if (!(range->frames[range->nb_frames] = av_frame_clone(frame)))
+  {
+    return AVERROR(ENOMEM);
+  }
+  range->nb_frames++;
+  return 0;
+}
+
+static int receive_frames(AVCodecContext *dec_ctx, AVFrame *frame, GopRange *range)
+{
+  int ret;
+  while ((ret = avcodec_receive_frame(dec_ctx, frame)) >= 0)
+  {
+    frame->pts = frame->best_effort_timestamp;
+    ret = keep_frame(range, frame);
+    av_frame_unref(frame);
+    if (ret < 0)
+      return ret;
+  }
+  return (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) ? 0 : ret;
+}
+
+// decode from the keyframe of range up to the keyframe of the next one. packets
+// after that keyframe with an earlier pts (open gop leading pictures) still belong
+// to this range, frames outside [start, end) in pts are dropped afterwards.
+static int decode_range(GopDecoder *d, int index, AVFormatContext *fmt_ctx, AVCodecContext *dec_ctx, AVPacket *pkt, AVFrame *frame)
+{
+  int ret;
+  int n = 0;
+  GopRange *range = &d->ranges[index];
+  int64_t end_dts = index + 1 < d->nb_ranges ? d->ranges[index + 1].key_dts : INT64_MAX;
+  int64_t start_pts = AV_NOPTS_VALUE;
+  int64_t end_pts = AV_NOPTS_VALUE;
+
+  if ((ret = av_seek_frame(fmt_ctx, d->stream_index, range->key_dts, AVSEEK_FLAG_BACKWARD)) < 0)
+  {
+    fprintf(stderr, "Could not seek to gop %d (%s)\n", index, av_err2str(ret));
+    return ret;
+  }
+  avcodec_flush_buffers(dec_ctx);
+
+  while (av_read_frame(fmt_ctx, pkt) >= 0)
+  {
+    int key = pkt->flags & AV_PKT_FLAG_KEY;
+    int64_t ts = packet_ts(pkt);
+
+    if (pkt->stream_index != d->stream_index)
+    {
+      av_packet_unref(pkt);
+      continue;
+    }
+    // the seek may land on an earlier keyframe
+    if (start_pts == AV_NOPTS_VALUE)
+    {
+      if (!key || pkt->dts < range->key_dts)
+      {
+        av_packet_unref(pkt);
+        continue;
+      }
+      start_pts = ts;
+    }
+    if (end_pts == AV_NOPTS_VALUE && key && pkt->dts != AV_NOPTS_VALUE && pkt->dts >= end_dts)
+    {
+      end_pts = ts;
+    }
+    else if (end_pts != AV_NOPTS_VALUE && ts >= end_pts)
+    {
+      av_packet_unref(pkt);
+      break;
+    }
+    ret = avcodec_send_packet(dec_ctx, pkt);
+    av_packet_unref(pkt);
+    if (ret < 0 || (ret = receive_frames(dec_ctx, frame, range)) < 0)
+    {
+      fprintf(stderr, "Error decoding gop %d (%s)\n", index, av_err2str(ret));
+      return ret;
+    }
+  }
+
+  // drain, the decoder is flushed before the next range
+  if ((ret = avcodec_send_packet(dec_ctx, NULL)) < 0 || (ret = receive_frames(dec_ctx, frame, range)) < 0)
+    return ret;
+
+  for (int i = 0; i < range->nb_frames; i++)
+  {
+    AVFrame *f = range->frames[i];
+    if (f->pts != AV_NOPTS_VALUE &&
+        ((start_pts != AV_NOPTS_VALUE && f->pts < start_pts) || (end_pts != AV_NOPTS_VALUE && f->pts >= end_pts)))
+    {
+      av_frame_free(&range->frames[i]);
+      continue;
+    }
+    range->frames[n++] = f;
+  }
+  range->nb_frames = n;
+  return 0;
+}
+
+static int write_frame(GopDecoder *d, AVFrame *frame)
+{
+  int ret;
+  ImageBuffer *image;
+
+  d->frame_count++;
+  d->checksum = fnv1a(d->checksum, (const uint8_t *)&frame->pts, sizeof(frame->pts));
+  d->checksum = fnv1a(d->checksum, frame->data[0], FFMIN(frame->linesize[0], 64));
+  if (!d->output) return 0;
+
+  if ((ret = image_pool_get(d->images, &image, frame->width, frame->height, frame->format)) < 0)
+  {
+    return ret;
+  }
+  av_image_copy(image->data, image->line_size,
+                (const uint8_t **)(frame->data), frame->linesize,
+                frame->format, frame->width, frame->height);
+  fwrite(image->data[0], 1, image->size, d->output);
+  return 0;
+}
+
+// write every finished range that is next in line. one worker writes at a time,
+// the others keep decoding meanwhile. called with the mutex held.
+static void emit_ranges(GopDecoder *d)
+{
+  int ret = 0;
+  if (d->emitting) return;
+  d->emitting = 1;
+  while (d->next_emit < d->nb_ranges && d->ranges[d->next_emit].done)
+  {
+    GopRange *range = &d->ranges[d->next_emit];
+    pthread_mutex_unlock(&d->mutex);
+    for (int i = 0; i < range->nb_frames; i++)
+    {
+      if (ret == 0) ret = write_frame(d, range->frames[i]);
+      av_frame_free(&range->frames[i]);
+    }
+    av_freep(&range->frames);
+    pthread_mutex_lock(&d->mutex);
+    if (ret < 0 && d->ret == 0) d->ret = ret;
+    d->next_emit++;
+    pthread_cond_broadcast(&d->cond);
+  }
+  d->emitting = 0;
+}
+
+static int open_decoder(AVCodecContext **dec_ctx, AVStream *st)
+{
+  int ret;
+  const AVCodec *dec;
+
+  if (!(dec = avcodec_find_decoder(st->codecpar->codec_id)))
+  {
+    fprintf(stderr, "Failed to find video codec\n");
+    return AVERROR(EINVAL);
+  }
+  if (!(*dec_ctx = avcodec_alloc_context3(dec)))
+  {
+    return AVERROR(ENOMEM);
+  }
+  if ((ret = avcodec_parameters_to_context(*dec_ctx, st->codecpar)) < 0)
+  {
+    return ret;
+  }
+  (*dec_ctx)->pkt_timebase = st->time_base;
+  // the parallelism comes from the gops, one core per decoder
+  (*dec_ctx)->thread_count = 1;
+  return avcodec_open2(*dec_ctx, dec, NULL);
+}
+
+static void *gop_worker(void *arg)
+{
+  int ret;
+  int index;
+  GopDecoder *d = arg;
+  AVFormatContext *fmt_ctx = NULL;
+  AVCodecContext *dec_ctx = NULL;
+  AVPacket *pkt = av_packet_alloc();
+  AVFrame *frame = av_frame_alloc();
+
+  if (!pkt || !frame)
+  {
+    ret = AVERROR(ENOMEM);
+    goto end;
+  }
+  if ((ret = open_input(&fmt_ctx, d->file_name)) < 0 ||
+      (ret = open_decoder(&dec_ctx, fmt_ctx->streams[d->stream_index])) < 0)
+  {
+    goto end;
+  }
+  for (unsigned int i = 0; i < fmt_ctx->nb_streams; i++)
+  {
+    if ((int)i != d->stream_index) fmt_ctx->streams[i]->discard = AVDISCARD_ALL;
+  }
+
+  for (;;)
+  {
+    pthread_mutex_lock(&d->mutex);
+    while (d->ret == 0 && d->next_range < d->nb_ranges &&
+           d->next_range - d->next_emit >= d->nb_threads * INFLIGHT_PER_THREAD)
+    {
+      pthread_cond_wait(&d->cond, &d->mutex);
+    }
+    if (d->ret != 0 || d->next_range >= d->nb_ranges)
+    {
+      pthread_mutex_unlock(&d->mutex);
+      break;
+    }
+    index = d->next_range++;
+    pthread_mutex_unlock(&d->mutex);
+
+    ret = decode_range(d, index, fmt_ctx, dec_ctx, pkt, frame);
+
+    pthread_mutex_lock(&d->mutex);
+    if (ret < 0 && d->ret == 0) d->ret = ret;
+    d->ranges[index].done = 1;
+    emit_ranges(d);
+    pthread_cond_broadcast(&d->cond);
+    pthread_mutex_unlock(&d->mutex);
+  }
+  ret = 0;
+
+end:
+  if (ret < 0)
+  {
+    pthread_mutex_lock(&d->mutex);
+    if (d->ret == 0) d->ret = ret;
+    pthread_cond_broadcast(&d->cond);
+    pthread_mutex_unlock(&d->mutex);
+  }
+  avcodec_free_context(&dec_ctx);
+  avformat_close_input(&fmt_ctx);
+  av_packet_free(&pkt);
+  av_frame_free(&frame);
+  return NULL;
+}
+
+static void gop_decoder_reset(GopDecoder *d)
+{
+  for (int i = 0; i < d->nb_ranges; i++)
+  {
+    for (int j = 0; j < d->ranges[i].nb_frames; j++)
+    {
+      av_frame_free(&d->ranges[i].frames[j]);
+    }
+    av_freep(&d->ranges[i].frames);
+    d->ranges[i].nb_frames = 0;
+    d->ranges[i].capacity = 0;
+    d->ranges[i].done = 0;
+  }
+  d->next_range = 0;
+  d->next_emit = 0;
+  d->emitting = 0;
+  d->ret = 0;
+  d->frame_count = 0;
+  d->checksum = 0xcbf29ce484222325ULL;
+}
+
+static int gop_decode_run(GopDecoder *d, int nb_threads)
+{
+  pthread_t threads[MAX_THREADS];
+  int started = 0;
+
+  gop_decoder_reset(d);
+  d->nb_threads = nb_threads;
+  for (int i = 0; i < nb_threads; i++)
+  {
+    if (pthread_create(&threads[i], NULL, &gop_worker, d) != 0)
+    {
+      fprintf(stderr, "Could not start worker %d\n", i);
+      break;
+    }
+    started++;
+  }
+  if (started == 0)
+  {
+    return AVERROR(EAGAIN);
+  }
+  for (int i = 0; i < started; i++)
+  {
+    pthread_join(threads[i], NULL);
+  }
+  if (d->ret == 0 && d->next_emit != d->nb_ranges)
+  {
+    d->ret = AVERROR_BUG;
+  }
+  return d->ret;
+}
+
+int main(int argc, char *argv[])
+{
+  int ret;
+  int bench;
+  int nb_threads;
+  double started, elapsed, baseline = 0;
+  GopDecoder d = { 0 };
+
+  if (argc < 3)
+  {
+    fprintf(stderr, "usage: %s input_file threads|bench [video_output_file]\n"
+            "Decode the video of a seekable file one gop per worker and write the\n"
+            "frames in presentation order as rawvideo. bench decodes with 1 to %d\n"
+            "workers and reports the speedup.\n",
+            argv[0], MAX_THREADS);
+    exit(1);
+  }
+
+  d.file_name = argv[1];
+  bench = strcmp(argv[2], "bench") == 0;
+  nb_threads = bench ? 1 : av_clip(atoi(argv[2]), 1, MAX_THREADS);
+  pthread_mutex_init(&d.mutex, NULL);
+  pthread_cond_init(&d.cond, NULL);
+
+  if ((ret = find_gops(&d)) < 0)
+    goto end;
+  printf("%d gops in video stream %d\n", d.nb_ranges, d.stream_index);
+
+  if (!bench && argc > 3)
+  {
+    if (!(d.output = fopen(argv[3], "wb")))
+    {
+      fprintf(stderr, "Could not open destination file %s\n", argv[3]);
+      ret = 1;
+      goto end;
+    }
+    if ((ret = image_pool_create(&d.images)) < 0)
+      goto end;
+  }
+
+  for (; nb_threads <= MAX_THREADS; nb_threads *= 2)
+  {
+    started = now_seconds();
+    if ((ret = gop_decode_run(&d, nb_threads)) < 0)
+    {
+      fprintf(stderr, "Decoding failed with %d threads (%s)\n", nb_threads, av_err2str(ret));
+      goto end;
+    }
+    elapsed = now_seconds() - started;
+    if (nb_threads == 1) baseline = elapsed;
+    printf("threads:%2d frames:%lld time:%.3fs fps:%.1f speedup:%.2f checksum:%016llx\n",
+           nb_threads, (long long)d.frame_count, elapsed, d.frame_count / elapsed,
+           baseline > 0 ? baseline / elapsed : 1.0, (unsigned long long)d.checksum);
+    if (!bench) break;
+  }
+
+end:
+  gop_decoder_reset(&d);
+  av_free(d.ranges);
+  image_pool_free(&d.images);
+  if (d.output) fclose(d.output);
+  pthread_mutex_destroy(&d.mutex);
+  pthread_cond_destroy(&d.cond);
+  return ret < 0;
+}
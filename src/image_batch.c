@@ -0,0 +1,383 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <libavutil/avutil.h>
+#include <libavformat/avformat.h>
+#include <libavformat/avio.h>
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+
+#include "image_batch.h"
+#include "image_pool.h"
+
+#define IMAGE_IO_BUFFER_SIZE (MEMORY_PAGE / 2)
+
+// one image_batch_run, lives on the caller's stack so batches can run side by side
+typedef struct ImageBatchRun
+{
+  ImageBatch *batch;
+  ImageRequest *requests;
+} ImageBatchRun;
+
+int image_batch_create(ImageBatch **image_batch, ThreadPool *pool)
+{
+  ImageBatch *batch;
+
+  if (!(batch = calloc(1, sizeof(ImageBatch))))
+  {
+    return AVERROR(ENOMEM);
+  }
+  batch->pool = pool;
+  pthread_mutex_init(&batch->mutex, NULL);
+
+  *image_batch = batch;
+
+  return 0;
+}
+
+static void image_worker_free(ImageWorker **image_worker)
+{
+  ImageWorker *w = *image_worker;
+  if (w == NULL) return;
+  memory_stream_free(&w->input);
+  for (int i = 0; i < w->nb_decoders; i++)
+  {
+    avcodec_free_context(&w->decoders[i]);
+  }
+  avcodec_free_context(&w->enc);
+  sws_freeContext(w->sws);
+  av_frame_free(&w->frame);
+  av_frame_free(&w->scaled);
+  av_packet_free(&w->pkt);
+  free(w);
+  *image_worker = NULL;
+}
+
+void image_batch_free(ImageBatch **image_batch)
+{
+  ImageWorker *w;
+  ImageBatch *batch = *image_batch;
+  if (batch == NULL) return;
+  while ((w = batch->idle))
+  {
+    batch->idle = w->next;
+    image_worker_free(&w);
+  }
+  pthread_mutex_destroy(&batch->mutex);
+  free(batch);
+  *image_batch = NULL;
+}
+
+static int image_worker_create(ImageWorker **image_worker)
+{
+  ImageWorker *w;
+
+  if (!(w = calloc(1, sizeof(ImageWorker))))
+  {
+    return AVERROR(ENOMEM);
+  }
+  if (memory_stream_create(&w->input, MEMORY_PAGE, 0) != 0 ||
+      !(w->frame = av_frame_alloc()) || !(w->scaled = av_frame_alloc()) || !(w->pkt = av_packet_alloc()))
+  {
+    image_worker_free(&w);
+    return AVERROR(ENOMEM);
+  }
+
+  *image_worker = w;
+
+  return 0;
+}
+
+// an idle worker, or a new one when all are busy
+static ImageWorker *acquire_worker(ImageBatch *image_batch)
+{
+  ImageWorker *w;
+
+  pthread_mutex_lock(&image_batch->mutex);
+  if ((w = image_batch->idle))
+  {
+    image_batch->idle = w->next;
+  }
+  pthread_mutex_unlock(&image_batch->mutex);
+
+  if (!w && image_worker_create(&w) < 0)
+  {
+    return NULL;
+  }
+  return w;
+}
+
+static void release_worker(ImageBatch *image_batch, ImageWorker *w)
+{
+  pthread_mutex_lock(&image_batch->mutex);
+  w->next = image_batch->idle;
+  image_batch->idle = w;
+  pthread_mutex_unlock(&image_batch->mutex);
+}
+
+static int read_input(void *opaque, uint8_t *buf, int buf_size)
+{
+  size_t size = memory_stream_read(opaque, buf, buf_size);
+  return size > 0 ? (int)size : AVERROR_EOF;
+}
+
+static int64_t seek_input(void *opaque, int64_t offset, int whence)
+{
+  MemoryStream *ms = opaque;
+  if (whence == AVSEEK_SIZE) return ms->length;
+  return memory_stream_seek(ms, offset, whence);
+}
+
+// the worker's open decoder for par, opened on first use. the oldest one makes room
+static AVCodecContext *worker_decoder(ImageWorker *w, const AVCodecParameters *par)
+{
+  int ret;
+  int slot;
+  const AVCodec *codec;
+  AVCodecContext *ctx;
+
+  for (int i = 0; i < w->nb_decoders; i++)
+  {
+    if (w->decoders[i]->codec_id == par->codec_id) return w->decoders[i];
+  }
+
+  if (!(codec = avcodec_find_decoder(par->codec_id)))
+  {
+    fprintf(stderr, "Could not find %s decoder\n", avcodec_get_name(par->codec_id));
+    return NULL;
+  }
+  if (!(ctx = avcodec_alloc_context3(codec)))
+  {
+    return NULL;
+  }
+  // parallelism comes from the batch, one image per worker
+  ctx->thread_count = 1;
+  if ((ret = avcodec_parameters_to_context(ctx, par)) < 0 || (ret = avcodec_open2(ctx, codec, NULL)) < 0)
+  {
+    fprintf(stderr, "Could not open %s decoder (%s)\n", codec->name, av_err2str(ret));
+    avcodec_free_context(&ctx);
+    return NULL;
+  }
+
+  if (w->nb_decoders == IMAGE_WORKER_DECODERS)
+  {
+    avcodec_free_context(&w->decoders[0]);
+    memmove(w->decoders, w->decoders + 1, --w->nb_decoders * sizeof(*w->decoders));
+  }
+  slot = w->nb_decoders++;
+  w->decoders[slot] = ctx;
+  return ctx;
+}
+
+// probe and decode the request's input into w->frame, read through the memory stream like a session input
+static int decode_image(ImageWorker *w, ImageRequest *r)
+{
+  int ret;
+  uint8_t *io_buffer = NULL;
+  AVIOContext *io_ctx = NULL;
+  AVFormatContext *fmt_ctx = NULL;
+  AVCodecContext *dec_ctx;
+
+  memory_stream_reset(w->input, 0);
+  memory_stream_write(w->input, r->data, r->size);
+
+  if (!(io_buffer = av_malloc(IMAGE_IO_BUFFER_SIZE)) ||
+      !(io_ctx = avio_alloc_context(io_buffer, IMAGE_IO_BUFFER_SIZE, 0, w->input, &read_input, NULL, &seek_input)) ||
+      !(fmt_ctx = avformat_alloc_context()))
+  {
+    if (!io_ctx) av_free(io_buffer);
+    ret = AVERROR(ENOMEM);
+    goto end;
+  }
+  fmt_ctx->pb = io_ctx;
+
+  // image pipes know their codec from the probe, no find_stream_info needed
+  if ((ret = avformat_open_input(&fmt_ctx, NULL, NULL, NULL)) < 0)
+  {
+    fprintf(stderr, "Could not recognize image (%s)\n", av_err2str(ret));
+    goto end;
+  }
+  if (fmt_ctx->nb_streams < 1 || fmt_ctx->streams[0]->codecpar->codec_type != AVMEDIA_TYPE_VIDEO)
+  {
+    ret = AVERROR_INVALIDDATA;
+    goto end;
+  }
+  if (!(dec_ctx = worker_decoder(w, fmt_ctx->streams[0]->codecpar)))
+  {
+    ret = AVERROR_DECODER_NOT_FOUND;
+    goto end;
+  }
+
+  if ((ret = av_read_frame(fmt_ctx, w->pkt)) < 0)
+    goto end;
+  ret = avcodec_send_packet(dec_ctx, w->pkt);
+  av_packet_unref(w->pkt);
+  if (ret >= 0 && (ret = avcodec_send_packet(dec_ctx, NULL)) >= 0)
+  {
+    ret = avcodec_receive_frame(dec_ctx, w->frame);
+  }
+  // ready for the next image
+  avcodec_flush_buffers(dec_ctx);
+  if (ret < 0)
+  {
+    fprintf(stderr, "Could not decode image (%s)\n", av_err2str(ret));
+  }
+
+end:
+  avformat_close_input(&fmt_ctx);
+  if (io_ctx)
+  {
+    av_freep(&io_ctx->buffer);
+    avio_context_free(&io_ctx);
+  }
+  return ret;
+}
+
+// the worker's encoder, reopened only when codec, size or quality change
+static int worker_encoder(ImageWorker *w, ImageRequest *r, int width, int height)
+{
+  int ret;
+  const AVCodec *codec;
+  int global_quality = r->quality > 0 ? FF_QP2LAMBDA * av_clip(r->quality, 2, 31) : 0;
+
+  if (w->enc && w->enc->codec_id == r->codec_id && w->enc->width == width && w->enc->height == height &&
+      w->enc->global_quality == global_quality)
+  {
+    return 0;
+  }
+  avcodec_free_context(&w->enc);
+
+  if (!(codec = avcodec_find_encoder(r->codec_id)))
+  {
+    fprintf(stderr, "Could not find %s encoder\n", avcodec_get_name(r->codec_id));
+    return AVERROR_ENCODER_NOT_FOUND;
+  }
+  if (!(w->enc = avcodec_alloc_context3(codec)))
+  {
+    return AVERROR(ENOMEM);
+  }
+  w->enc->width = width;
+  w->enc->height = height;
+  w->enc->pix_fmt = codec->pix_fmts ? codec->pix_fmts[0] : AV_PIX_FMT_YUV420P;
+  w->enc->time_base = (AVRational){ 1, 25 };
+  w->enc->thread_count = 1;
+  if (global_quality)
+  {
+    w->enc->flags |= AV_CODEC_FLAG_QSCALE;
+    w->enc->global_quality = global_quality;
+  }
+  if ((ret = avcodec_open2(w->enc, codec, NULL)) < 0)
+  {
+    fprintf(stderr, "Could not open %s encoder (%s)\n", codec->name, av_err2str(ret));
+    avcodec_free_context(&w->enc);
+    return ret;
+  }
+  return 0;
+}
+
+static int scale_image(ImageWorker *w, int width, int height)
+{
+  int ret;
+  AVFrame *scaled = w->scaled;
+
+  if (scaled->width != width || scaled->height != height || scaled->format != w->enc->pix_fmt)
+  {
+    av_frame_unref(scaled);
+    scaled->width = width;
+    scaled->height = height;
+    scaled->format = w->enc->pix_fmt;
+    if ((ret = av_frame_get_buffer(scaled, 0)) < 0)
+      return ret;
+  }
+  // the encoder may still hold the previous image
+  else if ((ret = av_frame_make_writable(scaled)) < 0)
+  {
+    return ret;
+  }
+
+  if (!(w->sws = sws_getCachedContext(w->sws, w->frame->width, w->frame->height, w->frame->format,
+                                      width, height, scaled->format, SWS_BICUBIC, NULL, NULL, NULL)))
+  {
+    fprintf(stderr, "Could not create scale context for %dx%d!\n", width, height);
+    return AVERROR(EINVAL);
+  }
+  sws_scale(w->sws, (const uint8_t * const *)w->frame->data, w->frame->linesize, 0, w->frame->height,
+            scaled->data, scaled->linesize);
+  return 0;
+}
+
+static int process_image(ImageWorker *w, ImageRequest *r)
+{
+  int ret;
+  int width = r->width;
+  int height = r->height;
+
+  if ((ret = decode_image(w, r)) < 0)
+    return ret;
+
+  if (width <= 0 && height <= 0)
+  {
+    width = w->frame->width;
+    height = w->frame->height;
+  }
+  else if (width <= 0)
+  {
+    width = image_follow_aspect(height, w->frame->width, w->frame->height);
+  }
+  else if (height <= 0)
+  {
+    height = image_follow_aspect(width, w->frame->height, w->frame->width);
+  }
+
+  if ((ret = worker_encoder(w, r, width, height)) < 0 || (ret = scale_image(w, width, height)) < 0)
+    goto end;
+
+  if (!r->output && !(r->output = av_packet_alloc()))
+  {
+    ret = AVERROR(ENOMEM);
+    goto end;
+  }
+  av_packet_unref(r->output);
+  w->scaled->quality = w->enc->global_quality;
+  if ((ret = avcodec_send_frame(w->enc, w->scaled)) >= 0)
+  {
+    ret = avcodec_receive_packet(w->enc, r->output);
+  }
+  if (ret < 0)
+  {
+    fprintf(stderr, "Could not encode image (%s)\n", av_err2str(ret));
+  }
+
+end:
+  av_frame_unref(w->frame);
+  return ret;
+}
+
+static void image_job(void *arg, int index)
+{
+  ImageBatchRun *run = arg;
+  ImageRequest *r = &run->requests[index];
+  ImageWorker *w;
+
+  if (!(w = acquire_worker(run->batch)))
+  {
+    r->ret = AVERROR(ENOMEM);
+    return;
+  }
+  r->ret = process_image(w, r);
+  release_worker(run->batch, w);
+}
+
+int image_batch_run(ImageBatch *image_batch, ImageRequest *requests, int count, int priority)
+{
+  ImageBatchRun run = { .batch = image_batch, .requests = requests };
+
+  thread_pool_run(image_batch->pool, &image_job, &run, count, priority);
+
+  for (int i = 0; i < count; i++)
+  {
+    if (requests[i].ret < 0) return requests[i].ret;
+  }
+  return 0;
+}
@@ -0,0 +1,64 @@
+#ifndef IMAGE_BATCH_H
+#define IMAGE_BATCH_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include <libavcodec/avcodec.h>
+
+#include "memory_stream.h"
+#include "thread_pool.h"
+
+// decoders a worker keeps open, one per input codec
+#define IMAGE_WORKER_DECODERS 4
+
+struct SwsContext;
+
+// one image of a batch: encoded input in, re-encoded output out
+typedef struct ImageRequest
+{
+  const uint8_t *data;
+  size_t size;
+  // output size, a side <= 0 follows the aspect ratio of the input, both <= 0 keep it
+  int width;
+  int height;
+  // output encoder, AV_CODEC_ID_MJPEG, AV_CODEC_ID_PNG or any other still image encoder of the build
+  enum AVCodecID codec_id;
+  // qscale for lossy encoders, 2 (best) to 31, 0 for the encoder default
+  int quality;
+  // the encoded image, allocated on first use and reused by later batches. free with av_packet_free
+  AVPacket *output;
+  int ret;
+} ImageRequest;
+
+// codec contexts and buffers of one worker, reused from image to image
+typedef struct ImageWorker
+{
+  MemoryStream *input;
+  AVCodecContext *decoders[IMAGE_WORKER_DECODERS];
+  int nb_decoders;
+  AVCodecContext *enc;
+  struct SwsContext *sws;
+  AVFrame *frame;
+  AVFrame *scaled;
+  AVPacket *pkt;
+  struct ImageWorker *next;
+} ImageWorker;
+
+// decodes, resizes and re-encodes images on a thread pool. every job borrows an
+// idle worker, so no more workers are created than jobs ever ran at once.
+typedef struct ImageBatch
+{
+  ThreadPool *pool;
+  pthread_mutex_t mutex;
+  ImageWorker *idle;
+} ImageBatch;
+
+int image_batch_create(ImageBatch **image_batch, ThreadPool *pool);
+
+void image_batch_free(ImageBatch **image_batch);
+
+// process count requests on the pool, returns once all are done. each request
+// reports its own outcome in ret, the first error is returned as well
+int image_batch_run(ImageBatch *image_batch, ImageRequest *requests, int count, int priority);
+#endif
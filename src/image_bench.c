@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <dirent.h>
+
+#include <libavutil/avutil.h>
+#include <libavutil/file.h>
+#include <libavcodec/avcodec.h>
+
+#include "image_batch.h"
+#include "thread_pool.h"
+
+// decode, resize and re-encode every image of a directory through the batch image
+// engine and report images per second, for one thread count or 1 to MAX_THREADS.
+
+#define MAX_THREADS 16
+#define MAX_IMAGES 4096
+// the corpus is repeated until a run has at least this many images
+#define MIN_BATCH 256
+
+typedef struct Corpus
+{
+  char *names[MAX_IMAGES];
+  uint8_t *data[MAX_IMAGES];
+  size_t size[MAX_IMAGES];
+  int nb_images;
+} Corpus;
+
+static double now_seconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int is_image(const char *name)
+{
+  const char *ext = strrchr(name, '.');
+  return ext && (!strcasecmp(ext, ".jpg") || !strcasecmp(ext, ".jpeg") || !strcasecmp(ext, ".png") || !strcasecmp(ext, ".webp"));
+}
+
+static int load_corpus(Corpus *c, const char *dir_name)
+{
+  int ret;
+  char path[4096];
+  struct dirent *entry;
+  DIR *dir;
+
+  if (!(dir = opendir(dir_name)))
+  {
+    fprintf(stderr, "Could not open directory %s\n", dir_name);
+    return AVERROR(ENOENT);
+  }
+  while ((entry = readdir(dir)) && c->nb_images < MAX_IMAGES)
+  {
+    if (!is_image(entry->d_name)) continue;
+    snprintf(path, sizeof(path), "%s/%s", dir_name, entry->d_name);
+    if ((ret = av_file_map(path, &c->data[c->nb_images], &c->size[c->nb_images], 0, NULL)) < 0)
+    {
+      fprintf(stderr, "Could not read %s (%s)\n", path, av_err2str(ret));
+      continue;
+    }
+    c->names[c->nb_images++] = strdup(entry->d_name);
+  }
+  closedir(dir);
+  return c->nb_images ? 0 : AVERROR(ENOENT);
+}
+
+static void write_outputs(ImageRequest *requests, int count, Corpus *c, const char *dir_name)
+{
+  char path[4096];
+  FILE *f;
+
+  for (int i = 0; i < count && i < c->nb_images; i++)
+  {
+    if (requests[i].ret < 0) continue;
+    snprintf(path, sizeof(path), "%s/%s.jpg", dir_name, c->names[i]);
+    if (!(f = fopen(path, "wb")))
+    {
+      fprintf(stderr, "Could not open destination file %s\n", path);
+      continue;
+    }
+    fwrite(requests[i].output->data, 1, requests[i].output->size, f);
+    fclose(f);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  int ret;
+  int bench;
+  int nb_threads;
+  int count = 0;
+  long failed;
+  int64_t bytes;
+  double started, elapsed, baseline = 0;
+  Corpus c = { 0 };
+  ImageRequest *requests = NULL;
+  ThreadPool *pool = NULL;
+  ImageBatch *batch = NULL;
+
+  if (argc < 3)
+  {
+    fprintf(stderr, "usage: %s image_dir threads|bench [width] [output_dir]\n"
+            "Decode the jpeg/png/webp images of a directory, resize them to width\n"
+            "(320 by default) and encode them to jpeg on a thread pool. bench runs\n"
+            "with 1 to %d threads and reports the speedup.\n",
+            argv[0], MAX_THREADS);
+    exit(1);
+  }
+
+  bench = strcmp(argv[2], "bench") == 0;
+  nb_threads = bench ? 1 : av_clip(atoi(argv[2]), 1, MAX_THREADS);
+
+  if ((ret = load_corpus(&c, argv[1])) < 0)
+  {
+    fprintf(stderr, "No images in %s\n", argv[1]);
+    goto end;
+  }
+  count = FFMAX(c.nb_images, (MIN_BATCH + c.nb_images - 1) / c.nb_images * c.nb_images);
+  if (!(requests = calloc(count, sizeof(ImageRequest))))
+  {
+    ret = AVERROR(ENOMEM);
+    goto end;
+  }
+  for (int i = 0; i < count; i++)
+  {
+    requests[i].data = c.data[i % c.nb_images];
+    requests[i].size = c.size[i % c.nb_images];
+    requests[i].width = argc > 3 ? atoi(argv[3]) : 320;
+    requests[i].height = -1;
+    requests[i].codec_id = AV_CODEC_ID_MJPEG;
+    requests[i].quality = 5;
+  }
+  printf("%d images, %d per run\n", c.nb_images, count);
+
+  for (; nb_threads <= MAX_THREADS; nb_threads *= 2)
+  {
+    // the caller works on its batch too, so threads - 1 pool workers
+    if (nb_threads > 1 && (ret = thread_pool_create(&pool, nb_threads - 1)) < 0)
+      goto end;
+    if ((ret = image_batch_create(&batch, pool)) < 0)
+      goto end;
+
+    // the first run opens the codec contexts every later one reuses
+    image_batch_run(batch, requests, count, THREAD_POOL_PRIORITY_NORMAL);
+    started = now_seconds();
+    image_batch_run(batch, requests, count, THREAD_POOL_PRIORITY_NORMAL);
+    elapsed = now_seconds() - started;
+
+    failed = 0;
+    bytes = 0;
+    for (int i = 0; i < count; i++)
+    {
+      if (requests[i].ret < 0) failed++;
+      else bytes += requests[i].output->size;
+    }
+    if (nb_threads == 1) baseline = elapsed;
+    printf("threads:%2d images:%d failed:%ld time:%.3fs images/s:%.1f speedup:%.2f output:%lld bytes\n",
+           nb_threads, count, failed, elapsed, count / elapsed, baseline > 0 ? baseline / elapsed : 1.0, (long long)bytes);
+
+    if (!bench && argc > 4)
+    {
+      write_outputs(requests, count, &c, argv[4]);
+    }
+    image_batch_free(&batch);
+    thread_pool_free(&pool);
+    if (!bench) break;
+  }
+
+end:
+  image_batch_free(&batch);
+  thread_pool_free(&pool);
+  if (requests)
+  {
+    for (int i = 0; i < count; i++)
+    {
+      av_packet_free(&requests[i].output);
+    }
+    free(requests);
+  }
+  for (int i = 0; i < c.nb_images; i++)
+  {
+    av_file_unmap(c.data[i], c.size[i]);
+    free(c.names[i]);
+  }
+  if (ret < 0)
+  {
+    fprintf(stderr, "Error occurred: %s\n", av_err2str(ret));
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,102 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <libavutil/avutil.h>
+#include <libavutil/imgutils.h>
+
+#include "image_pool.h"
+
+int image_pool_create(ImagePool **image_pool)
+{
+  ImagePool *pool;
+
+  if (!(pool = calloc(1, sizeof(ImagePool))))
+  {
+    return AVERROR(ENOMEM);
+  }
+
+  *image_pool = pool;
+
+  return 0;
+}
+
+void image_pool_free(ImagePool **image_pool)
+{
+  ImagePool *pool = *image_pool;
+  if (pool == NULL) return;
+  for (int i = 0; i < pool->length; i++)
+  {
+    av_freep(&pool->buffers[i].data[0]);
+  }
+  free(pool);
+  *image_pool = NULL;
+}
+
+void image_pool_reset(ImagePool *image_pool)
+{
+  image_pool->current = NULL;
+}
+
+static ImageBuffer *image_pool_find(ImagePool *image_pool, int width, int height, int format)
+{
+  for (int i = 0; i < image_pool->length; i++)
+  {
+    ImageBuffer *buffer = &image_pool->buffers[i];
+    if (buffer->width == width && buffer->height == height && buffer->format == format) return buffer;
+  }
+  return NULL;
+}
+
+// a free slot, or the least recently used one once the pool is full
+static ImageBuffer *image_pool_evict(ImagePool *image_pool)
+{
+  ImageBuffer *victim;
+  if (image_pool->length < IMAGE_POOL_SIZE)
+  {
+    return &image_pool->buffers[image_pool->length++];
+  }
+  victim = &image_pool->buffers[0];
+  for (int i = 1; i < image_pool->length; i++)
+  {
+    if (image_pool->buffers[i].last_used < victim->last_used) victim = &image_pool->buffers[i];
+  }
+  av_freep(&victim->data[0]);
+  return victim;
+}
+
+int image_pool_get(ImagePool *image_pool, ImageBuffer **image_buffer, int width, int height, int format)
+{
+  int ret;
+  ImageBuffer *buffer;
+  ImageBuffer *previous = image_pool->current;
+  // the previous buffer may be the one evicted below
+  int changed = previous == NULL || previous->width != width || previous->height != height || previous->format != format;
+
+  if (!(buffer = image_pool_find(image_pool, width, height, format)))
+  {
+    buffer = image_pool_evict(image_pool);
+    if ((ret = av_image_alloc(buffer->data, buffer->line_size, width, height, format, 1)) < 0)
+    {
+      fprintf(stderr, "Could not allocate raw video buffer\n");
+      buffer->width = buffer->height = 0;
+      buffer->format = -1;
+      image_pool->current = NULL;
+      return ret;
+    }
+    buffer->size = ret;
+    buffer->width = width;
+    buffer->height = height;
+    buffer->format = format;
+  }
+
+  buffer->last_used = ++image_pool->clock;
+  image_pool->current = buffer;
+  *image_buffer = buffer;
+
+  return changed;
+}
+
+int image_follow_aspect(int other, int source_side, int source_other)
+{
+  return FFMAX(2, (int)((int64_t)other * source_side / source_other) & ~1);
+}
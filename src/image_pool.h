@@ -0,0 +1,41 @@
+#ifndef IMAGE_POOL_H
+#define IMAGE_POOL_H
+
+#include <stdint.h>
+
+// distinct (width, height, format) buffers kept around, enough for an abr ladder
+#define IMAGE_POOL_SIZE 4
+
+typedef struct ImageBuffer
+{
+  uint8_t *data[4];
+  int line_size[4];
+  long size;
+  int width;
+  int height;
+  int format;
+  long last_used;
+} ImageBuffer;
+
+typedef struct ImagePool
+{
+  ImageBuffer buffers[IMAGE_POOL_SIZE];
+  int length;
+  ImageBuffer *current;
+  long clock;
+} ImagePool;
+
+int image_pool_create(ImagePool **image_pool);
+
+void image_pool_free(ImagePool **image_pool);
+
+// forget the current buffer so the next get reports a change
+void image_pool_reset(ImagePool *image_pool);
+
+// returns 1 when the buffer differs in geometry or format from the previous get, 0 when not, < 0 on error
+int image_pool_get(ImagePool *image_pool, ImageBuffer **image_buffer, int width, int height, int format);
+
+// the side of a scaled image whose other side is given, following the source's aspect
+// ratio. even sizes keep chroma subsampled formats happy
+int image_follow_aspect(int other, int source_side, int source_other);
+#endif
@@ -0,0 +1,189 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavutil/avutil.h>
+#include <libavcodec/avcodec.h>
+
+#include "jitter_buffer.h"
+
+int jitter_buffer_create(JitterBuffer **jitter_buffer, int64_t target)
+{
+  JitterBuffer *jb;
+
+  if (!(jb = calloc(1, sizeof(JitterBuffer))))
+  {
+    return AVERROR(ENOMEM);
+  }
+  jb->target = target > 0 ? target : JITTER_TARGET;
+  jitter_buffer_clear(jb);
+
+  *jitter_buffer = jb;
+
+  return 0;
+}
+
+void jitter_buffer_free(JitterBuffer **jitter_buffer)
+{
+  JitterBuffer *jb = *jitter_buffer;
+  if (jb == NULL) return;
+  jitter_buffer_clear(jb);
+  av_freep(&jb->entries);
+  free(jb);
+  *jitter_buffer = NULL;
+}
+
+void jitter_buffer_clear(JitterBuffer *jitter_buffer)
+{
+  JitterBuffer *jb = jitter_buffer;
+
+  for (int i = 0; i < jb->length; i++)
+  {
+    av_packet_free(&jb->entries[i].pkt);
+  }
+  jb->length = 0;
+  jb->delay = jb->target;
+  jb->offset = 0;
+  jb->last_dts = AV_NOPTS_VALUE;
+  jb->last_duration = 0;
+  jb->base_transit = AV_NOPTS_VALUE;
+  jb->window_start = AV_NOPTS_VALUE;
+  jb->window_peak = 0;
+  jb->window_low = INT64_MAX;
+}
+
+// at the end of every window the delay comes down halfway to what the window needed,
+// and the baseline follows the least lateness so clock drift does not add up
+static void jitter_buffer_adapt(JitterBuffer *jb, int64_t now)
+{
+  int64_t needed = jb->window_peak + JITTER_MARGIN;
+
+  if (jb->window_start == AV_NOPTS_VALUE) jb->window_start = now;
+  if (now - jb->window_start < JITTER_WINDOW) return;
+
+  if (needed < jb->delay) jb->delay = (jb->delay + needed) / 2;
+  if (jb->window_low != INT64_MAX) jb->base_transit += jb->window_low;
+  jb->window_start = now;
+  jb->window_peak = 0;
+  jb->window_low = INT64_MAX;
+}
+
+// rebase pkt when its dts jumps, note how late it is and return its dts in microseconds
+static int64_t jitter_buffer_track(JitterBuffer *jb, AVPacket *pkt, AVRational time_base, int64_t now)
+{
+  int64_t dts = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts;
+  int64_t transit, lateness, offset;
+
+  // nothing to place it by, it goes out right after the packet before
+  if (dts == AV_NOPTS_VALUE) return jb->last_dts;
+
+  dts = av_rescale_q(dts, time_base, AV_TIME_BASE_Q) + jb->offset;
+  if (jb->last_dts != AV_NOPTS_VALUE && FFABS(dts - jb->last_dts) > JITTER_DISCONTINUITY)
+  {
+    jb->offset += jb->last_dts + jb->last_duration - dts;
+    dts = jb->last_dts + jb->last_duration;
+    jb->discontinuities++;
+  }
+  else if (jb->last_dts != AV_NOPTS_VALUE && dts < jb->last_dts)
+  {
+    jb->reordered++;
+  }
+  if (jb->offset)
+  {
+    offset = av_rescale_q(jb->offset, AV_TIME_BASE_Q, time_base);
+    if (pkt->pts != AV_NOPTS_VALUE) pkt->pts += offset;
+    if (pkt->dts != AV_NOPTS_VALUE) pkt->dts += offset;
+  }
+  if (jb->last_dts == AV_NOPTS_VALUE || dts >= jb->last_dts)
+  {
+    jb->last_dts = dts;
+    jb->last_duration = av_rescale_q(pkt->duration, time_base, AV_TIME_BASE_Q);
+  }
+
+  transit = now - dts;
+  if (jb->base_transit == AV_NOPTS_VALUE || transit < jb->base_transit)
+  {
+    // earlier than any packet so far, later ones are measured against it
+    if (jb->base_transit != AV_NOPTS_VALUE && jb->window_low != INT64_MAX)
+    {
+      jb->window_peak += jb->base_transit - transit;
+      jb->window_low += jb->base_transit - transit;
+    }
+    jb->base_transit = transit;
+  }
+  lateness = transit - jb->base_transit;
+  jb->window_peak = FFMAX(jb->window_peak, lateness);
+  jb->window_low = FFMIN(jb->window_low, lateness);
+  if (lateness > jb->delay)
+  {
+    jb->late++;
+    jb->delay = FFMIN(jb->target, lateness + JITTER_MARGIN);
+  }
+  jitter_buffer_adapt(jb, now);
+  return dts;
+}
+
+int jitter_buffer_put(JitterBuffer *jitter_buffer, AVPacket *pkt, AVRational time_base, int64_t now)
+{
+  int i;
+  int64_t dts;
+  AVPacket *held;
+  JitterBuffer *jb = jitter_buffer;
+
+  if (jb->length == jb->capacity)
+  {
+    int capacity = FFMAX(jb->capacity * 2, 256);
+    JitterEntry *entries = av_realloc_array(jb->entries, capacity, sizeof(JitterEntry));
+    if (!entries) return AVERROR(ENOMEM);
+    jb->entries = entries;
+    jb->capacity = capacity;
+  }
+  if (!(held = av_packet_alloc()))
+  {
+    return AVERROR(ENOMEM);
+  }
+  dts = jitter_buffer_track(jb, pkt, time_base, now);
+  av_packet_move_ref(held, pkt);
+
+  // mostly in order already, so the place is found from the end. equal dts keep their order
+  for (i = jb->length; i > 0 && dts != AV_NOPTS_VALUE && jb->entries[i - 1].dts != AV_NOPTS_VALUE && jb->entries[i - 1].dts > dts; i--);
+  memmove(&jb->entries[i + 1], &jb->entries[i], (jb->length - i) * sizeof(JitterEntry));
+  jb->entries[i].pkt = held;
+  jb->entries[i].dts = dts;
+  jb->length++;
+  return 0;
+}
+
+// hand out the earliest packet
+static int jitter_buffer_pop(JitterBuffer *jb, AVPacket *pkt)
+{
+  if (!jb->length) return 0;
+  av_packet_move_ref(pkt, jb->entries[0].pkt);
+  av_packet_free(&jb->entries[0].pkt);
+  jb->length--;
+  memmove(&jb->entries[0], &jb->entries[1], jb->length * sizeof(JitterEntry));
+  return 1;
+}
+
+int jitter_buffer_get(JitterBuffer *jitter_buffer, AVPacket *pkt, int64_t now, int64_t *wait)
+{
+  int64_t due;
+  JitterBuffer *jb = jitter_buffer;
+
+  *wait = -1;
+  if (!jb->length) return 0;
+  if (jb->entries[0].dts != AV_NOPTS_VALUE && jb->base_transit != AV_NOPTS_VALUE)
+  {
+    due = jb->base_transit + jb->entries[0].dts + jb->delay;
+    if (now < due)
+    {
+      *wait = due - now;
+      return 0;
+    }
+  }
+  return jitter_buffer_pop(jb, pkt);
+}
+
+int jitter_buffer_flush(JitterBuffer *jitter_buffer, AVPacket *pkt)
+{
+  return jitter_buffer_pop(jitter_buffer, pkt);
+}
@@ -0,0 +1,72 @@
+#ifndef JITTER_BUFFER_H
+#define JITTER_BUFFER_H
+
+#include <stdint.h>
+
+#include <libavcodec/avcodec.h>
+
+// delay a jitter buffer starts with and may grow back to unless configured otherwise
+#define JITTER_TARGET (500 * 1000)
+// kept on top of the lateness measured when the delay adapts
+#define JITTER_MARGIN (20 * 1000)
+// how long the delay must be more than needed before it shrinks
+#define JITTER_WINDOW (2 * 1000000)
+// a dts jump of more than this, either way, is a discontinuity rather than reordering
+#define JITTER_DISCONTINUITY (10 * 1000000LL)
+
+// a packet waiting for its time, dts in microseconds after rebasing
+typedef struct JitterEntry
+{
+  AVPacket *pkt;
+  int64_t dts;
+} JitterEntry;
+
+// holds the demuxed packets of a live input for a delay after their timestamps and hands
+// them out in dts order, so bursts and reordering in the network never reach the
+// decoders. a packet is due delay after the earliest it could have arrived, judged by
+// the smallest arrival time minus dts seen. the delay starts at the target, grows back
+// up to it whenever a packet arrives later than that and shrinks towards the lateness
+// actually seen after every window without such a packet. timestamps that jump by more
+// than JITTER_DISCONTINUITY, as on an encoder restart, are rebased to go on from the
+// previous packet.
+typedef struct JitterBuffer
+{
+  // sorted by dts
+  JitterEntry *entries;
+  int length;
+  int capacity;
+  int64_t target;
+  int64_t delay;
+  // added to every timestamp since the last discontinuity, in microseconds
+  int64_t offset;
+  // highest dts put so far and its duration
+  int64_t last_dts;
+  int64_t last_duration;
+  // smallest arrival time minus dts, AV_NOPTS_VALUE before the first packet
+  int64_t base_transit;
+  // largest and smallest lateness over the current window
+  int64_t window_start;
+  int64_t window_peak;
+  int64_t window_low;
+  long reordered;
+  long discontinuities;
+  long late;
+} JitterBuffer;
+
+int jitter_buffer_create(JitterBuffer **jitter_buffer, int64_t target);
+
+void jitter_buffer_free(JitterBuffer **jitter_buffer);
+
+// drop every packet and start over, the stats are kept
+void jitter_buffer_clear(JitterBuffer *jitter_buffer);
+
+// take over pkt, in time_base, which arrived at now (av_gettime_relative)
+int jitter_buffer_put(JitterBuffer *jitter_buffer, AVPacket *pkt, AVRational time_base, int64_t now);
+
+// 1 when pkt holds the earliest packet and it is due at now, 0 otherwise with *wait set
+// to the microseconds until it is, -1 when empty
+int jitter_buffer_get(JitterBuffer *jitter_buffer, AVPacket *pkt, int64_t now, int64_t *wait);
+
+// the earliest packet whether due or not, for the end of the input. 0 when empty
+int jitter_buffer_flush(JitterBuffer *jitter_buffer, AVPacket *pkt);
+#endif
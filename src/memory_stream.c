@@ -37,6 +37,15 @@ void memory_stream_free(MemoryStream **memory_stream)
   free(*memory_stream);
 }
 
+void memory_stream_reset(MemoryStream *const memory_stream, int is_stream)
+{
+  memory_stream->is_stream = is_stream;
+  memory_stream->recycle_length = 0;
+  memory_stream->length = 0;
+  memory_stream->position = 0;
+  memory_stream->is_done = 0;
+}
+
 size_t memory_stream_get_free(MemoryStream *const memory_stream)
 {
   return memory_stream->capacity - memory_stream->length;
@@ -121,6 +130,20 @@ size_t memory_stream_write(MemoryStream *const memory_stream, const uint8_t *buf
   return buf_size;
 }
 
+// overwrite from the read position on, growing the stream when needed. lets muxers seek back and patch headers
+size_t memory_stream_write_at_position(MemoryStream *const memory_stream, const uint8_t *buf, size_t buf_size)
+{
+  size_t end = memory_stream->position + buf_size;
+  if (end > memory_stream->capacity)
+  {
+    memory_stream_resize(memory_stream, end - memory_stream->length);
+  }
+  memcpy(memory_stream->data + memory_stream->position, buf, buf_size);
+  memory_stream->position = end;
+  memory_stream->length = V_MAX(memory_stream->length, end);
+  return buf_size;
+}
+
 size_t memory_stream_write_callback(MemoryStream *memory_stream, void *opaque, size_t buf_size, MemoryStreamWriteCallback callback)
 {
   uint8_t *dest = memory_stream_ensure_write(memory_stream, buf_size);
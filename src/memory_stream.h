@@ -28,6 +28,8 @@ int memory_stream_create(MemoryStream **memory_stream, size_t capacity, int is_s
 
 void memory_stream_free(MemoryStream **memory_stream);
 
+void memory_stream_reset(MemoryStream *memory_stream, int is_stream);
+
 size_t memory_stream_get_free(MemoryStream *memory_stream);
 
 size_t memory_stream_get_available(MemoryStream *memory_stream);
@@ -50,6 +52,8 @@ void memory_stream_did_write(MemoryStream *memory_stream, size_t write_length);
 
 size_t memory_stream_write(MemoryStream *memory_stream, const uint8_t *buf, size_t buf_size);
 
+size_t memory_stream_write_at_position(MemoryStream *memory_stream, const uint8_t *buf, size_t buf_size);
+
 size_t memory_stream_write_callback(MemoryStream *memory_stream, void *opaque, size_t buf_size, MemoryStreamWriteCallback callback);
 
 long memory_stream_seek(MemoryStream *memory_stream, long offset, int whence);
@@ -0,0 +1,76 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <libavutil/avutil.h>
+#include <libavcodec/avcodec.h>
+
+#include "packet_batch.h"
+
+int packet_batch_create(PacketBatch **packet_batch, int capacity)
+{
+  PacketBatch *batch;
+
+  if (!(batch = calloc(1, sizeof(PacketBatch))))
+  {
+    return AVERROR(ENOMEM);
+  }
+  batch->capacity = capacity > 0 ? capacity : PACKET_BATCH_COUNT;
+  if (!(batch->records = calloc(batch->capacity, sizeof(PacketRecord))) ||
+      memory_stream_create(&batch->payload, PACKET_BATCH_BYTES, 0) != 0)
+  {
+    packet_batch_free(&batch);
+    return AVERROR(ENOMEM);
+  }
+
+  *packet_batch = batch;
+
+  return 0;
+}
+
+void packet_batch_free(PacketBatch **packet_batch)
+{
+  PacketBatch *batch = *packet_batch;
+  if (batch == NULL) return;
+  free(batch->records);
+  memory_stream_free(&batch->payload);
+  free(batch);
+  *packet_batch = NULL;
+}
+
+void packet_batch_reset(PacketBatch *packet_batch)
+{
+  packet_batch->count = 0;
+  memory_stream_reset(packet_batch->payload, 0);
+}
+
+static int64_t to_microseconds(int64_t ts, AVRational time_base)
+{
+  return ts == AV_NOPTS_VALUE ? INT64_MIN : av_rescale_q(ts, time_base, AV_TIME_BASE_Q);
+}
+
+int packet_batch_add(PacketBatch *packet_batch, const AVPacket *pkt, AVRational time_base)
+{
+  PacketRecord *record;
+
+  if (packet_batch->count >= packet_batch->capacity)
+  {
+    return AVERROR(ENOSPC);
+  }
+
+  record = &packet_batch->records[packet_batch->count++];
+  record->stream_index = pkt->stream_index;
+  record->flags = (pkt->flags & AV_PKT_FLAG_KEY) ? PACKET_RECORD_FLAG_KEY : 0;
+  record->pts = to_microseconds(pkt->pts, time_base);
+  record->dts = to_microseconds(pkt->dts, time_base);
+  record->duration = pkt->duration > 0 ? av_rescale_q(pkt->duration, time_base, AV_TIME_BASE_Q) : 0;
+  record->offset = packet_batch->payload->length;
+  record->size = pkt->size;
+  memory_stream_write(packet_batch->payload, pkt->data, pkt->size);
+
+  return 0;
+}
+
+int packet_batch_is_full(PacketBatch *packet_batch)
+{
+  return packet_batch->count >= packet_batch->capacity || packet_batch->payload->length >= PACKET_BATCH_BYTES;
+}
@@ -0,0 +1,51 @@
+#ifndef PACKET_BATCH_H
+#define PACKET_BATCH_H
+
+#include <stdint.h>
+
+#include <libavcodec/avcodec.h>
+
+#include "memory_stream.h"
+
+// packets handed over per batch unless configured otherwise
+#define PACKET_BATCH_COUNT 8
+// a batch is also handed over once its payload grows past this
+#define PACKET_BATCH_BYTES (MEMORY_PAGE * 4)
+
+#define PACKET_RECORD_FLAG_KEY 1
+
+// one compressed packet of a batch. plain fixed size fields so the records can be
+// read straight from the wasm heap or written to a pipe for another process.
+// timestamps are microseconds, INT64_MIN when unknown.
+typedef struct PacketRecord
+{
+  int32_t stream_index;
+  int32_t flags;
+  int64_t pts;
+  int64_t dts;
+  int64_t duration;
+  // offset of the payload from the start of the batch payload
+  int32_t offset;
+  int32_t size;
+} PacketRecord;
+
+typedef struct PacketBatch
+{
+  PacketRecord *records;
+  int count;
+  int capacity;
+  MemoryStream *payload;
+} PacketBatch;
+
+int packet_batch_create(PacketBatch **packet_batch, int capacity);
+
+void packet_batch_free(PacketBatch **packet_batch);
+
+void packet_batch_reset(PacketBatch *packet_batch);
+
+// copy the payload of pkt into the batch, time_base is the one of its stream
+int packet_batch_add(PacketBatch *packet_batch, const AVPacket *pkt, AVRational time_base);
+
+// the batch holds its packet count or the payload limit
+int packet_batch_is_full(PacketBatch *packet_batch);
+#endif
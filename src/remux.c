@@ -0,0 +1,191 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <libavutil/avutil.h>
+#include <libavutil/dict.h>
+#include <libavformat/avio.h>
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+
+#include "remux.h"
+
+#define REMUX_IO_BUFFER_SIZE (MEMORY_PAGE)
+#define REMUX_SEGMENT_SIZE (MEMORY_PAGE * 4)
+
+// audio only inputs have a keyframe per packet, cut fragments by duration instead
+#define REMUX_AUDIO_FRAGMENT_DURATION "1000000"
+
+static int write_segment(void *opaque, uint8_t *buffer, int buffer_size)
+{
+  Remuxer *remuxer = opaque;
+  memory_stream_write(remuxer->segment, buffer, buffer_size);
+  return buffer_size;
+}
+
+// hand over whatever the muxer completed. the fragmented mov muxer keeps a
+// fragment in its own buffer until it is done, so each delivery is whole boxes.
+static void deliver_segment(Remuxer *remuxer, int is_init)
+{
+  avio_flush(remuxer->io_ctx);
+  if (remuxer->segment->length == 0) return;
+  (*remuxer->on_segment)(remuxer->opaque, remuxer->segment->data, remuxer->segment->length, is_init);
+  memory_stream_reset(remuxer->segment, 0);
+}
+
+int remuxer_create(Remuxer **remuxer, AVStream **streams, int nb_streams, int nb_input_streams, RemuxSegmentCallback on_segment, void *opaque)
+{
+  int ret;
+  int has_video = 0;
+  uint8_t *io_buffer;
+  AVDictionary *options = NULL;
+  Remuxer *r;
+
+  if (!(r = calloc(1, sizeof(Remuxer))))
+  {
+    return AVERROR(ENOMEM);
+  }
+  r->on_segment = on_segment;
+  r->opaque = opaque;
+  r->nb_input_streams = nb_input_streams;
+
+  if (memory_stream_create(&r->segment, REMUX_SEGMENT_SIZE, 0) != 0 ||
+      !(r->pkt = av_packet_alloc()) ||
+      !(r->stream_map = malloc(nb_input_streams * sizeof(int))) ||
+      !(r->input_time_base = calloc(nb_input_streams, sizeof(AVRational))))
+  {
+    ret = AVERROR(ENOMEM);
+    goto fail;
+  }
+  for (int i = 0; i < nb_input_streams; i++) r->stream_map[i] = -1;
+
+  if (!(io_buffer = av_malloc(REMUX_IO_BUFFER_SIZE)))
+  {
+    ret = AVERROR(ENOMEM);
+    goto fail;
+  }
+  if (!(r->io_ctx = avio_alloc_context(io_buffer, REMUX_IO_BUFFER_SIZE, 1, r, NULL, &write_segment, NULL)))
+  {
+    av_free(io_buffer);
+    ret = AVERROR(ENOMEM);
+    goto fail;
+  }
+
+  if ((ret = avformat_alloc_output_context2(&r->ofmt_ctx, NULL, "mp4", NULL)) < 0)
+  {
+    fprintf(stderr, "Could not create mp4 muxer\n");
+    goto fail;
+  }
+  r->ofmt_ctx->pb = r->io_ctx;
+
+  for (int i = 0; i < nb_streams; i++)
+  {
+    AVStream *in = streams[i];
+    AVStream *out;
+    if (!in) continue;
+
+    if (!(out = avformat_new_stream(r->ofmt_ctx, NULL)))
+    {
+      ret = AVERROR(ENOMEM);
+      goto fail;
+    }
+    if ((ret = avcodec_parameters_copy(out->codecpar, in->codecpar)) < 0)
+    {
+      goto fail;
+    }
+    // let the muxer pick the tag, flv and ts tags mean nothing to mp4
+    out->codecpar->codec_tag = 0;
+    out->time_base = in->time_base;
+    r->stream_map[in->index] = out->index;
+    r->input_time_base[in->index] = in->time_base;
+    if (in->codecpar->codec_type == AVMEDIA_TYPE_VIDEO) has_video = 1;
+  }
+
+  if (has_video)
+  {
+    av_dict_set(&options, "movflags", "frag_keyframe+empty_moov+default_base_moof+skip_trailer", 0);
+  }
+  else
+  {
+    av_dict_set(&options, "movflags", "empty_moov+default_base_moof+skip_trailer", 0);
+    av_dict_set(&options, "frag_duration", REMUX_AUDIO_FRAGMENT_DURATION, 0);
+  }
+  ret = avformat_write_header(r->ofmt_ctx, &options);
+  av_dict_free(&options);
+  if (ret < 0)
+  {
+    fprintf(stderr, "Could not write mp4 header (%s)\n", av_err2str(ret));
+    goto fail;
+  }
+
+  // with empty_moov the header is the complete init segment
+  deliver_segment(r, 1);
+
+  *remuxer = r;
+  return 0;
+
+fail:
+  remuxer_free(&r);
+  return ret;
+}
+
+void remuxer_free(Remuxer **remuxer)
+{
+  Remuxer *r = *remuxer;
+  if (r == NULL) return;
+  if (r->ofmt_ctx) avformat_free_context(r->ofmt_ctx);
+  if (r->io_ctx)
+  {
+    av_freep(&r->io_ctx->buffer);
+    avio_context_free(&r->io_ctx);
+  }
+  av_packet_free(&r->pkt);
+  memory_stream_free(&r->segment);
+  free(r->stream_map);
+  free(r->input_time_base);
+  free(r);
+  *remuxer = NULL;
+}
+
+int remuxer_write(Remuxer *remuxer, const AVPacket *pkt)
+{
+  int ret;
+  AVStream *out;
+
+  if (pkt->stream_index < 0 || pkt->stream_index >= remuxer->nb_input_streams || remuxer->stream_map[pkt->stream_index] < 0)
+  {
+    return 0;
+  }
+  out = remuxer->ofmt_ctx->streams[remuxer->stream_map[pkt->stream_index]];
+
+  // a new reference, the input packet stays untouched for the caller
+  if ((ret = av_packet_ref(remuxer->pkt, pkt)) < 0)
+  {
+    return ret;
+  }
+  remuxer->pkt->stream_index = out->index;
+  remuxer->pkt->pos = -1;
+  av_packet_rescale_ts(remuxer->pkt, remuxer->input_time_base[pkt->stream_index], out->time_base);
+
+  // packets come interleaved from the demuxer, skip the muxer side queue
+  ret = av_write_frame(remuxer->ofmt_ctx, remuxer->pkt);
+  av_packet_unref(remuxer->pkt);
+  if (ret < 0)
+  {
+    fprintf(stderr, "Error muxing packet (%s)\n", av_err2str(ret));
+    return ret;
+  }
+
+  deliver_segment(remuxer, 0);
+  return 0;
+}
+
+int remuxer_finish(Remuxer *remuxer)
+{
+  int ret;
+  if ((ret = av_write_trailer(remuxer->ofmt_ctx)) < 0)
+  {
+    return ret;
+  }
+  deliver_segment(remuxer, 0);
+  return 0;
+}
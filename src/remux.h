@@ -0,0 +1,36 @@
+#ifndef REMUX_H
+#define REMUX_H
+
+#include <libavformat/avformat.h>
+
+#include "memory_stream.h"
+
+// called with the init segment (ftyp + moov) once, then with every media segment (moof + mdat)
+typedef void (*RemuxSegmentCallback)(void *opaque, uint8_t *ptr, size_t size, int is_init);
+
+typedef struct Remuxer
+{
+  AVFormatContext *ofmt_ctx;
+  AVIOContext *io_ctx;
+  // bytes the muxer wrote since the last delivered segment
+  MemoryStream *segment;
+  AVPacket *pkt;
+  // input stream index -> output stream index, -1 when not remuxed
+  int *stream_map;
+  int nb_input_streams;
+  AVRational *input_time_base;
+  RemuxSegmentCallback on_segment;
+  void *opaque;
+} Remuxer;
+
+// remux streams (NULL entries are skipped) of an input with nb_input_streams streams into fragmented mp4
+int remuxer_create(Remuxer **remuxer, AVStream **streams, int nb_streams, int nb_input_streams, RemuxSegmentCallback on_segment, void *opaque);
+
+void remuxer_free(Remuxer **remuxer);
+
+// write an input packet, packets of streams not remuxed are ignored
+int remuxer_write(Remuxer *remuxer, const AVPacket *pkt);
+
+// flush the last fragment
+int remuxer_finish(Remuxer *remuxer);
+#endif
@@ -0,0 +1,114 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <libavutil/avutil.h>
+#include <libswscale/swscale.h>
+
+#include "rendition_ladder.h"
+
+int rendition_ladder_create(RenditionLadder **rendition_ladder)
+{
+  RenditionLadder *ladder;
+
+  if (!(ladder = calloc(1, sizeof(RenditionLadder))))
+  {
+    return AVERROR(ENOMEM);
+  }
+
+  *rendition_ladder = ladder;
+
+  return 0;
+}
+
+void rendition_ladder_free(RenditionLadder **rendition_ladder)
+{
+  RenditionLadder *ladder = *rendition_ladder;
+  if (ladder == NULL) return;
+
+  for (int i = 0; i < ladder->nb_renditions; i++)
+  {
+    Rendition *r = &ladder->renditions[i];
+    sws_freeContext(r->sws);
+    image_pool_free(&r->images);
+  }
+  free(ladder);
+  *rendition_ladder = NULL;
+}
+
+int rendition_ladder_add(RenditionLadder *rendition_ladder, int width, int height, int format)
+{
+  int ret;
+  Rendition *r;
+
+  if (rendition_ladder->started) return AVERROR(EBUSY);
+  if (rendition_ladder->nb_renditions >= LADDER_MAX_RENDITIONS) return AVERROR(ENOSPC);
+
+  r = &rendition_ladder->renditions[rendition_ladder->nb_renditions];
+  if ((ret = image_pool_create(&r->images)) < 0)
+  {
+    return ret;
+  }
+  r->width = width;
+  r->height = height;
+  r->format = format;
+
+  return rendition_ladder->nb_renditions++;
+}
+
+static int scale_rendition(Rendition *r, const AVFrame *frame)
+{
+  int ret;
+  int width = r->width;
+  int height = r->height;
+
+  if (width <= 0 && height <= 0)
+  {
+    width = frame->width;
+    height = frame->height;
+  }
+  else if (width <= 0)
+  {
+    width = image_follow_aspect(height, frame->width, frame->height);
+  }
+  else if (height <= 0)
+  {
+    height = image_follow_aspect(width, frame->height, frame->width);
+  }
+
+  if ((ret = image_pool_get(r->images, &r->image, width, height, r->format)) < 0)
+  {
+    return ret;
+  }
+  if (!(r->sws = sws_getCachedContext(r->sws, frame->width, frame->height, frame->format,
+                                      width, height, r->format, SWS_BILINEAR, NULL, NULL, NULL)))
+  {
+    fprintf(stderr, "Could not create scale context for %dx%d!\n", width, height);
+    return AVERROR(EINVAL);
+  }
+  sws_scale(r->sws, (const uint8_t * const *)frame->data, frame->linesize, 0, frame->height,
+            r->image->data, r->image->line_size);
+  return 0;
+}
+
+static void scale_job(void *arg, int index)
+{
+  RenditionLadder *ladder = arg;
+  Rendition *r = &ladder->renditions[index];
+  r->ret = scale_rendition(r, ladder->frame);
+}
+
+int rendition_ladder_scale(RenditionLadder *rendition_ladder, const AVFrame *frame, ThreadPool *pool, int priority)
+{
+  int ret = 0;
+
+  rendition_ladder->started = 1;
+  rendition_ladder->frame = frame;
+  thread_pool_run(pool, &scale_job, rendition_ladder, rendition_ladder->nb_renditions, priority);
+  rendition_ladder->frame = NULL;
+
+  for (int i = 0; i < rendition_ladder->nb_renditions && ret == 0; i++)
+  {
+    ret = rendition_ladder->renditions[i].ret;
+  }
+  return ret;
+}
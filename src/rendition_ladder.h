@@ -0,0 +1,46 @@
+#ifndef RENDITION_LADDER_H
+#define RENDITION_LADDER_H
+
+#include <libavutil/frame.h>
+
+#include "image_pool.h"
+#include "thread_pool.h"
+
+// renditions one decoded frame can be scaled to
+#define LADDER_MAX_RENDITIONS 8
+
+struct SwsContext;
+
+typedef struct Rendition
+{
+  // requested geometry, a side <= 0 follows the aspect ratio of the source
+  int width;
+  int height;
+  int format;
+  struct SwsContext *sws;
+  ImagePool *images;
+  // result of the last rendition_ladder_scale
+  ImageBuffer *image;
+  int ret;
+} Rendition;
+
+// scales each frame to every rendition at once, one thread pool job per rendition
+typedef struct RenditionLadder
+{
+  Rendition renditions[LADDER_MAX_RENDITIONS];
+  int nb_renditions;
+  int started;
+  // frame being scaled
+  const AVFrame *frame;
+} RenditionLadder;
+
+int rendition_ladder_create(RenditionLadder **rendition_ladder);
+
+void rendition_ladder_free(RenditionLadder **rendition_ladder);
+
+// returns the rendition index, renditions can only be added before the first scale
+int rendition_ladder_add(RenditionLadder *rendition_ladder, int width, int height, int format);
+
+// scale frame to all renditions on pool, returns once every rendition holds its image
+int rendition_ladder_scale(RenditionLadder *rendition_ladder, const AVFrame *frame, ThreadPool *pool, int priority);
+#endif
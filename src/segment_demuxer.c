@@ -0,0 +1,507 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <libavutil/avutil.h>
+#include <libavformat/avformat.h>
+#include <libavformat/avio.h>
+#include <libavcodec/avcodec.h>
+
+#include "segment_demuxer.h"
+
+#define SEGMENT_IO_SIZE (64 * 1024)
+
+int segment_demuxer_create(SegmentDemuxer **segment_demuxer, ThreadPool *pool)
+{
+  SegmentDemuxer *sd;
+
+  if (!(sd = calloc(1, sizeof(SegmentDemuxer))))
+  {
+    return AVERROR(ENOMEM);
+  }
+  sd->pool = pool;
+  pthread_mutex_init(&sd->mutex, NULL);
+  pthread_cond_init(&sd->cond, NULL);
+  segment_demuxer_reset(sd, -1, SEGMENT_AHEAD, THREAD_POOL_PRIORITY_NORMAL);
+
+  *segment_demuxer = sd;
+
+  return 0;
+}
+
+static void demux_ahead(SegmentDemuxer *sd);
+
+static void close_format(AVFormatContext **fmt_ctx)
+{
+  AVIOContext *io_ctx;
+  if (!*fmt_ctx) return;
+  io_ctx = (*fmt_ctx)->pb;
+  avformat_close_input(fmt_ctx);
+  if (io_ctx)
+  {
+    av_freep(&io_ctx->buffer);
+    avio_context_free(&io_ctx);
+  }
+}
+
+static void free_packets(Segment *seg)
+{
+  for (int i = 0; i < seg->nb_packets; i++)
+  {
+    av_packet_free(&seg->packets[i]);
+  }
+  av_freep(&seg->packets);
+  seg->nb_packets = seg->capacity = seg->next = 0;
+}
+
+static void segment_free(Segment **segment)
+{
+  Segment *seg = *segment;
+  if (seg == NULL) return;
+  // the pool may still be done with its job
+  if (seg->queued) thread_pool_wait(seg->demuxer->pool, &seg->group);
+  free_packets(seg);
+  close_format(&seg->fmt_ctx);
+  av_buffer_unref(&seg->init);
+  av_buffer_unref(&seg->data);
+  free(seg);
+  *segment = NULL;
+}
+
+void segment_demuxer_free(SegmentDemuxer **segment_demuxer)
+{
+  SegmentDemuxer *sd = *segment_demuxer;
+  if (sd == NULL) return;
+  segment_demuxer_reset(sd, -1, SEGMENT_AHEAD, THREAD_POOL_PRIORITY_NORMAL);
+  pthread_mutex_destroy(&sd->mutex);
+  pthread_cond_destroy(&sd->cond);
+  free(sd);
+  *segment_demuxer = NULL;
+}
+
+// caller holds the mutex
+static void reset_locked(SegmentDemuxer *sd, int first_sequence, int ahead, int priority)
+{
+  Segment *seg;
+
+  while (sd->demuxing)
+  {
+    pthread_cond_wait(&sd->cond, &sd->mutex);
+  }
+  while ((seg = sd->segments))
+  {
+    sd->segments = seg->next_segment;
+    segment_free(&seg);
+  }
+  av_buffer_unref(&sd->init);
+  close_format(&sd->template);
+  sd->opened = 0;
+  sd->next_sequence = first_sequence;
+  sd->ahead = av_clip(ahead, 1, SEGMENT_MAX_AHEAD);
+  sd->priority = priority;
+  sd->offset = 0;
+  sd->end = AV_NOPTS_VALUE;
+  sd->is_done = 0;
+  // a reader waiting for the start looks again
+  pthread_cond_broadcast(&sd->cond);
+}
+
+void segment_demuxer_reset(SegmentDemuxer *segment_demuxer, int first_sequence, int ahead, int priority)
+{
+  pthread_mutex_lock(&segment_demuxer->mutex);
+  reset_locked(segment_demuxer, first_sequence, ahead, priority);
+  pthread_mutex_unlock(&segment_demuxer->mutex);
+}
+
+int segment_demuxer_start(SegmentDemuxer *segment_demuxer, int first_sequence, int ahead, int priority)
+{
+  int ret = 0;
+
+  pthread_mutex_lock(&segment_demuxer->mutex);
+  if (segment_demuxer->opened) ret = AVERROR(EBUSY);
+  else reset_locked(segment_demuxer, first_sequence, ahead, priority);
+  pthread_mutex_unlock(&segment_demuxer->mutex);
+  return ret;
+}
+
+int segment_demuxer_add(SegmentDemuxer *segment_demuxer, int sequence, int flags, int64_t duration, AVBufferRef *data)
+{
+  Segment *seg;
+  Segment **p;
+  SegmentDemuxer *sd = segment_demuxer;
+
+  if (flags & SEGMENT_INIT)
+  {
+    pthread_mutex_lock(&sd->mutex);
+    av_buffer_unref(&sd->init);
+    sd->init = data;
+    pthread_mutex_unlock(&sd->mutex);
+    return 0;
+  }
+  if (!(seg = calloc(1, sizeof(Segment))))
+  {
+    av_buffer_unref(&data);
+    return AVERROR(ENOMEM);
+  }
+  seg->sequence = sequence;
+  seg->flags = flags;
+  seg->duration = duration;
+  seg->data = data;
+  seg->start = AV_NOPTS_VALUE;
+  seg->end = AV_NOPTS_VALUE;
+
+  pthread_mutex_lock(&sd->mutex);
+  if (sd->init && !(seg->init = av_buffer_ref(sd->init)))
+  {
+    pthread_mutex_unlock(&sd->mutex);
+    segment_free(&seg);
+    return AVERROR(ENOMEM);
+  }
+  for (p = &sd->segments; *p && (*p)->sequence < sequence; p = &(*p)->next_segment);
+  if (*p && (*p)->sequence == sequence)
+  {
+    // downloaded twice, the first copy is kept
+    pthread_mutex_unlock(&sd->mutex);
+    segment_free(&seg);
+    return 0;
+  }
+  seg->next_segment = *p;
+  *p = seg;
+  seg->demuxer = sd;
+  demux_ahead(sd);
+  pthread_cond_broadcast(&sd->cond);
+  pthread_mutex_unlock(&sd->mutex);
+  return 0;
+}
+
+void segment_demuxer_done(SegmentDemuxer *segment_demuxer)
+{
+  pthread_mutex_lock(&segment_demuxer->mutex);
+  segment_demuxer->is_done = 1;
+  pthread_cond_broadcast(&segment_demuxer->cond);
+  pthread_mutex_unlock(&segment_demuxer->mutex);
+}
+
+void segment_demuxer_wake(SegmentDemuxer *segment_demuxer)
+{
+  pthread_mutex_lock(&segment_demuxer->mutex);
+  pthread_cond_broadcast(&segment_demuxer->cond);
+  pthread_mutex_unlock(&segment_demuxer->mutex);
+}
+
+/*************************************************/
+/*** demux section *******************************/
+/*************************************************/
+static int64_t segment_size(Segment *seg)
+{
+  return (seg->init ? (int64_t)seg->init->size : 0) + (int64_t)seg->data->size;
+}
+
+// the init section followed by the segment, as one file
+static int read_segment(void *opaque, uint8_t *buffer, int buffer_size)
+{
+  Segment *seg = opaque;
+  int64_t init_size = seg->init ? (int64_t)seg->init->size : 0;
+  int n = 0;
+
+  while (n < buffer_size && seg->position < segment_size(seg))
+  {
+    int64_t pos = seg->position;
+    const uint8_t *src = pos < init_size ? seg->init->data + pos : seg->data->data + (pos - init_size);
+    int64_t left = pos < init_size ? init_size - pos : segment_size(seg) - pos;
+    int size = (int)FFMIN(left, buffer_size - n);
+    memcpy(buffer + n, src, size);
+    seg->position += size;
+    n += size;
+  }
+  return n ? n : AVERROR_EOF;
+}
+
+static int64_t seek_segment(void *opaque, int64_t offset, int whence)
+{
+  Segment *seg = opaque;
+  int64_t size = segment_size(seg);
+
+  switch (whence & ~AVSEEK_FORCE)
+  {
+    case AVSEEK_SIZE: return size;
+    case SEEK_SET: break;
+    case SEEK_CUR: offset += seg->position; break;
+    case SEEK_END: offset += size; break;
+    default: return AVERROR(EINVAL);
+  }
+  if (offset < 0 || offset > size) return AVERROR(EINVAL);
+  seg->position = offset;
+  return offset;
+}
+
+static int keep_packet(Segment *seg, AVPacket *pkt, AVRational time_base)
+{
+  int64_t dts;
+
+  if (seg->nb_packets == seg->capacity)
+  {
+    int capacity = FFMAX(seg->capacity * 2, 256);
+    AVPacket **packets = av_realloc_array(seg->packets, capacity, sizeof(AVPacket *));
+    if (!packets) return AVERROR(ENOMEM);
+    seg->packets = packets;
+    seg->capacity = capacity;
+  }
+  if (!(seg->packets[seg->nb_packets] = av_packet_alloc()))
+  {
+    return AVERROR(ENOMEM);
+  }
+  pkt->time_base = time_base;
+  av_packet_move_ref(seg->packets[seg->nb_packets++], pkt);
+
+  pkt = seg->packets[seg->nb_packets - 1];
+  if ((dts = pkt->dts != AV_NOPTS_VALUE ? pkt->dts : pkt->pts) == AV_NOPTS_VALUE) return 0;
+  dts = av_rescale_q(dts, time_base, AV_TIME_BASE_Q);
+  seg->start = seg->start == AV_NOPTS_VALUE ? dts : FFMIN(seg->start, dts);
+  seg->end = FFMAX(seg->end == AV_NOPTS_VALUE ? dts : seg->end, dts + av_rescale_q(pkt->duration, time_base, AV_TIME_BASE_Q));
+  return 0;
+}
+
+static int demux_segment(Segment *seg)
+{
+  int ret;
+  uint8_t *io_buffer;
+  AVIOContext *io_ctx;
+  AVFormatContext *fmt_ctx;
+  AVPacket *pkt;
+
+  if (!(io_buffer = av_malloc(SEGMENT_IO_SIZE)))
+  {
+    return AVERROR(ENOMEM);
+  }
+  if (!(io_ctx = avio_alloc_context(io_buffer, SEGMENT_IO_SIZE, 0, seg, &read_segment, NULL, &seek_segment)))
+  {
+    av_free(io_buffer);
+    return AVERROR(ENOMEM);
+  }
+  if (!(fmt_ctx = avformat_alloc_context()))
+  {
+    av_freep(&io_ctx->buffer);
+    avio_context_free(&io_ctx);
+    return AVERROR(ENOMEM);
+  }
+  fmt_ctx->pb = io_ctx;
+  seg->fmt_ctx = fmt_ctx;
+  if ((ret = avformat_open_input(&seg->fmt_ctx, NULL, NULL, NULL)) < 0)
+  {
+    // a failed open frees the context but not our io
+    av_freep(&io_ctx->buffer);
+    avio_context_free(&io_ctx);
+    return ret;
+  }
+  // only the streams of the first segment are looked into, the others just give packets
+  if (seg->keep && (ret = avformat_find_stream_info(seg->fmt_ctx, NULL)) < 0)
+  {
+    return ret;
+  }
+  if (!(pkt = av_packet_alloc()))
+  {
+    return AVERROR(ENOMEM);
+  }
+  while ((ret = av_read_frame(seg->fmt_ctx, pkt)) >= 0)
+  {
+    ret = keep_packet(seg, pkt, seg->fmt_ctx->streams[pkt->stream_index]->time_base);
+    av_packet_unref(pkt);
+    if (ret < 0) break;
+  }
+  av_packet_free(&pkt);
+  if (!seg->keep) close_format(&seg->fmt_ctx);
+  return ret == AVERROR_EOF ? 0 : ret;
+}
+
+// caller holds the mutex
+static void finish_demux(SegmentDemuxer *sd, Segment *seg)
+{
+  seg->demuxed = 1;
+  sd->demuxing--;
+  if (seg->keep && seg->ret >= 0 && !sd->template)
+  {
+    sd->template = seg->fmt_ctx;
+    seg->fmt_ctx = NULL;
+  }
+  close_format(&seg->fmt_ctx);
+  pthread_cond_broadcast(&sd->cond);
+}
+
+static void demux_job(void *arg, int index)
+{
+  Segment *seg = arg;
+  SegmentDemuxer *sd = seg->demuxer;
+
+  if ((seg->ret = demux_segment(seg)) < 0)
+  {
+    fprintf(stderr, "Could not demux segment %d (%s)\n", seg->sequence, av_err2str(seg->ret));
+  }
+  // without a pool the job runs right in demux_ahead, under the mutex
+  if (sd->pool) pthread_mutex_lock(&sd->mutex);
+  finish_demux(sd, seg);
+  if (sd->pool) pthread_mutex_unlock(&sd->mutex);
+}
+
+// queue the segment read next and the ones downloaded after it on the pool, so that up
+// to ahead of them are demuxed or being demuxed. the reader only waits for its own one.
+// caller holds the mutex
+static void demux_ahead(SegmentDemuxer *sd)
+{
+  int count = 0;
+
+  for (Segment *seg = sd->segments; seg && count < sd->ahead; seg = seg->next_segment)
+  {
+    if (seg->sequence < sd->next_sequence) continue;
+    count++;
+    if (seg->queued) continue;
+    // only the segment read first looks into the streams
+    seg->keep = !sd->template && seg->sequence == sd->next_sequence;
+    seg->queued = 1;
+    sd->demuxing++;
+    thread_pool_submit(sd->pool, &seg->group, &demux_job, seg, 1, sd->priority);
+  }
+}
+
+// demuxed before it was known to be the first, again keeping its streams. caller holds
+// the mutex
+static void redemux_segment(SegmentDemuxer *sd, Segment *seg)
+{
+  thread_pool_wait(sd->pool, &seg->group);
+  free_packets(seg);
+  seg->position = 0;
+  seg->start = seg->end = AV_NOPTS_VALUE;
+  seg->ret = 0;
+  seg->queued = seg->demuxed = 0;
+  demux_ahead(sd);
+}
+
+/*************************************************/
+/*** splice section ******************************/
+/*************************************************/
+// the demuxed segment read next, waiting for its download. caller holds the mutex
+static int next_segment(SegmentDemuxer *sd, Segment **segment, volatile int *abort)
+{
+  Segment *seg;
+
+  for (;;)
+  {
+    if (*abort) return AVERROR_EXIT;
+    for (seg = sd->segments; seg && seg->sequence < sd->next_sequence; seg = seg->next_segment);
+    // a gap is waited for until the playlist is done, then skipped. so is the start
+    // when it is not known, segments may arrive in any order
+    if (seg && (seg->sequence == sd->next_sequence || sd->is_done))
+    {
+      sd->next_sequence = seg->sequence;
+      if (!sd->template && seg->demuxed && !seg->keep) redemux_segment(sd, seg);
+      if (!seg->demuxed)
+      {
+        demux_ahead(sd);
+        pthread_cond_wait(&sd->cond, &sd->mutex);
+        continue;
+      }
+      if (!seg->started)
+      {
+        seg->started = 1;
+        // timestamps restart after a discontinuity, they are moved on to where the last segment ended
+        if ((seg->flags & SEGMENT_DISCONTINUITY) && sd->end != AV_NOPTS_VALUE && seg->start != AV_NOPTS_VALUE)
+        {
+          sd->offset = sd->end - seg->start;
+        }
+      }
+      *segment = seg;
+      return 0;
+    }
+    if (!seg && sd->is_done) return AVERROR_EOF;
+    pthread_cond_wait(&sd->cond, &sd->mutex);
+  }
+}
+
+// drop a segment read to its end, caller holds the mutex
+static void finish_segment(SegmentDemuxer *sd, Segment *seg)
+{
+  Segment **p;
+
+  if (seg->end != AV_NOPTS_VALUE)
+  {
+    sd->end = seg->end + sd->offset;
+  }
+  else if (sd->end != AV_NOPTS_VALUE)
+  {
+    sd->end += seg->duration;
+  }
+  for (p = &sd->segments; *p != seg; p = &(*p)->next_segment);
+  *p = seg->next_segment;
+  sd->next_sequence = seg->sequence + 1;
+  segment_free(&seg);
+  demux_ahead(sd);
+}
+
+int segment_demuxer_open(SegmentDemuxer *segment_demuxer, AVFormatContext **fmt_ctx, volatile int *abort)
+{
+  int ret = 0;
+  Segment *seg;
+  SegmentDemuxer *sd = segment_demuxer;
+
+  pthread_mutex_lock(&sd->mutex);
+  while (!sd->template && (ret = next_segment(sd, &seg, abort)) >= 0)
+  {
+    // a first segment that does not open is skipped, the next one tries again
+    if (!sd->template) finish_segment(sd, seg);
+  }
+  *fmt_ctx = sd->template;
+  sd->opened = !!sd->template;
+  pthread_mutex_unlock(&sd->mutex);
+  return ret < 0 ? ret : 0;
+}
+
+int segment_demuxer_read(SegmentDemuxer *segment_demuxer, AVPacket *pkt, volatile int *abort)
+{
+  int ret;
+  int64_t offset;
+  Segment *seg;
+  AVStream *st;
+  SegmentDemuxer *sd = segment_demuxer;
+
+  pthread_mutex_lock(&sd->mutex);
+  while ((ret = next_segment(sd, &seg, abort)) >= 0)
+  {
+    if (seg->next == seg->nb_packets)
+    {
+      finish_segment(sd, seg);
+      continue;
+    }
+    av_packet_move_ref(pkt, seg->packets[seg->next]);
+    av_packet_free(&seg->packets[seg->next++]);
+    if (!sd->template || pkt->stream_index >= (int)sd->template->nb_streams)
+    {
+      av_packet_unref(pkt);
+      continue;
+    }
+    st = sd->template->streams[pkt->stream_index];
+    if (sd->offset)
+    {
+      offset = av_rescale_q(sd->offset, AV_TIME_BASE_Q, pkt->time_base);
+      if (pkt->pts != AV_NOPTS_VALUE) pkt->pts += offset;
+      if (pkt->dts != AV_NOPTS_VALUE) pkt->dts += offset;
+    }
+    av_packet_rescale_ts(pkt, pkt->time_base, st->time_base);
+    pkt->time_base = st->time_base;
+    break;
+  }
+  pthread_mutex_unlock(&sd->mutex);
+  return ret;
+}
+
+int segment_demuxer_ready(SegmentDemuxer *segment_demuxer)
+{
+  int ready = 0;
+  Segment *seg;
+  SegmentDemuxer *sd = segment_demuxer;
+
+  pthread_mutex_lock(&sd->mutex);
+  for (seg = sd->segments; seg && seg->sequence < sd->next_sequence; seg = seg->next_segment);
+  ready = sd->is_done || (seg && seg->sequence == sd->next_sequence);
+  pthread_mutex_unlock(&sd->mutex);
+  return ready;
+}
@@ -0,0 +1,117 @@
+#ifndef SEGMENT_DEMUXER_H
+#define SEGMENT_DEMUXER_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include <libavformat/avformat.h>
+
+#include "thread_pool.h"
+
+// segment flags, from the playlist
+#define SEGMENT_INIT (1 << 0)
+#define SEGMENT_DISCONTINUITY (1 << 1)
+
+// segments demuxed ahead of the reader by default, and at most
+#define SEGMENT_AHEAD 4
+#define SEGMENT_MAX_AHEAD 16
+
+struct SegmentDemuxer;
+
+// one media segment of the playlist and, once demuxed, its packets
+typedef struct Segment
+{
+  struct SegmentDemuxer *demuxer;
+  int sequence;
+  int flags;
+  // playlist duration in microseconds, 0 when unknown
+  int64_t duration;
+  // init section (EXT-X-MAP, dash initialization) the segment is read after, NULL for ts
+  AVBufferRef *init;
+  AVBufferRef *data;
+  // read position over init and data for the segment's avio
+  int64_t position;
+  AVPacket **packets;
+  int nb_packets;
+  int capacity;
+  // packet read next
+  int next;
+  // dts range of the packets in microseconds, AV_NOPTS_VALUE when empty
+  int64_t start;
+  int64_t end;
+  // handed to the pool in group, and done there
+  int queued;
+  int demuxed;
+  ThreadPoolGroup group;
+  int started;
+  // set on the segment read first while there are no streams, it keeps its format context
+  int keep;
+  AVFormatContext *fmt_ctx;
+  int ret;
+  struct Segment *next_segment;
+} Segment;
+
+// takes the segments of an hls or dash playlist as they are downloaded, in any order,
+// demuxes those already there in parallel on a thread pool ahead of the reader and
+// hands their packets out spliced in playlist order, rescaled to the time bases of the
+// first segment's streams. timestamps are rebased across discontinuities so they keep
+// running on from the previous segment.
+typedef struct SegmentDemuxer
+{
+  ThreadPool *pool;
+  int priority;
+  int ahead;
+  // sorted by sequence
+  Segment *segments;
+  // init section for segments added from now on
+  AVBufferRef *init;
+  // sequence spliced next, < 0 until the playlist tells where to start
+  int next_sequence;
+  // streams of the first segment, what packets are rescaled to
+  AVFormatContext *template;
+  // set once segment_demuxer_open handed out the template, only a reset drops it then
+  int opened;
+  // added to every timestamp since the last discontinuity, and where the last segment ended (us)
+  int64_t offset;
+  int64_t end;
+  int is_done;
+  // segments queued on the pool and not demuxed yet, they must stay
+  int demuxing;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+} SegmentDemuxer;
+
+int segment_demuxer_create(SegmentDemuxer **segment_demuxer, ThreadPool *pool);
+
+void segment_demuxer_free(SegmentDemuxer **segment_demuxer);
+
+// drop every segment and start over at first_sequence, demuxing up to ahead segments at
+// once. with first_sequence < 0 nothing is read until the demuxer is done, the lowest
+// one added is the first then. waits for the segments being demuxed
+void segment_demuxer_reset(SegmentDemuxer *segment_demuxer, int first_sequence, int ahead, int priority);
+
+// the same as a reset before playback, AVERROR(EBUSY) once segment_demuxer_open handed
+// out the streams, a reader still uses them
+int segment_demuxer_start(SegmentDemuxer *segment_demuxer, int first_sequence, int ahead, int priority);
+
+// add a downloaded segment, the demuxer takes over data. an init segment (SEGMENT_INIT)
+// applies to the media segments added after it
+int segment_demuxer_add(SegmentDemuxer *segment_demuxer, int sequence, int flags, int64_t duration, AVBufferRef *data);
+
+// no more segments, readers get AVERROR_EOF after the last one
+void segment_demuxer_done(SegmentDemuxer *segment_demuxer);
+
+// wait for the first segment and return the format context describing its streams. it
+// stays owned by the demuxer until the next reset, segment_demuxer_start is refused from
+// then on. AVERROR_EXIT once *abort is set
+int segment_demuxer_open(SegmentDemuxer *segment_demuxer, AVFormatContext **fmt_ctx, volatile int *abort);
+
+// the next packet in playlist order, waiting for the segment it is in
+int segment_demuxer_read(SegmentDemuxer *segment_demuxer, AVPacket *pkt, volatile int *abort);
+
+// 1 when a packet can be read without waiting for a download
+int segment_demuxer_ready(SegmentDemuxer *segment_demuxer);
+
+// wake a reader so it looks at its abort flag again
+void segment_demuxer_wake(SegmentDemuxer *segment_demuxer);
+#endif
@@ -0,0 +1,265 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "thread_pool.h"
+
+typedef struct Worker
+{
+  ThreadPool *pool;
+  int index;
+} Worker;
+
+// the worker the current thread is, -1 outside the pool
+static __thread int current_worker = -1;
+static __thread ThreadPool *current_pool = NULL;
+
+static ThreadPool *shared_pool = NULL;
+static pthread_mutex_t shared_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void queue_push(ThreadPoolGroupQueue *queue, ThreadPoolGroup *group)
+{
+  group->queue = queue;
+  group->prev = queue->tail;
+  group->next_group = NULL;
+  if (queue->tail) queue->tail->next_group = group;
+  else queue->head = group;
+  queue->tail = group;
+}
+
+static void queue_remove(ThreadPoolGroup *group)
+{
+  ThreadPoolGroupQueue *queue = group->queue;
+  if (!queue) return;
+  if (group->prev) group->prev->next_group = group->next_group;
+  else queue->head = group->next_group;
+  if (group->next_group) group->next_group->prev = group->prev;
+  else queue->tail = group->prev;
+  group->queue = NULL;
+  group->prev = NULL;
+  group->next_group = NULL;
+}
+
+// claim the next job of group, it leaves its queue with the last one
+static int group_claim(ThreadPoolGroup *group)
+{
+  int index = group->next++;
+  if (group->next == group->count) queue_remove(group);
+  return index;
+}
+
+// one job from the head batch, which then goes to the back of the line
+static ThreadPoolGroup *queue_claim(ThreadPoolGroupQueue *queue, int *index)
+{
+  ThreadPoolGroupQueue *owner;
+  ThreadPoolGroup *group = queue->head;
+  if (!group) return NULL;
+  *index = group_claim(group);
+  if ((owner = group->queue))
+  {
+    queue_remove(group);
+    queue_push(owner, group);
+  }
+  return group;
+}
+
+// own queue first, then the shared queues, then steal from the other workers,
+// higher priorities before lower ones. called with the mutex held.
+static ThreadPoolGroup *find_work(ThreadPool *pool, int self, int *index)
+{
+  ThreadPoolGroup *group;
+  for (int priority = THREAD_POOL_PRIORITIES - 1; priority >= 0; priority--)
+  {
+    if ((group = queue_claim(&pool->local[self][priority], index))) return group;
+    if ((group = queue_claim(&pool->shared[priority], index))) return group;
+    for (int i = 1; i < pool->nb_workers; i++)
+    {
+      int victim = (self + i) % pool->nb_workers;
+      if ((group = queue_claim(&pool->local[victim][priority], index))) return group;
+    }
+  }
+  return NULL;
+}
+
+static void finish_job(ThreadPool *pool, ThreadPoolGroup *group)
+{
+  if (--group->remaining == 0) pthread_cond_broadcast(&pool->done_cond);
+}
+
+static void *worker_main(void *arg)
+{
+  int index;
+  Worker *worker = arg;
+  ThreadPool *pool = worker->pool;
+  ThreadPoolGroup *group;
+
+  current_worker = worker->index;
+  current_pool = pool;
+  free(worker);
+
+  pthread_mutex_lock(&pool->mutex);
+  while (!pool->quit)
+  {
+    if (!(group = find_work(pool, current_worker, &index)))
+    {
+      pthread_cond_wait(&pool->work_cond, &pool->mutex);
+      continue;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    (*group->job)(group->arg, index);
+    pthread_mutex_lock(&pool->mutex);
+    finish_job(pool, group);
+  }
+  pthread_mutex_unlock(&pool->mutex);
+  return NULL;
+}
+
+int thread_pool_create(ThreadPool **thread_pool, int nb_workers)
+{
+  ThreadPool *pool;
+  Worker *worker;
+
+  if (nb_workers <= 0)
+  {
+    nb_workers = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  nb_workers = nb_workers < 1 ? 1 : nb_workers > THREAD_POOL_MAX_WORKERS ? THREAD_POOL_MAX_WORKERS : nb_workers;
+
+  if (!(pool = calloc(1, sizeof(ThreadPool))))
+  {
+    return -1;
+  }
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->work_cond, NULL);
+  pthread_cond_init(&pool->done_cond, NULL);
+
+  // workers look at nb_workers to steal, they start once all are there
+  pthread_mutex_lock(&pool->mutex);
+  for (int i = 0; i < nb_workers; i++)
+  {
+    if (!(worker = malloc(sizeof(Worker))))
+    {
+      break;
+    }
+    worker->pool = pool;
+    worker->index = i;
+    if (pthread_create(&pool->workers[i], NULL, &worker_main, worker) != 0)
+    {
+      fprintf(stderr, "Could not start pool worker %d\n", i);
+      free(worker);
+      break;
+    }
+    pool->nb_workers++;
+  }
+  pthread_mutex_unlock(&pool->mutex);
+  if (pool->nb_workers == 0)
+  {
+    thread_pool_free(&pool);
+    return -1;
+  }
+
+  *thread_pool = pool;
+  return 0;
+}
+
+void thread_pool_free(ThreadPool **thread_pool)
+{
+  ThreadPool *pool = *thread_pool;
+  if (pool == NULL) return;
+
+  pthread_mutex_lock(&pool->mutex);
+  pool->quit = 1;
+  pthread_cond_broadcast(&pool->work_cond);
+  pthread_mutex_unlock(&pool->mutex);
+  for (int i = 0; i < pool->nb_workers; i++)
+  {
+    pthread_join(pool->workers[i], NULL);
+  }
+  pthread_mutex_destroy(&pool->mutex);
+  pthread_cond_destroy(&pool->work_cond);
+  pthread_cond_destroy(&pool->done_cond);
+  free(pool);
+  *thread_pool = NULL;
+}
+
+ThreadPool *thread_pool_shared()
+{
+  pthread_mutex_lock(&shared_mutex);
+  if (!shared_pool && thread_pool_create(&shared_pool, 0) < 0)
+  {
+    fprintf(stderr, "Could not create the shared thread pool\n");
+  }
+  pthread_mutex_unlock(&shared_mutex);
+  return shared_pool;
+}
+
+void thread_pool_run(ThreadPool *thread_pool, ThreadPoolJob job, void *arg, int count, int priority)
+{
+  ThreadPoolGroup group;
+
+  if (!thread_pool || count <= 1)
+  {
+    for (int i = 0; i < count; i++) (*job)(arg, i);
+    return;
+  }
+  thread_pool_submit(thread_pool, &group, job, arg, count, priority);
+  thread_pool_wait(thread_pool, &group);
+}
+
+void thread_pool_submit(ThreadPool *thread_pool, ThreadPoolGroup *group, ThreadPoolJob job, void *arg, int count, int priority)
+{
+  *group = (ThreadPoolGroup){
+    .job = job,
+    .arg = arg,
+    .count = count > 0 ? count : 0,
+    .remaining = count > 0 ? count : 0,
+  };
+
+  if (!thread_pool)
+  {
+    for (int i = 0; i < group->count; i++) (*job)(arg, i);
+    group->next = group->count;
+    group->remaining = 0;
+    return;
+  }
+  if (!group->count) return;
+  priority = priority < 0 ? 0 : priority >= THREAD_POOL_PRIORITIES ? THREAD_POOL_PRIORITIES - 1 : priority;
+
+  pthread_mutex_lock(&thread_pool->mutex);
+  if (current_pool == thread_pool && current_worker >= 0)
+  {
+    queue_push(&thread_pool->local[current_worker][priority], group);
+  }
+  else
+  {
+    queue_push(&thread_pool->shared[priority], group);
+  }
+  pthread_cond_broadcast(&thread_pool->work_cond);
+  pthread_mutex_unlock(&thread_pool->mutex);
+}
+
+void thread_pool_wait(ThreadPool *thread_pool, ThreadPoolGroup *group)
+{
+  int index;
+
+  if (!thread_pool) return;
+  pthread_mutex_lock(&thread_pool->mutex);
+  while (group->next < group->count)
+  {
+    index = group_claim(group);
+    pthread_mutex_unlock(&thread_pool->mutex);
+    (*group->job)(group->arg, index);
+    pthread_mutex_lock(&thread_pool->mutex);
+    finish_job(thread_pool, group);
+  }
+  while (group->remaining > 0)
+  {
+    pthread_cond_wait(&thread_pool->done_cond, &thread_pool->mutex);
+  }
+  pthread_mutex_unlock(&thread_pool->mutex);
+}
+
+int thread_pool_thread_index(ThreadPool *thread_pool)
+{
+  return current_pool == thread_pool && current_worker >= 0 ? current_worker : thread_pool->nb_workers;
+}
@@ -0,0 +1,79 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <pthread.h>
+
+#define THREAD_POOL_MAX_WORKERS 16
+
+enum ThreadPoolPriority {
+  THREAD_POOL_PRIORITY_LOW = 0,
+  THREAD_POOL_PRIORITY_NORMAL = 1,
+  THREAD_POOL_PRIORITY_HIGH = 2,
+  THREAD_POOL_PRIORITIES = 3,
+};
+
+// one job of a batch, index runs from 0 to count - 1
+typedef void (*ThreadPoolJob)(void *arg, int index);
+
+struct ThreadPoolGroupQueue;
+
+// a batch handed to thread_pool_run, lives on the caller's stack, or to thread_pool_submit
+typedef struct ThreadPoolGroup
+{
+  ThreadPoolJob job;
+  void *arg;
+  int count;
+  // next job to claim and jobs not finished yet
+  int next;
+  int remaining;
+  struct ThreadPoolGroupQueue *queue;
+  struct ThreadPoolGroup *prev;
+  struct ThreadPoolGroup *next_group;
+} ThreadPoolGroup;
+
+typedef struct ThreadPoolGroupQueue
+{
+  ThreadPoolGroup *head;
+  ThreadPoolGroup *tail;
+} ThreadPoolGroupQueue;
+
+// a fixed set of workers shared by every caller. batches from outside the pool
+// queue per priority and are served round robin, one job per turn, so no caller
+// starves another. batches started from a worker land in that worker's own queue,
+// idle workers steal from there once the shared queues are empty.
+typedef struct ThreadPool
+{
+  pthread_t workers[THREAD_POOL_MAX_WORKERS];
+  int nb_workers;
+  pthread_mutex_t mutex;
+  pthread_cond_t work_cond;
+  pthread_cond_t done_cond;
+  ThreadPoolGroupQueue shared[THREAD_POOL_PRIORITIES];
+  ThreadPoolGroupQueue local[THREAD_POOL_MAX_WORKERS][THREAD_POOL_PRIORITIES];
+  int quit;
+} ThreadPool;
+
+// nb_workers <= 0 uses one worker per logical core
+int thread_pool_create(ThreadPool **thread_pool, int nb_workers);
+
+void thread_pool_free(ThreadPool **thread_pool);
+
+// the process wide pool, created on first use, NULL if it could not be
+ThreadPool *thread_pool_shared();
+
+// run job(arg, 0 .. count - 1) on the pool and return once all are done. the
+// calling thread works on its own batch meanwhile, so nested calls cannot deadlock.
+void thread_pool_run(ThreadPool *thread_pool, ThreadPoolJob job, void *arg, int count, int priority);
+
+// queue job(arg, 0 .. count - 1) on the pool and return right away. group is the
+// caller's and must stay until thread_pool_wait returned for it. without a pool the
+// jobs run before this returns.
+void thread_pool_submit(ThreadPool *thread_pool, ThreadPoolGroup *group, ThreadPoolJob job, void *arg, int count, int priority);
+
+// return once every job of a submitted group is done, working on those not started yet
+void thread_pool_wait(ThreadPool *thread_pool, ThreadPoolGroup *group);
+
+// index of the calling worker of thread_pool, nb_workers for any other thread. jobs of
+// one batch running at the same time never share an index
+int thread_pool_thread_index(ThreadPool *thread_pool);
+#endif
@@ -0,0 +1,244 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+
+#include <libavutil/avutil.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+
+#include "thumbnailer.h"
+#include "image_pool.h"
+
+static void vtt_printf(Thumbnailer *t, const char *format, ...)
+{
+  char line[256];
+  int size;
+  va_list args;
+
+  va_start(args, format);
+  size = vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  memory_stream_write(t->vtt, (const uint8_t *)line, FFMIN(size, (int)sizeof(line) - 1));
+  // keep the map a c string
+  *memory_stream_ensure_write(t->vtt, 1) = 0;
+}
+
+int thumbnailer_create(Thumbnailer **thumbnailer, int width, int height, int columns, int rows, enum AVCodecID codec_id, int quality)
+{
+  Thumbnailer *t;
+
+  if (!(t = calloc(1, sizeof(Thumbnailer))))
+  {
+    return AVERROR(ENOMEM);
+  }
+  t->width = width;
+  t->height = height;
+  t->columns = FFMAX(columns, 0);
+  t->rows = t->columns ? FFMAX(rows, 1) : 0;
+  t->codec_id = codec_id;
+  t->quality = av_clip(quality, 2, 31);
+  t->cue_pts = AV_NOPTS_VALUE;
+
+  if (!(t->pkt = av_packet_alloc()) || memory_stream_create(&t->vtt, MEMORY_PAGE, 0) != 0)
+  {
+    thumbnailer_free(&t);
+    return AVERROR(ENOMEM);
+  }
+  vtt_printf(t, "WEBVTT\n\n");
+
+  *thumbnailer = t;
+
+  return 0;
+}
+
+void thumbnailer_free(Thumbnailer **thumbnailer)
+{
+  Thumbnailer *t = *thumbnailer;
+  if (t == NULL) return;
+  avcodec_free_context(&t->enc);
+  sws_freeContext(t->sws);
+  av_frame_free(&t->image);
+  av_packet_free(&t->pkt);
+  memory_stream_free(&t->vtt);
+  free(t);
+  *thumbnailer = NULL;
+}
+
+// the encoder and the image it encodes, sized by the first frame
+static int open_encoder(Thumbnailer *t, const AVFrame *frame)
+{
+  int ret;
+  const AVCodec *codec;
+
+  if (t->width <= 0 && t->height <= 0)
+  {
+    t->width = frame->width & ~1;
+    t->height = frame->height & ~1;
+  }
+  else if (t->width <= 0)
+  {
+    t->width = image_follow_aspect(t->height, frame->width, frame->height);
+  }
+  else if (t->height <= 0)
+  {
+    t->height = image_follow_aspect(t->width, frame->height, frame->width);
+  }
+  t->width &= ~1;
+  t->height &= ~1;
+
+  if (!(codec = avcodec_find_encoder(t->codec_id)))
+  {
+    fprintf(stderr, "Could not find %s encoder\n", avcodec_get_name(t->codec_id));
+    return AVERROR(ENOSYS);
+  }
+  if (!(t->enc = avcodec_alloc_context3(codec)))
+  {
+    return AVERROR(ENOMEM);
+  }
+  t->enc->width = t->width * FFMAX(t->columns, 1);
+  t->enc->height = t->height * FFMAX(t->rows, 1);
+  t->enc->pix_fmt = codec->pix_fmts ? codec->pix_fmts[0] : AV_PIX_FMT_YUV420P;
+  t->enc->time_base = (AVRational){ 1, 25 };
+  t->enc->flags |= AV_CODEC_FLAG_QSCALE;
+  t->enc->global_quality = FF_QP2LAMBDA * t->quality;
+  if ((ret = avcodec_open2(t->enc, codec, NULL)) < 0)
+  {
+    fprintf(stderr, "Could not open %s encoder (%s)\n", codec->name, av_err2str(ret));
+    return ret;
+  }
+
+  if (!(t->image = av_frame_alloc()))
+  {
+    return AVERROR(ENOMEM);
+  }
+  t->image->width = t->enc->width;
+  t->image->height = t->enc->height;
+  t->image->format = t->enc->pix_fmt;
+  return av_frame_get_buffer(t->image, 0);
+}
+
+// tiles a last sheet leaves empty stay black
+static void clear_image(Thumbnailer *t)
+{
+  ptrdiff_t line_size[4];
+  for (int i = 0; i < 4; i++)
+  {
+    line_size[i] = t->image->linesize[i];
+  }
+  av_image_fill_black(t->image->data, line_size, t->image->format, AVCOL_RANGE_JPEG, t->image->width, t->image->height);
+}
+
+static void vtt_time(char *buf, int64_t us)
+{
+  int64_t ms = FFMAX(us, 0) / 1000;
+  snprintf(buf, 16, "%02d:%02d:%02d.%03d", (int)(ms / 3600000), (int)(ms / 60000 % 60), (int)(ms / 1000 % 60), (int)(ms % 1000));
+}
+
+static void write_cue(Thumbnailer *t, int64_t end)
+{
+  char from[16], to[16];
+  const char *ext = t->codec_id == AV_CODEC_ID_MJPEG ? "jpg" : avcodec_get_name(t->codec_id);
+
+  if (t->cue_pts == AV_NOPTS_VALUE) return;
+  vtt_time(from, t->cue_pts);
+  vtt_time(to, FFMAX(end, t->cue_pts));
+  if (t->columns)
+  {
+    vtt_printf(t, "%s --> %s\nsheet_%d.%s#xywh=%d,%d,%d,%d\n\n", from, to, t->cue_image, ext, t->cue_x, t->cue_y, t->width, t->height);
+  }
+  else
+  {
+    vtt_printf(t, "%s --> %s\nthumb_%d.%s\n\n", from, to, t->cue_image, ext);
+  }
+  t->cue_pts = AV_NOPTS_VALUE;
+}
+
+static int encode_image(Thumbnailer *t)
+{
+  int ret;
+
+  av_packet_unref(t->pkt);
+  t->image->quality = t->enc->global_quality;
+  t->image->pts = t->nb_images;
+  if ((ret = avcodec_send_frame(t->enc, t->image)) < 0 || (ret = avcodec_receive_packet(t->enc, t->pkt)) < 0)
+  {
+    fprintf(stderr, "Could not encode thumbnail (%s)\n", av_err2str(ret));
+    return ret;
+  }
+  t->image_pts = t->sheet_pts;
+  t->nb_images++;
+  t->tiles = 0;
+  return 1;
+}
+
+// the planes of the image at pixel (x, y), for scaling straight into a sheet tile
+static void tile_planes(Thumbnailer *t, int x, int y, uint8_t *planes[4])
+{
+  const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(t->image->format);
+  for (int i = 0; i < 4; i++)
+  {
+    int ty = i == 1 || i == 2 ? y >> desc->log2_chroma_h : y;
+    planes[i] = t->image->data[i] ? t->image->data[i] + ty * t->image->linesize[i] +
+                FFMAX(av_image_get_linesize(t->image->format, x, i), 0) : NULL;
+  }
+}
+
+int thumbnailer_add(Thumbnailer *thumbnailer, const AVFrame *frame, int64_t pts)
+{
+  int ret;
+  int x, y;
+  uint8_t *planes[4];
+  Thumbnailer *t = thumbnailer;
+
+  if (!t->enc && (ret = open_encoder(t, frame)) < 0)
+  {
+    return ret;
+  }
+  if ((ret = av_frame_make_writable(t->image)) < 0)
+  {
+    return ret;
+  }
+  if (t->columns && !t->tiles) clear_image(t);
+
+  x = t->columns ? t->tiles % t->columns * t->width : 0;
+  y = t->columns ? t->tiles / t->columns * t->height : 0;
+  if (!(t->sws = sws_getCachedContext(t->sws, frame->width, frame->height, frame->format,
+                                      t->width, t->height, t->image->format, SWS_BICUBIC, NULL, NULL, NULL)))
+  {
+    fprintf(stderr, "Could not create scale context for %dx%d thumbnails!\n", t->width, t->height);
+    return AVERROR(EINVAL);
+  }
+  tile_planes(t, x, y, planes);
+  sws_scale(t->sws, (const uint8_t * const *)frame->data, frame->linesize, 0, frame->height, planes, t->image->linesize);
+
+  write_cue(t, pts);
+  t->cue_pts = pts;
+  t->cue_image = t->nb_images;
+  t->cue_x = x;
+  t->cue_y = y;
+  if (!t->tiles++) t->sheet_pts = pts;
+
+  if (t->tiles < FFMAX(t->columns * t->rows, 1)) return 0;
+  return encode_image(t);
+}
+
+int thumbnailer_flush(Thumbnailer *thumbnailer, int64_t end)
+{
+  int ret = 0;
+  Thumbnailer *t = thumbnailer;
+
+  if (t->tiles && (ret = encode_image(t)) < 0)
+  {
+    return ret;
+  }
+  write_cue(t, end);
+  return ret;
+}
+
+const char *thumbnailer_vtt(Thumbnailer *thumbnailer, long *size)
+{
+  *size = thumbnailer->vtt->length;
+  return (const char *)thumbnailer->vtt->data;
+}
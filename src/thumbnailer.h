@@ -0,0 +1,58 @@
+#ifndef THUMBNAILER_H
+#define THUMBNAILER_H
+
+#include <stdint.h>
+
+#include <libavcodec/avcodec.h>
+
+#include "memory_stream.h"
+
+struct SwsContext;
+
+// scales frames to thumbnails and encodes them to still images, one per thumbnail or
+// a sprite sheet of columns x rows thumbnails each. a WebVTT map of the thumbnails
+// is built alongside.
+typedef struct Thumbnailer
+{
+  // requested size, a side <= 0 follows the aspect ratio of the source
+  int width;
+  int height;
+  // tiles per sheet, 0 columns for one image per thumbnail
+  int columns;
+  int rows;
+  enum AVCodecID codec_id;
+  // encoder qscale, 2 (best) to 31
+  int quality;
+  AVCodecContext *enc;
+  struct SwsContext *sws;
+  // the thumbnail or sheet being filled
+  AVFrame *image;
+  int tiles;
+  // the last encoded image, valid until the next add or flush
+  AVPacket *pkt;
+  int nb_images;
+  // pts of the first thumbnail of pkt in microseconds
+  int64_t image_pts;
+  int64_t sheet_pts;
+  // cue of the last thumbnail, written once the next one tells where it ends
+  int64_t cue_pts;
+  int cue_image;
+  int cue_x;
+  int cue_y;
+  MemoryStream *vtt;
+} Thumbnailer;
+
+int thumbnailer_create(Thumbnailer **thumbnailer, int width, int height, int columns, int rows, enum AVCodecID codec_id, int quality);
+
+void thumbnailer_free(Thumbnailer **thumbnailer);
+
+// add frame shown from pts (us). returns 1 when an image is ready in pkt, 0 when not, < 0 on error
+int thumbnailer_add(Thumbnailer *thumbnailer, const AVFrame *frame, int64_t pts);
+
+// encode a partially filled sheet and close the vtt map with the last thumbnail
+// ending at end (us). returns 1 when an image is ready in pkt, 0 when not, < 0 on error
+int thumbnailer_flush(Thumbnailer *thumbnailer, int64_t end);
+
+// the WebVTT map so far, images are named thumb_<n> or sheet_<n> with the extension of the codec
+const char *thumbnailer_vtt(Thumbnailer *thumbnailer, long *size);
+#endif
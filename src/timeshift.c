@@ -0,0 +1,172 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavutil/avutil.h>
+#include <libavcodec/avcodec.h>
+
+#include "timeshift.h"
+
+int timeshift_create(Timeshift **timeshift, long budget, int64_t window)
+{
+  Timeshift *t;
+
+  if (!(t = calloc(1, sizeof(Timeshift))))
+  {
+    return AVERROR(ENOMEM);
+  }
+  t->budget = budget > 0 ? budget : TIMESHIFT_BUDGET;
+  t->window = window > 0 ? window : TIMESHIFT_WINDOW;
+
+  *timeshift = t;
+
+  return 0;
+}
+
+void timeshift_free(Timeshift **timeshift)
+{
+  Timeshift *t = *timeshift;
+  if (t == NULL) return;
+  timeshift_clear(t);
+  av_freep(&t->entries);
+  free(t);
+  *timeshift = NULL;
+}
+
+static TimeshiftEntry *entry_at(Timeshift *t, int index)
+{
+  return &t->entries[(t->head + index) % t->capacity];
+}
+
+void timeshift_clear(Timeshift *timeshift)
+{
+  for (int i = 0; i < timeshift->length; i++)
+  {
+    av_packet_free(&entry_at(timeshift, i)->pkt);
+  }
+  timeshift->head = 0;
+  timeshift->length = 0;
+  timeshift->cursor = 0;
+  timeshift->bytes = 0;
+}
+
+// drop the oldest gop, up to the next keyframe. the gop at the live edge always stays
+static int timeshift_evict(Timeshift *t)
+{
+  int end = 1;
+
+  while (end < t->length && !entry_at(t, end)->keyframe) end++;
+  if (end == t->length) return 0;
+
+  for (int i = 0; i < end; i++)
+  {
+    TimeshiftEntry *entry = entry_at(t, i);
+    t->bytes -= entry->bytes;
+    av_packet_free(&entry->pkt);
+  }
+  t->head = (t->head + end) % t->capacity;
+  t->length -= end;
+  t->cursor -= end;
+  if (t->cursor < 0)
+  {
+    t->cursor = 0;
+    t->overruns++;
+  }
+  t->evicted++;
+  return 1;
+}
+
+static int timeshift_grow(Timeshift *t)
+{
+  int capacity = FFMAX(t->capacity * 2, 256);
+  TimeshiftEntry *entries = av_malloc_array(capacity, sizeof(TimeshiftEntry));
+
+  if (!entries) return AVERROR(ENOMEM);
+  // unwrap the ring into the new array
+  for (int i = 0; i < t->length; i++)
+  {
+    entries[i] = *entry_at(t, i);
+  }
+  av_freep(&t->entries);
+  t->entries = entries;
+  t->capacity = capacity;
+  t->head = 0;
+  return 0;
+}
+
+int timeshift_put(Timeshift *timeshift, const AVPacket *pkt, int64_t pts, int keyframe)
+{
+  int ret;
+  TimeshiftEntry *entry;
+  Timeshift *t = timeshift;
+  long bytes = pkt->size + sizeof(AVPacket);
+
+  if (t->length == t->capacity && (ret = timeshift_grow(t)) < 0)
+  {
+    return ret;
+  }
+  entry = entry_at(t, t->length);
+  if (!(entry->pkt = av_packet_clone(pkt)))
+  {
+    return AVERROR(ENOMEM);
+  }
+  entry->pts = pts;
+  entry->keyframe = keyframe;
+  entry->bytes = bytes;
+  t->length++;
+  t->bytes += bytes;
+
+  while (t->bytes > t->budget || (pts != AV_NOPTS_VALUE && timeshift_start(t) != AV_NOPTS_VALUE && pts - timeshift_start(t) > t->window))
+  {
+    if (!timeshift_evict(t)) break;
+  }
+  return 0;
+}
+
+int timeshift_next(Timeshift *timeshift, AVPacket *pkt)
+{
+  int ret;
+
+  if (timeshift->cursor >= timeshift->length) return 0;
+  if ((ret = av_packet_ref(pkt, entry_at(timeshift, timeshift->cursor)->pkt)) < 0)
+  {
+    return ret;
+  }
+  timeshift->cursor++;
+  return 1;
+}
+
+int timeshift_seek(Timeshift *timeshift, int64_t pts)
+{
+  int found = -1;
+
+  for (int i = 0; i < timeshift->length; i++)
+  {
+    TimeshiftEntry *entry = entry_at(timeshift, i);
+    if (!entry->keyframe) continue;
+    if (found >= 0 && entry->pts != AV_NOPTS_VALUE && entry->pts > pts) break;
+    found = i;
+  }
+  if (found < 0) return AVERROR(ERANGE);
+  timeshift->cursor = found;
+  return 0;
+}
+
+int timeshift_behind(Timeshift *timeshift)
+{
+  return timeshift->cursor < timeshift->length;
+}
+
+int64_t timeshift_start(Timeshift *timeshift)
+{
+  return timeshift->length ? entry_at(timeshift, 0)->pts : AV_NOPTS_VALUE;
+}
+
+int64_t timeshift_end(Timeshift *timeshift)
+{
+  return timeshift->length ? entry_at(timeshift, timeshift->length - 1)->pts : AV_NOPTS_VALUE;
+}
+
+int64_t timeshift_position(Timeshift *timeshift)
+{
+  return timeshift_behind(timeshift) ? entry_at(timeshift, timeshift->cursor)->pts : timeshift_end(timeshift);
+}
@@ -0,0 +1,65 @@
+#ifndef TIMESHIFT_H
+#define TIMESHIFT_H
+
+#include <stdint.h>
+
+#include <libavcodec/avcodec.h>
+
+// memory and span a timeshift buffer may hold unless configured otherwise
+#define TIMESHIFT_BUDGET (64 * 1024 * 1024)
+#define TIMESHIFT_WINDOW (10 * 60 * 1000000LL)
+
+// a demuxed packet kept for replay. pts in microseconds, keyframe when a gop starts at it
+typedef struct TimeshiftEntry
+{
+  AVPacket *pkt;
+  int64_t pts;
+  int keyframe;
+  long bytes;
+} TimeshiftEntry;
+
+// the last window of demuxed packets of a live input, oldest first in a ring. once
+// over budget or window whole gops are dropped from the front, so replay can always
+// start at a keyframe. a read cursor lags behind the live edge after a pause or a
+// seek back and catches up as packets are read.
+typedef struct Timeshift
+{
+  TimeshiftEntry *entries;
+  int head;
+  int length;
+  int capacity;
+  // entry read next, counted from head, length at the live edge
+  int cursor;
+  long budget;
+  long bytes;
+  int64_t window;
+  // gops dropped, and times that took the packet under the cursor with them
+  long evicted;
+  long overruns;
+} Timeshift;
+
+int timeshift_create(Timeshift **timeshift, long budget, int64_t window);
+
+void timeshift_free(Timeshift **timeshift);
+
+// drop every packet, the stats are kept
+void timeshift_clear(Timeshift *timeshift);
+
+// keep a reference to pkt at the live edge
+int timeshift_put(Timeshift *timeshift, const AVPacket *pkt, int64_t pts, int keyframe);
+
+// 1 when pkt holds the packet at the cursor, which moves on, 0 at the live edge, < 0 on error
+int timeshift_next(Timeshift *timeshift, AVPacket *pkt);
+
+// move the cursor to the last keyframe at or before pts, the first one when pts is older.
+// AVERROR(ERANGE) when there is none
+int timeshift_seek(Timeshift *timeshift, int64_t pts);
+
+// 1 while the cursor is behind the live edge
+int timeshift_behind(Timeshift *timeshift);
+
+// pts of the oldest and newest packet held, and of the one at the cursor. AV_NOPTS_VALUE when none
+int64_t timeshift_start(Timeshift *timeshift);
+int64_t timeshift_end(Timeshift *timeshift);
+int64_t timeshift_position(Timeshift *timeshift);
+#endif
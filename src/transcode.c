@@ -2,11 +2,20 @@
 
 #include <libavutil/avutil.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/audio_fifo.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/time.h>
 #include <libavformat/avio.h>
 #include <libavformat/avformat.h>
 #include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+#include <libswresample/swresample.h>
 
+#ifdef __EMSCRIPTEN__
 #include "emscripten.h"
+#else
+#define EMSCRIPTEN_KEEPALIVE
+#endif
 // #include <emscripten/html5.h>
 #include "memory_stream.h"
 
@@ -37,6 +46,40 @@ static uint8_t *video_dst_data[4] = {NULL};
 static int video_dst_linesize[4];
 static int video_dst_bufsize;
 
+// transcode output
+static MemoryStream *output = NULL;
+static uint8_t *out_io_buffer = NULL;
+static AVIOContext *out_io_ctx = NULL;
+static AVFormatContext *ofmt_ctx = NULL;
+static AVStream *out_video_stream = NULL;
+static AVStream *out_audio_stream = NULL;
+
+// encode context
+static AVCodecContext *video_enc_ctx = NULL;
+static AVCodecContext *audio_enc_ctx = NULL;
+
+// scale & resample
+static struct SwsContext *sws_ctx = NULL;
+static SwrContext *swr_ctx = NULL;
+static AVAudioFifo *audio_fifo = NULL;
+static uint8_t **resample_data = NULL;
+static int resample_capacity = 0;
+
+// reused for every frame and packet of the pipeline
+static AVFrame *video_enc_frame = NULL;
+static AVFrame *audio_enc_frame = NULL;
+static AVPacket *enc_pkt = NULL;
+// AV_NOPTS_VALUE until the first decoded audio frame gives it
+static int64_t audio_next_pts = AV_NOPTS_VALUE;
+// for decoded frames without a timestamp
+static int64_t video_next_pts = 0;
+// start_time of the input, output timestamps start at 0 from there for every stream
+static int64_t input_start = 0;
+
+// stats
+static int64_t media_duration = 0;
+static double realtime_factor = 0;
+
 /*************************************************/
 /*** test section ******************************/
 /*************************************************/
@@ -103,18 +146,7 @@ static int find_best_stream_by_type(AVStream **stream, AVFormatContext *fmt_ctx,
     return ret;
 }
 
-static int infinite_parse_packet(double time, void *data)
-{
-    if (av_read_frame(fmt_ctx, pkt) >= 0)
-    {
-
-    }
-    return 0;
-}
-
-// demux api
-EMSCRIPTEN_KEEPALIVE
-int open_demuxer(StreamSelectedCallback on_stream_selected, PacketParsedCallback on_packet_parsed)
+static int open_input()
 {
     int ret;
 
@@ -156,13 +188,27 @@ int open_demuxer(StreamSelectedCallback on_stream_selected, PacketParsedCallback
         fprintf(stderr, "Could not find stream %s\n", av_get_media_type_string(AVMEDIA_TYPE_AUDIO));
     }
 
-    // trigger event for select stream end
     if (!video_stream && !audio_stream)
     {
         fprintf(stderr, "Could not find video and audio streams\n");
         return AVERROR(ENOSTR);
     }
 
+    return 0;
+}
+
+// demux api
+EMSCRIPTEN_KEEPALIVE
+int open_demuxer(StreamSelectedCallback on_stream_selected, PacketParsedCallback on_packet_parsed)
+{
+    int ret;
+
+    if ((ret = open_input()) < 0)
+    {
+        return ret;
+    }
+
+    // trigger event for select stream end
     (*on_stream_selected)();
 
     // infinite parse packet
@@ -175,8 +221,6 @@ int open_demuxer(StreamSelectedCallback on_stream_selected, PacketParsedCallback
     {
         return AVERROR(ENOMEM);
     }
-    
-    // emscripten_request_animation_frame_loop(&infinite_parse_packet, NULL);
 
     while(av_read_frame(fmt_ctx, pkt) >=0)
     {
@@ -341,4 +385,632 @@ void close_decoder()
     if (audio_dec_ctx) avcodec_free_context(&audio_dec_ctx);
     if (pkt) av_packet_free(&pkt);
     if (frame) av_frame_free(&frame);
-}
\ No newline at end of file
+    av_freep(&video_dst_data[0]);
+}
+/*************************************************/
+/*** encode section ******************************/
+/*************************************************/
+static const AVCodec *find_encoder(const char *codec_name, enum AVCodecID default_id)
+{
+    if (codec_name && codec_name[0]) return avcodec_find_encoder_by_name(codec_name);
+    return default_id == AV_CODEC_ID_NONE ? NULL : avcodec_find_encoder(default_id);
+}
+
+static int open_video_encoder(const char *codec_name, int width, int height, int64_t bit_rate)
+{
+    int ret;
+    const AVCodec *enc;
+    AVRational frame_rate;
+
+    if (!(enc = find_encoder(codec_name, ofmt_ctx->oformat->video_codec)))
+    {
+        fprintf(stderr, "Could not find video encoder %s\n", codec_name ? codec_name : "");
+        return AVERROR_ENCODER_NOT_FOUND;
+    }
+
+    if (!(video_enc_ctx = avcodec_alloc_context3(enc)))
+    {
+        return AVERROR(ENOMEM);
+    }
+
+    // keep the aspect ratio when only one side is given
+    if (width <= 0 && height <= 0)
+    {
+        width = video_dec_ctx->width;
+        height = video_dec_ctx->height;
+    }
+    else if (width <= 0)
+    {
+        width = (int)av_rescale(video_dec_ctx->width, height, video_dec_ctx->height) & ~1;
+    }
+    else if (height <= 0)
+    {
+        height = (int)av_rescale(video_dec_ctx->height, width, video_dec_ctx->width) & ~1;
+    }
+
+    frame_rate = av_guess_frame_rate(fmt_ctx, video_stream, NULL);
+    if (!frame_rate.num || !frame_rate.den) frame_rate = av_make_q(25, 1);
+
+    video_enc_ctx->width = width;
+    video_enc_ctx->height = height;
+    video_enc_ctx->sample_aspect_ratio = video_dec_ctx->sample_aspect_ratio;
+    video_enc_ctx->pix_fmt = enc->pix_fmts ? enc->pix_fmts[0] : video_dec_ctx->pix_fmt;
+    video_enc_ctx->framerate = frame_rate;
+    video_enc_ctx->time_base = av_inv_q(frame_rate);
+    if (bit_rate > 0) video_enc_ctx->bit_rate = bit_rate;
+    if (ofmt_ctx->oformat->flags & AVFMT_GLOBALHEADER)
+    {
+        video_enc_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+
+    if ((ret = avcodec_open2(video_enc_ctx, enc, NULL)) < 0)
+    {
+        fprintf(stderr, "Could not open video encoder %s\n", enc->name);
+        return ret;
+    }
+
+    // one frame for every scaled picture
+    if (!(video_enc_frame = av_frame_alloc()))
+    {
+        return AVERROR(ENOMEM);
+    }
+    video_enc_frame->format = video_enc_ctx->pix_fmt;
+    video_enc_frame->width = width;
+    video_enc_frame->height = height;
+    if ((ret = av_frame_get_buffer(video_enc_frame, 0)) < 0)
+    {
+        return ret;
+    }
+
+    return 0;
+}
+
+static int open_audio_encoder(const char *codec_name, int64_t bit_rate)
+{
+    int ret;
+    const AVCodec *enc;
+
+    if (!(enc = find_encoder(codec_name, ofmt_ctx->oformat->audio_codec)))
+    {
+        fprintf(stderr, "Could not find audio encoder %s\n", codec_name ? codec_name : "");
+        return AVERROR_ENCODER_NOT_FOUND;
+    }
+
+    if (!(audio_enc_ctx = avcodec_alloc_context3(enc)))
+    {
+        return AVERROR(ENOMEM);
+    }
+
+    audio_enc_ctx->sample_fmt = enc->sample_fmts ? enc->sample_fmts[0] : audio_dec_ctx->sample_fmt;
+    audio_enc_ctx->sample_rate = audio_dec_ctx->sample_rate;
+    if (enc->supported_samplerates)
+    {
+        // take the source rate when supported, else the first one offered
+        const int *rate = enc->supported_samplerates;
+        audio_enc_ctx->sample_rate = *rate;
+        for (; *rate; rate++)
+        {
+            if (*rate == audio_dec_ctx->sample_rate) audio_enc_ctx->sample_rate = *rate;
+        }
+    }
+    if ((ret = av_channel_layout_copy(&audio_enc_ctx->ch_layout, &audio_dec_ctx->ch_layout)) < 0)
+    {
+        return ret;
+    }
+    audio_enc_ctx->time_base = av_make_q(1, audio_enc_ctx->sample_rate);
+    if (bit_rate > 0) audio_enc_ctx->bit_rate = bit_rate;
+    if (ofmt_ctx->oformat->flags & AVFMT_GLOBALHEADER)
+    {
+        audio_enc_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    }
+
+    if ((ret = avcodec_open2(audio_enc_ctx, enc, NULL)) < 0)
+    {
+        fprintf(stderr, "Could not open audio encoder %s\n", enc->name);
+        return ret;
+    }
+
+    if ((ret = swr_alloc_set_opts2(&swr_ctx,
+        &audio_enc_ctx->ch_layout, audio_enc_ctx->sample_fmt, audio_enc_ctx->sample_rate,
+        &audio_dec_ctx->ch_layout, audio_dec_ctx->sample_fmt, audio_dec_ctx->sample_rate,
+        0, NULL)) < 0 || (ret = swr_init(swr_ctx)) < 0)
+    {
+        fprintf(stderr, "Could not open audio resampler\n");
+        return ret;
+    }
+
+    // encoders take fixed size frames, resampled audio queues up in between
+    if (!(audio_fifo = av_audio_fifo_alloc(audio_enc_ctx->sample_fmt, audio_enc_ctx->ch_layout.nb_channels, 1)))
+    {
+        return AVERROR(ENOMEM);
+    }
+
+    if (!(audio_enc_frame = av_frame_alloc()))
+    {
+        return AVERROR(ENOMEM);
+    }
+    audio_enc_frame->format = audio_enc_ctx->sample_fmt;
+    audio_enc_frame->sample_rate = audio_enc_ctx->sample_rate;
+    audio_enc_frame->nb_samples = audio_enc_ctx->frame_size > 0 ? audio_enc_ctx->frame_size : 1024;
+    if ((ret = av_channel_layout_copy(&audio_enc_frame->ch_layout, &audio_enc_ctx->ch_layout)) < 0)
+    {
+        return ret;
+    }
+    if ((ret = av_frame_get_buffer(audio_enc_frame, 0)) < 0)
+    {
+        return ret;
+    }
+
+    return 0;
+}
+
+static int encode_write_frame(AVCodecContext *enc_ctx, AVStream *out_stream, AVFrame *frame)
+{
+    int ret;
+
+    if ((ret = avcodec_send_frame(enc_ctx, frame)) < 0)
+    {
+        fprintf(stderr, "Error sending a frame for encoding (%s)\n", av_err2str(ret));
+        return ret;
+    }
+
+    while (ret >= 0)
+    {
+        if ((ret = avcodec_receive_packet(enc_ctx, enc_pkt)) < 0)
+        {
+            if (ret == AVERROR_EOF || ret == AVERROR(EAGAIN)) return 0;
+            fprintf(stderr, "Error during encoding (%s)\n", av_err2str(ret));
+            return ret;
+        }
+
+        enc_pkt->stream_index = out_stream->index;
+        av_packet_rescale_ts(enc_pkt, enc_ctx->time_base, out_stream->time_base);
+        // takes over and resets the packet
+        if ((ret = av_interleaved_write_frame(ofmt_ctx, enc_pkt)) < 0)
+        {
+            fprintf(stderr, "Error muxing packet (%s)\n", av_err2str(ret));
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+/*************************************************/
+/*** scale & resample section ********************/
+/*************************************************/
+static int transcode_video_frame(AVFrame *frame)
+{
+    int ret;
+
+    if ((ret = av_frame_make_writable(video_enc_frame)) < 0)
+    {
+        return ret;
+    }
+
+    // cached context follows resolution changes of the input
+    if (!(sws_ctx = sws_getCachedContext(sws_ctx,
+        frame->width, frame->height, frame->format,
+        video_enc_ctx->width, video_enc_ctx->height, video_enc_ctx->pix_fmt,
+        SWS_BILINEAR, NULL, NULL, NULL)))
+    {
+        fprintf(stderr, "Could not open scaler\n");
+        return AVERROR(EINVAL);
+    }
+    sws_scale(sws_ctx, (const uint8_t * const *)frame->data, frame->linesize, 0, frame->height,
+        video_enc_frame->data, video_enc_frame->linesize);
+
+    // frames without a timestamp go on from the one before
+    if (frame->best_effort_timestamp != AV_NOPTS_VALUE)
+    {
+        video_enc_frame->pts = av_rescale_q(frame->best_effort_timestamp -
+            av_rescale_q(input_start, AV_TIME_BASE_Q, video_stream->time_base), video_stream->time_base, video_enc_ctx->time_base);
+    }
+    else
+    {
+        video_enc_frame->pts = video_next_pts;
+    }
+    video_next_pts = video_enc_frame->pts + 1;
+
+    return encode_write_frame(video_enc_ctx, out_video_stream, video_enc_frame);
+}
+
+// encode every full frame in the fifo, or what is left of it when flushing
+static int drain_audio_fifo(int flush)
+{
+    int ret;
+    int frame_size = audio_enc_ctx->frame_size > 0 ? audio_enc_ctx->frame_size : 1024;
+
+    while (av_audio_fifo_size(audio_fifo) >= frame_size || (flush && av_audio_fifo_size(audio_fifo) > 0))
+    {
+        if ((ret = av_frame_make_writable(audio_enc_frame)) < 0)
+        {
+            return ret;
+        }
+        audio_enc_frame->nb_samples = av_audio_fifo_read(audio_fifo, (void **)audio_enc_frame->data, frame_size);
+        audio_enc_frame->pts = audio_next_pts;
+        audio_next_pts += audio_enc_frame->nb_samples;
+        if ((ret = encode_write_frame(audio_enc_ctx, out_audio_stream, audio_enc_frame)) < 0)
+        {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+// a NULL frame drains the resampler
+static int transcode_audio_frame(AVFrame *frame)
+{
+    int ret;
+    int in_samples = frame ? frame->nb_samples : 0;
+    int out_samples = (int)av_rescale_rnd(swr_get_delay(swr_ctx, audio_dec_ctx->sample_rate) + in_samples,
+        audio_enc_ctx->sample_rate, audio_dec_ctx->sample_rate, AV_ROUND_UP);
+
+    // audio that starts later than the input does so in the output as well
+    if (frame && audio_next_pts == AV_NOPTS_VALUE)
+    {
+        audio_next_pts = frame->best_effort_timestamp == AV_NOPTS_VALUE ? 0 :
+            FFMAX(av_rescale_q(frame->best_effort_timestamp - av_rescale_q(input_start, AV_TIME_BASE_Q, audio_stream->time_base),
+                audio_stream->time_base, audio_enc_ctx->time_base), 0);
+    }
+
+    // the resample buffer only ever grows
+    if (out_samples > resample_capacity)
+    {
+        if (resample_data) av_freep(&resample_data[0]);
+        av_freep(&resample_data);
+        if ((ret = av_samples_alloc_array_and_samples(&resample_data, NULL, audio_enc_ctx->ch_layout.nb_channels,
+            out_samples, audio_enc_ctx->sample_fmt, 0)) < 0)
+        {
+            resample_capacity = 0;
+            return ret;
+        }
+        resample_capacity = out_samples;
+    }
+
+    if ((ret = swr_convert(swr_ctx, resample_data, out_samples,
+        frame ? (const uint8_t **)frame->extended_data : NULL, in_samples)) < 0)
+    {
+        fprintf(stderr, "Error while resampling (%s)\n", av_err2str(ret));
+        return ret;
+    }
+
+    if (ret > 0 && av_audio_fifo_write(audio_fifo, (void **)resample_data, ret) < ret)
+    {
+        return AVERROR(ENOMEM);
+    }
+
+    return drain_audio_fifo(!frame);
+}
+
+/*************************************************/
+/*** mux section *********************************/
+/*************************************************/
+static int io_write_packet(void *opaque, uint8_t *buffer, int buffer_size)
+{
+    MemoryStream *ms = (MemoryStream *)opaque;
+    return memory_stream_write_at_position(ms, buffer, buffer_size);
+}
+
+static int64_t io_output_seek(void *opaque, int64_t offset, int whence)
+{
+    MemoryStream *ms = (MemoryStream *)opaque;
+    if (whence == AVSEEK_SIZE) return ms->length;
+    return memory_stream_seek(ms, offset, whence);
+}
+
+static int open_muxer(const char *format_name)
+{
+    int ret;
+
+    if ((ret = memory_stream_create(&output, STORE_SIZE, 0)) != 0)
+    {
+        return AVERROR(ENOMEM);
+    }
+
+    if (!(out_io_buffer = av_malloc(IO_BUFFER_SIZE)))
+    {
+        return AVERROR(ENOMEM);
+    }
+
+    if (!(out_io_ctx = avio_alloc_context(out_io_buffer, IO_BUFFER_SIZE, 1, output, NULL, &io_write_packet, &io_output_seek)))
+    {
+        return AVERROR(ENOMEM);
+    }
+
+    if ((ret = avformat_alloc_output_context2(&ofmt_ctx, NULL, format_name, NULL)) < 0)
+    {
+        fprintf(stderr, "Could not create output format %s\n", format_name);
+        return ret;
+    }
+    ofmt_ctx->pb = out_io_ctx;
+
+    return 0;
+}
+
+static int add_output_stream(AVStream **out_stream, AVCodecContext *enc_ctx)
+{
+    int ret;
+
+    if (!(*out_stream = avformat_new_stream(ofmt_ctx, NULL)))
+    {
+        return AVERROR(ENOMEM);
+    }
+    if ((ret = avcodec_parameters_from_context((*out_stream)->codecpar, enc_ctx)) < 0)
+    {
+        return ret;
+    }
+    (*out_stream)->time_base = enc_ctx->time_base;
+
+    return 0;
+}
+
+/*************************************************/
+/*** transcode section ***************************/
+/*************************************************/
+static int transcode_packet(AVCodecContext *ctx, AVPacket *pkt)
+{
+    int ret;
+
+    if ((ret = avcodec_send_packet(ctx, pkt)) < 0)
+    {
+        fprintf(stderr, "Error submitting a packet for decoding (%s)\n", av_err2str(ret));
+        return ret;
+    }
+
+    while (ret >= 0)
+    {
+        if ((ret = avcodec_receive_frame(ctx, frame)) < 0)
+        {
+            if (ret == AVERROR_EOF || ret == AVERROR(EAGAIN)) return 0;
+            fprintf(stderr, "Error during decoding %s\n", av_err2str(ret));
+            return ret;
+        }
+
+        if (ctx == video_dec_ctx)
+        {
+            ret = transcode_video_frame(frame);
+        }
+        else
+        {
+            ret = transcode_audio_frame(frame);
+        }
+        av_frame_unref(frame);
+    }
+
+    return ret;
+}
+
+// transcode api
+// format_name picks the container (mp4, webm, ...), codec names default to the
+// container's when empty and drop the stream when "none". width or height <= 0
+// keeps the source size or aspect ratio, bit rates <= 0 keep encoder defaults.
+EMSCRIPTEN_KEEPALIVE
+int open_transcoder(const char *format_name, const char *video_codec_name, const char *audio_codec_name,
+    int width, int height, int video_bit_rate, int audio_bit_rate)
+{
+    int ret;
+
+    if ((ret = open_input()) < 0)
+    {
+        return ret;
+    }
+
+    if ((ret = open_muxer(format_name)) < 0)
+    {
+        return ret;
+    }
+
+    if (video_codec_name && !strcmp(video_codec_name, "none")) video_stream = NULL;
+    if (audio_codec_name && !strcmp(audio_codec_name, "none")) audio_stream = NULL;
+
+    // the decoders alone, frames are scaled straight into the encoder's
+    if ((video_stream && (ret = open_decoder_by_type(&video_dec_ctx, video_stream, AVMEDIA_TYPE_VIDEO)) < 0) ||
+        (audio_stream && (ret = open_decoder_by_type(&audio_dec_ctx, audio_stream, AVMEDIA_TYPE_AUDIO)) < 0))
+    {
+        return ret;
+    }
+
+    if (video_stream)
+    {
+        if ((ret = open_video_encoder(video_codec_name, width, height, video_bit_rate)) < 0 ||
+            (ret = add_output_stream(&out_video_stream, video_enc_ctx)) < 0)
+        {
+            return ret;
+        }
+    }
+
+    if (audio_stream)
+    {
+        if ((ret = open_audio_encoder(audio_codec_name, audio_bit_rate)) < 0 ||
+            (ret = add_output_stream(&out_audio_stream, audio_enc_ctx)) < 0)
+        {
+            return ret;
+        }
+    }
+
+    if (!(pkt = av_packet_alloc()) || !(frame = av_frame_alloc()) || !(enc_pkt = av_packet_alloc()))
+    {
+        return AVERROR(ENOMEM);
+    }
+
+    if ((ret = avformat_write_header(ofmt_ctx, NULL)) < 0)
+    {
+        fprintf(stderr, "Could not write output header (%s)\n", av_err2str(ret));
+        return ret;
+    }
+
+    audio_next_pts = AV_NOPTS_VALUE;
+    video_next_pts = 0;
+    input_start = fmt_ctx->start_time != AV_NOPTS_VALUE ? fmt_ctx->start_time : 0;
+    media_duration = fmt_ctx->duration;
+
+    return 0;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int transcode()
+{
+    int ret = 0;
+    int64_t started = av_gettime_relative();
+    double elapsed;
+
+    while (ret >= 0 && av_read_frame(fmt_ctx, pkt) >= 0)
+    {
+        if (video_stream && pkt->stream_index == video_stream->index)
+        {
+            ret = transcode_packet(video_dec_ctx, pkt);
+        }
+        else if (audio_stream && pkt->stream_index == audio_stream->index)
+        {
+            ret = transcode_packet(audio_dec_ctx, pkt);
+        }
+        av_packet_unref(pkt);
+    }
+
+    // flush decoders, resampler and encoders
+    if (ret >= 0 && video_stream && (ret = transcode_packet(video_dec_ctx, NULL)) >= 0)
+    {
+        ret = encode_write_frame(video_enc_ctx, out_video_stream, NULL);
+    }
+    if (ret >= 0 && audio_stream && (ret = transcode_packet(audio_dec_ctx, NULL)) >= 0 &&
+        (ret = transcode_audio_frame(NULL)) >= 0)
+    {
+        ret = encode_write_frame(audio_enc_ctx, out_audio_stream, NULL);
+    }
+    if (ret < 0)
+    {
+        return ret;
+    }
+
+    if ((ret = av_write_trailer(ofmt_ctx)) < 0)
+    {
+        return ret;
+    }
+    avio_flush(out_io_ctx);
+
+    elapsed = (av_gettime_relative() - started) / 1000000.0;
+    realtime_factor = elapsed > 0 ? (media_duration / (double)AV_TIME_BASE) / elapsed : 0;
+
+    return 0;
+}
+
+EMSCRIPTEN_KEEPALIVE
+uint8_t *get_output_data()
+{
+    return output ? output->data : NULL;
+}
+
+EMSCRIPTEN_KEEPALIVE
+size_t get_output_size()
+{
+    return output ? output->length : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE
+double get_realtime_factor()
+{
+    return realtime_factor;
+}
+
+EMSCRIPTEN_KEEPALIVE
+void close_transcoder()
+{
+    close_demuxer();
+    close_decoder();
+
+    avcodec_free_context(&video_enc_ctx);
+    avcodec_free_context(&audio_enc_ctx);
+    sws_freeContext(sws_ctx);
+    sws_ctx = NULL;
+    swr_free(&swr_ctx);
+    if (audio_fifo) av_audio_fifo_free(audio_fifo);
+    audio_fifo = NULL;
+    if (resample_data) av_freep(&resample_data[0]);
+    av_freep(&resample_data);
+    resample_capacity = 0;
+    av_frame_free(&video_enc_frame);
+    av_frame_free(&audio_enc_frame);
+    av_packet_free(&enc_pkt);
+
+    if (ofmt_ctx) avformat_free_context(ofmt_ctx);
+    ofmt_ctx = NULL;
+    out_video_stream = NULL;
+    out_audio_stream = NULL;
+    if (out_io_ctx)
+    {
+        av_freep(&out_io_ctx->buffer);
+        avio_context_free(&out_io_ctx);
+    }
+    memory_stream_free(&output);
+    output = NULL;
+    video_stream = NULL;
+    audio_stream = NULL;
+}
+
+/*************************************************/
+/*** native section ******************************/
+/*************************************************/
+#ifndef __EMSCRIPTEN__
+int main(int argc, char *argv[])
+{
+    int ret;
+    FILE *file;
+    uint8_t buffer[4096];
+    size_t bytes_read;
+
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: %s input_file output_file [format] [video_codec] [audio_codec] [width] [height]\n"
+                "Transcodes input_file in memory and writes the muxed result to output_file.\n"
+                "Codecs default to the container's, \"none\" drops the stream.\n",
+                argv[0]);
+        exit(1);
+    }
+
+    if ((ret = open_store()) != 0)
+    {
+        fprintf(stderr, "Could not allocate store\n");
+        return 1;
+    }
+    if (!(file = fopen(argv[1], "rb")))
+    {
+        fprintf(stderr, "Could not open source file %s\n", argv[1]);
+        return 1;
+    }
+    while ((bytes_read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    {
+        memory_stream_write(store, buffer, bytes_read);
+    }
+    fclose(file);
+
+    if ((ret = open_transcoder(argc > 3 ? argv[3] : "mp4", argc > 4 ? argv[4] : NULL, argc > 5 ? argv[5] : NULL,
+        argc > 6 ? atoi(argv[6]) : 0, argc > 7 ? atoi(argv[7]) : 0, 0, 0)) < 0)
+    {
+        fprintf(stderr, "Could not open transcoder (%s)\n", av_err2str(ret));
+        goto end;
+    }
+
+    if ((ret = transcode()) < 0)
+    {
+        fprintf(stderr, "Transcode failed (%s)\n", av_err2str(ret));
+        goto end;
+    }
+
+    if (!(file = fopen(argv[2], "wb")))
+    {
+        fprintf(stderr, "Could not open destination file %s\n", argv[2]);
+        ret = 1;
+        goto end;
+    }
+    fwrite(get_output_data(), 1, get_output_size(), file);
+    fclose(file);
+    printf("realtime factor: %.2f\n", get_realtime_factor());
+
+end:
+    close_transcoder();
+    close_store();
+    return ret < 0 ? 1 : 0;
+}
+#endif
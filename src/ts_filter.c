@@ -0,0 +1,272 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <libavutil/avutil.h>
+#include <libavutil/crc.h>
+#include <libavutil/bswap.h>
+
+#include "ts_filter.h"
+
+#define TS_PID_PAT 0x0000
+#define TS_PID_NULL 0x1FFF
+#define TS_TABLE_PAT 0x00
+#define TS_TABLE_PMT 0x02
+
+int ts_filter_create(TsFilter **ts_filter, int program)
+{
+  TsFilter *f;
+
+  if (!(f = calloc(1, sizeof(TsFilter))))
+  {
+    return AVERROR(ENOMEM);
+  }
+  f->program = program;
+  f->pmt_pid = -1;
+
+  *ts_filter = f;
+
+  return 0;
+}
+
+void ts_filter_free(TsFilter **ts_filter)
+{
+  free(*ts_filter);
+  *ts_filter = NULL;
+}
+
+int ts_filter_add_pid(TsFilter *ts_filter, int pid)
+{
+  if (pid <= TS_PID_PAT || pid >= TS_PID_NULL) return AVERROR(EINVAL);
+  if (ts_filter->nb_pids == TS_FILTER_MAX_PIDS) return AVERROR(ENOSPC);
+  ts_filter->pids[ts_filter->nb_pids++] = pid;
+  return 0;
+}
+
+static int packet_pid(const uint8_t *pkt)
+{
+  return ((pkt[1] & 0x1F) << 8) | pkt[2];
+}
+
+// offset of the payload in pkt, TS_PACKET_SIZE when there is none
+static int payload_offset(const uint8_t *pkt)
+{
+  int control = (pkt[3] >> 4) & 0x3;
+  if (!(control & 0x1)) return TS_PACKET_SIZE;
+  if (control == 0x3) return FFMIN(5 + pkt[4], TS_PACKET_SIZE);
+  return 4;
+}
+
+// put the payload of pkt into section, 1 once it is complete
+static int section_feed(TsSection *section, const uint8_t *pkt)
+{
+  int offset = payload_offset(pkt);
+  int size;
+
+  if (offset == TS_PACKET_SIZE) return 0;
+  if (pkt[1] & 0x40)
+  {
+    // a new section starts after the pointer field
+    offset += 1 + pkt[offset];
+    section->length = 0;
+    section->expected = 0;
+    if (offset + 3 > TS_PACKET_SIZE) return 0;
+    section->expected = 3 + (((pkt[offset + 1] & 0x0F) << 8) | pkt[offset + 2]);
+    section->single = offset + section->expected <= TS_PACKET_SIZE;
+    if (section->expected > TS_MAX_SECTION)
+    {
+      section->expected = 0;
+      return 0;
+    }
+  }
+  else if (!section->expected || section->length >= section->expected)
+  {
+    return 0;
+  }
+  size = FFMIN(TS_PACKET_SIZE - offset, section->expected - section->length);
+  memcpy(section->data + section->length, pkt + offset, size);
+  section->length += size;
+  return section->length == section->expected;
+}
+
+static int section_selects(TsFilter *f, int pid)
+{
+  if (!f->nb_pids) return 1;
+  for (int i = 0; i < f->nb_pids; i++)
+  {
+    if (f->pids[i] == pid) return 1;
+  }
+  return 0;
+}
+
+// 1 when the pat lists the selected program
+static int parse_pat(TsFilter *f)
+{
+  const uint8_t *d = f->pat.data;
+  int end = f->pat.length - 4;
+
+  if (d[0] != TS_TABLE_PAT || end < 8) return 0;
+  for (int i = 8; i + 4 <= end; i += 4)
+  {
+    int program = (d[i] << 8) | d[i + 1];
+    int pid = ((d[i + 2] & 0x1F) << 8) | d[i + 3];
+    // program 0 points to the network information table
+    if (!program || (f->program && program != f->program)) continue;
+    if (pid != f->pmt_pid)
+    {
+      // another pmt, nothing passes until it is read
+      memset(f->keep, 0, sizeof(f->keep));
+      f->pmt.expected = 0;
+    }
+    f->pmt_pid = pid;
+    f->program_found = program;
+    return 1;
+  }
+  return 0;
+}
+
+// 1 when it is the pmt of the selected program, other programs may share its pid
+static int parse_pmt(TsFilter *f)
+{
+  const uint8_t *d = f->pmt.data;
+  int end = f->pmt.length - 4;
+  int pcr_pid, i;
+
+  if (d[0] != TS_TABLE_PMT || end < 12 || ((d[3] << 8) | d[4]) != f->program_found) return 0;
+  memset(f->keep, 0, sizeof(f->keep));
+  pcr_pid = ((d[8] & 0x1F) << 8) | d[9];
+  if (pcr_pid != TS_PID_NULL) f->keep[pcr_pid] = 1;
+  for (i = 12 + (((d[10] & 0x0F) << 8) | d[11]); i + 5 <= end; i += 5 + (((d[i + 3] & 0x0F) << 8) | d[i + 4]))
+  {
+    int pid = ((d[i + 1] & 0x1F) << 8) | d[i + 2];
+    if (section_selects(f, pid)) f->keep[pid] = 1;
+  }
+  return 1;
+}
+
+// replace the payload of pkt by section, one whole section of length bytes
+static void write_section(uint8_t *pkt, int pid, uint8_t *section, int length)
+{
+  uint32_t crc;
+
+  // crc32 over the section as the demuxer checks it, big endian
+  crc = av_bswap32(av_crc(av_crc_get_table(AV_CRC_32_IEEE), -1, section, length - 4));
+  section[length - 4] = (crc >> 24) & 0xFF;
+  section[length - 3] = (crc >> 16) & 0xFF;
+  section[length - 2] = (crc >> 8) & 0xFF;
+  section[length - 1] = crc & 0xFF;
+
+  // payload only, the continuity counter stays
+  pkt[1] = 0x40 | (pid >> 8);
+  pkt[2] = pid & 0xFF;
+  pkt[3] = 0x10 | (pkt[3] & 0x0F);
+  pkt[4] = 0;
+  memcpy(pkt + 5, section, length);
+  memset(pkt + 5 + length, 0xFF, TS_PACKET_SIZE - 5 - length);
+}
+
+// the pat with the selected program alone
+static void rewrite_pat(TsFilter *f, uint8_t *pkt)
+{
+  uint8_t section[16];
+
+  memcpy(section, f->pat.data, 8);
+  section[1] = 0xB0;
+  section[2] = sizeof(section) - 3;
+  // one section of one
+  section[6] = 0;
+  section[7] = 0;
+  section[8] = f->program_found >> 8;
+  section[9] = f->program_found & 0xFF;
+  section[10] = 0xE0 | (f->pmt_pid >> 8);
+  section[11] = f->pmt_pid & 0xFF;
+  write_section(pkt, TS_PID_PAT, section, sizeof(section));
+}
+
+// the pmt with the selected elementary streams alone
+static void rewrite_pmt(TsFilter *f, uint8_t *pkt)
+{
+  uint8_t section[TS_PACKET_SIZE];
+  const uint8_t *d = f->pmt.data;
+  int end = f->pmt.length - 4;
+  int length = 12 + (((d[10] & 0x0F) << 8) | d[11]);
+  int i, size;
+
+  if (length > end) return;
+  memcpy(section, d, length);
+  for (i = length; i + 5 <= end; i += size)
+  {
+    size = 5 + (((d[i + 3] & 0x0F) << 8) | d[i + 4]);
+    if (i + size > end) break;
+    if (!section_selects(f, ((d[i + 1] & 0x1F) << 8) | d[i + 2])) continue;
+    memcpy(section + length, d + i, size);
+    length += size;
+  }
+  length += 4;
+  section[1] = (d[1] & 0xF0) | ((length - 3) >> 8);
+  section[2] = (length - 3) & 0xFF;
+  write_section(pkt, f->pmt_pid, section, length);
+}
+
+// whether pkt passes, rewriting it in place when it is a section the filter changes
+static int filter_packet(TsFilter *f, uint8_t *pkt)
+{
+  int pid = packet_pid(pkt);
+
+  if (pid == TS_PID_PAT)
+  {
+    if (section_feed(&f->pat, pkt) && parse_pat(f) && f->pat.single) rewrite_pat(f, pkt);
+    return 1;
+  }
+  if (pid == f->pmt_pid)
+  {
+    if (section_feed(&f->pmt, pkt) && parse_pmt(f) && f->pmt.single && f->nb_pids) rewrite_pmt(f, pkt);
+    return 1;
+  }
+  return f->keep[pid];
+}
+
+size_t ts_filter_apply(TsFilter *ts_filter, uint8_t *data, size_t size)
+{
+  TsFilter *f = ts_filter;
+  size_t total = f->carry_length + size;
+  size_t in = 0, out = 0;
+
+  memcpy(data, f->carry, f->carry_length);
+  f->carry_length = 0;
+
+  if (!f->synced && total)
+  {
+    // decided once, on the first bytes of the input
+    f->synced = 1;
+    f->passthrough = data[0] != TS_SYNC_BYTE || (total > TS_PACKET_SIZE && data[TS_PACKET_SIZE] != TS_SYNC_BYTE);
+  }
+  if (f->passthrough) return total;
+
+  while (in < total)
+  {
+    if (data[in] != TS_SYNC_BYTE || (in + TS_PACKET_SIZE < total && data[in + TS_PACKET_SIZE] != TS_SYNC_BYTE))
+    {
+      in++;
+      f->unsynced++;
+      continue;
+    }
+    if (total - in < TS_PACKET_SIZE)
+    {
+      f->carry_length = total - in;
+      memcpy(f->carry, data + in, f->carry_length);
+      break;
+    }
+    if (filter_packet(f, data + in))
+    {
+      if (out != in) memmove(data + out, data + in, TS_PACKET_SIZE);
+      out += TS_PACKET_SIZE;
+      f->kept++;
+    }
+    else
+    {
+      f->dropped++;
+    }
+    in += TS_PACKET_SIZE;
+  }
+  return out;
+}
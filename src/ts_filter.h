@@ -0,0 +1,70 @@
+#ifndef TS_FILTER_H
+#define TS_FILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TS_PACKET_SIZE 188
+#define TS_SYNC_BYTE 0x47
+#define TS_MAX_PIDS 8192
+// longest psi section, with its 3 byte header
+#define TS_MAX_SECTION 1024
+// elementary pids of the program a filter can be limited to
+#define TS_FILTER_MAX_PIDS 16
+
+// a pat or pmt section put together from the packets of its pid
+typedef struct TsSection
+{
+  uint8_t data[TS_MAX_SECTION];
+  int length;
+  // 3 + section_length, 0 while no section is started
+  int expected;
+  // whether the section fits the packet it starts in
+  int single;
+} TsSection;
+
+// drops the packets of an mpeg-ts input the demuxer would only throw away, before they
+// are stored. the pat is followed to the pmt of the selected program and only that
+// program's elementary streams, its pcr, the pat and its pmt pass. the pat is rewritten
+// to list the selected program alone, so the demuxer does not wait for the pmts of the
+// others, and the pmt to list only the selected streams when limited to some. sections
+// that span several packets are parsed but passed on as they are. works in place, a
+// packet split across writes is carried over to the next.
+typedef struct TsFilter
+{
+  // program_number kept, 0 for the first one of the pat
+  int program;
+  // elementary pids of it kept, all of them while nb_pids is 0
+  int pids[TS_FILTER_MAX_PIDS];
+  int nb_pids;
+  // from the pat, -1 until the program is found
+  int pmt_pid;
+  int program_found;
+  TsSection pat;
+  TsSection pmt;
+  // set for the pids of the program that pass, from its pmt
+  uint8_t keep[TS_MAX_PIDS];
+  // bytes of a packet split across writes
+  uint8_t carry[TS_PACKET_SIZE];
+  int carry_length;
+  // set at the first write, not ts input passes as it is
+  int synced;
+  int passthrough;
+  long kept;
+  long dropped;
+  // bytes skipped to find the sync byte again
+  long unsynced;
+} TsFilter;
+
+// program 0 selects the first program of the pat
+int ts_filter_create(TsFilter **ts_filter, int program);
+
+void ts_filter_free(TsFilter **ts_filter);
+
+// limit the program to the elementary stream pid, the pmt then lists only those added
+int ts_filter_add_pid(TsFilter *ts_filter, int pid);
+
+// filter size bytes written at data + carry_length in place, the carried bytes are put
+// in front first. returns how many bytes at data are left
+size_t ts_filter_apply(TsFilter *ts_filter, uint8_t *data, size_t size);
+#endif
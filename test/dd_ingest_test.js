@@ -0,0 +1,57 @@
+const { appendFileSync, readSync, openSync } = require("fs");
+
+const ffmpeg = require("../src/demux_decode.js");
+
+
+const input_file = "../data/xgplayer-demo-720p.mp4"
+const segment_output_file = "../result/xgplayer-demo-720p-recording.mp4";
+
+ffmpeg().then(async (instance)=>{
+  // show hello
+  instance._hello_wasm();
+
+  let vf = 0;
+  let af = 0;
+  let segments = 0;
+  const onOutputVideoFrameCallback = instance.addFunction(() => vf++, 'viiii');
+  const onOutputAudioFrameCallback = instance.addFunction(() => af++, 'vii');
+  const onSessionEventCallback = instance.addFunction((event, arg0, arg1, arg2) => console.log(`event:${event},${arg0},${arg1},${arg2}`), 'viiii');
+  const onSegment = (pos, size, isInit) => {
+    segments++;
+    appendFileSync(segment_output_file, instance.HEAPU8.subarray(pos, pos + size));
+  }
+
+  // one ingest, read by a session decoding for display and one remuxing to a recording (256)
+  const ingest = instance._dd_open_ingest();
+  const display = instance._open_dd(1, 0, onOutputVideoFrameCallback, onOutputAudioFrameCallback, onSessionEventCallback);
+  const recorder = instance._open_dd(1, 256, onOutputVideoFrameCallback, onOutputAudioFrameCallback, onSessionEventCallback);
+  instance._dd_set_segment_callback(recorder, instance.addFunction(onSegment, 'viii'));
+  console.log(`ingest display:${instance._dd_set_ingest(display, ingest)},recorder:${instance._dd_set_ingest(recorder, ingest)}`);
+
+  const buffer = new Uint8Array(409600);
+  let b;
+  const onWriteDD = (opaque, pos, size) => {
+    instance.writeArrayToMemory(b, pos);
+  }
+  const onWriteDDCallback = instance.addFunction(onWriteDD, 'viii');
+
+  const fd = openSync(input_file);
+  const feedData = () => {
+    setTimeout(()=>{
+      const bytesRead = readSync(fd, buffer, 0, buffer.length);
+      if (bytesRead == 0)
+      {
+        instance._dd_ingest_done(ingest);
+        return;
+      }
+      b = buffer.subarray(0, bytesRead);
+      instance._dd_write_ingest(ingest, b.length, onWriteDDCallback);
+      feedData();
+    }, 100)
+  }
+  feedData();
+
+  // 15: KB of the ingest a session has not read yet, the ingest holds the largest of them
+  const started = Date.now();
+  setInterval(()=>console.log(`remain main thread, ${Date.now() - started}ms, heap:${instance._dd_heap_used()}, video:${vf}, audio:${af}, segments:${segments}, lag display:${instance._dd_get_stat(display, 15)}KB recorder:${instance._dd_get_stat(recorder, 15)}KB`), 1000);
+});
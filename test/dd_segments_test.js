@@ -0,0 +1,79 @@
+const { readFileSync } = require("fs");
+const path = require("path");
+
+const ffmpeg = require("../src/demux_decode.js");
+
+
+// a local hls rendition, the playlist and its segments side by side
+const playlist_file = process.argv[2] || "../data/hls/index.m3u8";
+
+// media sequence, flags and duration of every segment in the playlist, init sections as they come
+const parsePlaylist = (text) => {
+  const segments = [];
+  let sequence = 0;
+  let duration = 0;
+  let discontinuity = false;
+  for (const line of text.split(/\r?\n/).map(l => l.trim()).filter(l => l))
+  {
+    if (line.startsWith("#EXT-X-MEDIA-SEQUENCE:")) sequence = parseInt(line.split(":")[1]);
+    else if (line.startsWith("#EXTINF:")) duration = parseFloat(line.split(":")[1]);
+    else if (line == "#EXT-X-DISCONTINUITY") discontinuity = true;
+    else if (line.startsWith("#EXT-X-MAP:")) segments.push({ uri: /URI="([^"]+)"/.exec(line)[1], sequence, flags: 1, duration: 0 });
+    else if (!line.startsWith("#"))
+    {
+      // 2: DD_SEGMENT_DISCONTINUITY
+      segments.push({ uri: line, sequence: sequence++, flags: discontinuity ? 2 : 0, duration: duration * 1000 });
+      discontinuity = false;
+    }
+  }
+  return segments;
+}
+
+ffmpeg().then(async (instance)=>{
+  // show hello
+  instance._hello_wasm();
+
+  let vf = 0;
+  let af = 0;
+  const onOutputVideoFrameCallback = instance.addFunction(() => vf++, 'viiii');
+  const onOutputAudioFrameCallback = instance.addFunction(() => af++, 'vii');
+  const onSessionEventCallback = instance.addFunction((event, arg0, arg1, arg2) => console.log(`event:${event},${arg0},${arg1},${arg2}`), 'viiii');
+
+  // DD_INPUT_SEGMENTS (65536)
+  const session = instance._open_dd(1, 65536, onOutputVideoFrameCallback, onOutputAudioFrameCallback, onSessionEventCallback);
+  const segments = parsePlaylist(readFileSync(playlist_file, "utf8"));
+  const media = segments.filter(s => !(s.flags & 1));
+  console.log(`segments:${media.length}, playlist:${instance._dd_set_segment_playlist(session, media.length ? media[0].sequence : -1, 0)}`);
+
+  let b;
+  const onWriteDDCallback = instance.addFunction((opaque, pos, size) => instance.writeArrayToMemory(b, pos), 'viii');
+
+  // downloads finish out of order, every pair of media segments is swapped, init sections stay in place
+  const order = [];
+  for (let i = 0; i < segments.length; i++)
+  {
+    if (!(segments[i].flags & 1) && i + 1 < segments.length && !(segments[i + 1].flags & 1))
+    {
+      order.push(segments[i + 1], segments[i]);
+      i++;
+    }
+    else order.push(segments[i]);
+  }
+  const feedData = (index) => {
+    setTimeout(()=>{
+      if (index == order.length)
+      {
+        instance._write_is_done(session);
+        return;
+      }
+      const segment = order[index];
+      b = readFileSync(path.join(path.dirname(playlist_file), segment.uri));
+      instance._dd_write_segment(session, segment.sequence, segment.flags, segment.duration, b.length, onWriteDDCallback);
+      feedData(index + 1);
+    }, 100)
+  }
+  feedData(0);
+
+  const started = Date.now();
+  setInterval(()=>console.log(`remain main thread, ${Date.now() - started}ms, heap:${instance._dd_heap_used()}, video:${vf}, audio:${af}`), 1000);
+});
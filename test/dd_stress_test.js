@@ -0,0 +1,61 @@
+const { readSync, openSync } = require("fs");
+
+const ffmpeg = require("../src/demux_decode.js");
+
+
+const input_file = "../data/xgplayer-demo-720p.mp4"
+const rounds = 5000;
+const feed_size = 64 * 1024;
+// allowed heap growth between the warm-up round and the last round
+const max_heap_growth = 1024 * 1024;
+
+ffmpeg().then(async (instance)=>{
+  // show hello
+  instance._hello_wasm();
+
+  // frames are ignored, we only care about open/close
+  const onOutputVideoFrameCallback = instance.addFunction(() => {}, 'viiii');
+  const onOutputAudioFrameCallback = instance.addFunction(() => {}, 'vii');
+  const onSessionEventCallback = instance.addFunction(() => {}, 'viiii');
+
+  // a partial head of the input keeps the demux thread parked in the read callback
+  const buffer = new Uint8Array(feed_size);
+  const fd = openSync(input_file);
+  const bytesRead = readSync(fd, buffer, 0, buffer.length, 0);
+  const b = buffer.subarray(0, bytesRead);
+  const onWriteDD = (opaque, pos, size) => {
+    instance.writeArrayToMemory(b, pos);
+  }
+  const onWriteDDCallback = instance.addFunction(onWriteDD, 'viii');
+
+  let baseline = 0;
+  let timeouts = 0;
+  const started = Date.now();
+  for (let i = 0; i < rounds; i++)
+  {
+    // alternate stream and file mode, they block in different callbacks
+    const session = instance._open_dd(i % 2, 0, onOutputVideoFrameCallback, onOutputAudioFrameCallback, onSessionEventCallback);
+    if (!session) throw new Error(`open_dd failed at round ${i}`);
+    instance._write_dd(session, b.length, onWriteDDCallback);
+    if (instance._close_dd(session) != 0) timeouts++;
+
+    if (i == 100) baseline = instance._dd_heap_used();
+    if (i % 500 == 0)
+    {
+      console.log(`round:${i},heap:${instance._dd_heap_used()},sessions:${instance._dd_live_sessions()}`);
+    }
+  }
+  const elapsed = Date.now() - started;
+
+  instance._drain_dd_pool();
+  const growth = instance._dd_heap_used() - baseline;
+  console.log(`${rounds} rounds in ${elapsed}ms, ${(elapsed / rounds).toFixed(2)}ms per switch`);
+  console.log(`close timeouts:${timeouts},heap growth:${growth},sessions left:${instance._dd_live_sessions()}`);
+
+  if (timeouts > 0 || growth > max_heap_growth || instance._dd_live_sessions() != 0)
+  {
+    console.error("stress test failed");
+    process.exit(1);
+  }
+  process.exit(0);
+});
@@ -1,4 +1,4 @@
-const { appendFileSync, readSync, openSync } = require("fs");
+const { appendFileSync, writeFileSync, readSync, openSync } = require("fs");
 
 const ffmpeg = require("../src/demux_decode.js");
 
@@ -6,6 +6,26 @@ const ffmpeg = require("../src/demux_decode.js");
 const input_file = "../data/xgplayer-demo-720p.mp4"
 const video_output_file = "../result/xgplayer-demo-720p-video";
 const audio_output_file = "../result/xgplayer-demo-720p-audio";
+const segment_output_file = "../result/xgplayer-demo-720p-fmp4.mp4";
+const thumbnail_output_dir = "../result/";
+// 1: video only, 2: audio only, 3 or 0: both, add 256 to remux to fragmented mp4 instead of decoding,
+// 512 to receive compressed packets instead of decoding, 1024 for 5x5 jpeg sprite sheets of a thumbnail every 2s
+const flags = Number(process.argv[2] || 3);
+// optional stream index to switch to once the streams are known
+const switch_to = process.argv[3] === undefined ? -1 : Number(process.argv[3]);
+// optional renditions every video frame is scaled to as well, e.g. 640x360,320x-1 (yuv420p)
+const renditions = (process.argv[4] || "").split(",").filter(r => r).map(r => r.split("x").map(Number));
+// optional pacing clock, 1: audio, 2: wall. frames then come with timestamps
+const clock = Number(process.argv[5] || 0);
+// optional ms to scrub back to twice while playing, the second seek should hit the frame cache
+const scrub_to = process.argv[6] === undefined ? -1 : Number(process.argv[6]);
+// optional playback rate switched to after 50 video frames, e.g. 8 or -1 to play backwards
+const rate = Number(process.argv[7] || 1);
+// optional seconds of timeshift, the input is then fed as a live stream, paused at 100
+// video frames for 2s and rewound by 5s on resume
+const timeshift = Number(process.argv[8] || 0);
+// optional jitter buffer target in ms, the input is then fed as a live stream in bursts
+const jitter = Number(process.argv[9] || 0);
 
 ffmpeg().then(async (instance)=>{
   // show hello
@@ -19,6 +39,17 @@ ffmpeg().then(async (instance)=>{
   
   const onOutputVideoFrame = (pos, size, width, height) => {
     console.log(`video_frames:${vf++},size:${size}`);
+    if (scrub_to >= 0 && (vf == 100 || vf == 200)) console.log(`seek:${instance._dd_seek(session, scrub_to)}`);
+    if (rate != 1 && vf == 50) console.log(`rate:${instance._dd_set_playback_rate(session, rate, 0)}`);
+    if (timeshift && vf == 100)
+    {
+      console.log(`pause:${instance._dd_pause(session, 1)}`);
+      setTimeout(() => {
+        const end = instance._dd_get_stat(session, 13);
+        console.log(`timeshift:${instance._dd_get_stat(session, 12)}-${end}ms,${instance._dd_get_stat(session, 14)}KB`);
+        console.log(`seek:${instance._dd_seek(session, Math.max(end - 5000, 0))},resume:${instance._dd_pause(session, 0)}`);
+      }, 2000);
+    }
     console.log(`${width}x${height}`);
     const view = instance.HEAPU8;
     const buffer = view.subarray(pos, pos + size);
@@ -35,9 +66,94 @@ ffmpeg().then(async (instance)=>{
   const onOutputVideoFrameCallback = instance.addFunction(onOutputVideoFrame, 'viiii');
   const onOutputAudioFrameCallback = instance.addFunction(onOutputAudioFrame, 'vii');
 
+  const onStreamInfo = (index, type, codec, language, title, arg0, arg1, active) => {
+    const name = `${instance.UTF8ToString(codec)} ${instance.UTF8ToString(language)} ${instance.UTF8ToString(title)}`;
+    console.log(`stream:${index},type:${type},${name},${arg0}x${arg1}${active ? ' active' : ''}`);
+  }
+  const onStreamInfoCallback = instance.addFunction(onStreamInfo, 'viiiiiiii');
+
+  // 1: video format changed (width, height, pix_fmt), 2: audio format changed (sample_rate, channels, sample_fmt)
+  // 3: streams ready (count), 4: track switched (type, index, error), 5: filters configured (type, error)
+  let session = 0;
+  const onSessionEvent = (event, arg0, arg1, arg2) => {
+    console.log(`event:${event},${arg0},${arg1},${arg2}`);
+    if (event == 3)
+    {
+      for (let i = 0; i < arg0; i++) instance._dd_get_stream_info(session, i, onStreamInfoCallback);
+      if (switch_to >= 0) console.log(`select stream: ${instance._dd_select_stream(session, switch_to)}`);
+    }
+  }
+  const onSessionEventCallback = instance.addFunction(onSessionEvent, 'viiii');
+
   // open demux_decode
-  const ret = instance._open_dd(0, onOutputVideoFrameCallback, onOutputAudioFrameCallback);
-  console.log(ret);
+  session = instance._open_dd(timeshift || jitter ? 1 : 0, flags, onOutputVideoFrameCallback, onOutputAudioFrameCallback, onSessionEventCallback);
+  console.log(session);
+
+  const onSegment = (pos, size, isInit) => {
+    console.log(`segment:${isInit ? 'init' : 'media'},size:${size}`);
+    appendFileSync(segment_output_file, instance.HEAPU8.subarray(pos, pos + size));
+  }
+  instance._dd_set_segment_callback(session, instance.addFunction(onSegment, 'viii'));
+
+  const onCodecConfig = (index, type, codec, extradata, size, arg0, arg1) => {
+    console.log(`codec_config:${index},type:${type},${instance.UTF8ToString(codec)},extradata:${size},${arg0}x${arg1}`);
+  }
+  // PacketRecord: int32 stream_index, int32 flags, int64 pts, dts, duration (us), int32 offset, int32 size
+  let packets = 0;
+  let keyframes = 0;
+  const onPackets = (records, count, payload, size) => {
+    const view = new DataView(instance.HEAPU8.buffer, records, count * 40);
+    for (let i = 0; i < count; i++)
+    {
+      if (view.getInt32(i * 40 + 4, true) & 1) keyframes++;
+    }
+    packets += count;
+    console.log(`packets:${packets},batch:${count},bytes:${size},keyframes:${keyframes},pts:${view.getBigInt64(8, true)}`);
+  }
+  instance._dd_set_packet_callback(session, instance.addFunction(onCodecConfig, 'viiiiiii'), instance.addFunction(onPackets, 'viiii'), 0);
+
+  const onThumbnail = (index, pos, size, pts) => {
+    console.log(`thumbnail image:${index},size:${size},pts:${pts}`);
+    writeFileSync(`${thumbnail_output_dir}sheet_${index}.jpg`, instance.HEAPU8.subarray(pos, pos + size));
+  }
+  const onThumbnailMap = (vtt, size) => {
+    console.log(`thumbnail map:${size} bytes`);
+    writeFileSync(`${thumbnail_output_dir}thumbnails.vtt`, instance.UTF8ToString(vtt, size));
+  }
+  // AV_CODEC_ID_MJPEG is 7
+  instance._dd_set_thumbnails(session, 2000, 160, -1, 5, 5, 7, 0, instance.addFunction(onThumbnail, 'viiid'), instance.addFunction(onThumbnailMap, 'vii'));
+
+  const onRenditionFrame = (index, pos, size, width, height) => {
+    console.log(`rendition:${index},${width}x${height},size:${size}`);
+  }
+  const onRenditionFrameCallback = instance.addFunction(onRenditionFrame, 'viiiii');
+  for (const [width, height] of renditions)
+  {
+    console.log(`rendition added: ${instance._dd_add_rendition(session, width, height, 0, onRenditionFrameCallback)}`);
+  }
+
+  if (timeshift) console.log(`timeshift:${instance._dd_set_timeshift(session, timeshift, 0)}`);
+  if (jitter) console.log(`jitter:${instance._dd_set_jitter_buffer(session, jitter)}`);
+
+  // keep 200ms of audio ahead, video degrades first
+  instance._dd_set_min_audio_buffer(session, 200);
+
+  // 64MB of decoded frames for scrubbing, whole gops
+  instance._dd_set_frame_cache(session, 64, 1);
+
+  if (clock)
+  {
+    const onTimedVideoFrame = (pos, size, width, height, pts, duration) => {
+      console.log(`video pts:${pts.toFixed(1)},duration:${duration.toFixed(1)}`);
+      onOutputVideoFrame(pos, size, width, height);
+    }
+    const onTimedAudioFrame = (pos, size, pts, duration) => {
+      console.log(`audio pts:${pts.toFixed(1)},duration:${duration.toFixed(1)}`);
+      onOutputAudioFrame(pos, size);
+    }
+    instance._dd_set_timed_frame_callbacks(session, instance.addFunction(onTimedVideoFrame, 'viiiidd'), instance.addFunction(onTimedAudioFrame, 'viidd'));
+    instance._dd_set_pacing(session, clock, 500);
+  }
 
   // feed data
   
@@ -55,15 +171,17 @@ ffmpeg().then(async (instance)=>{
       bytesRead = readSync(fd, buffer, 0, buffer.length);
       if (bytesRead == 0)
       {
-        instance._write_is_done();
+        instance._write_is_done(session);
         return;
       }
       b = buffer.subarray(0, bytesRead);
-      instance._write_dd(b.length, onWriteDDCallback);
+      instance._write_dd(session, b.length, onWriteDDCallback);
       feedData();
-    }, 100)
+    }, jitter ? Math.random() * 200 : 100)
   }
   feedData();
 
-  setInterval(()=>console.log('remain main thread'), 1000);
+  // compare heap and frame counts across track modes
+  const started = Date.now();
+  setInterval(()=>console.log(`remain main thread, ${Date.now() - started}ms, heap:${instance._dd_heap_used()}, audio buffered:${instance._dd_get_stat(session, 1)}ms, underruns:${instance._dd_get_stat(session, 2)}, late:${instance._dd_get_stat(session, 6)}, cache hits:${instance._dd_get_stat(session, 7)}/${instance._dd_get_stat(session, 8)}, jitter:${instance._dd_get_stat(session, 16)}ms late:${instance._dd_get_stat(session, 17)} reordered:${instance._dd_get_stat(session, 18)} discontinuities:${instance._dd_get_stat(session, 19)}`), 1000);
 });
\ No newline at end of file
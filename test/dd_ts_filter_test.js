@@ -0,0 +1,50 @@
+const { readSync, openSync } = require("fs");
+
+const ffmpeg = require("../src/demux_decode.js");
+
+
+// a multi program transport stream, the program to play (0 for the first one) and
+// optionally the pids of it to keep, e.g. 256,257
+const input_file = process.argv[2] || "../data/multi-program.ts";
+const program = Number(process.argv[3] || 0);
+const pids = (process.argv[4] || "").split(",").filter(p => p).map(Number);
+
+ffmpeg().then(async (instance)=>{
+  // show hello
+  instance._hello_wasm();
+
+  let vf = 0;
+  let af = 0;
+  const onOutputVideoFrameCallback = instance.addFunction(() => vf++, 'viiii');
+  const onOutputAudioFrameCallback = instance.addFunction(() => af++, 'vii');
+  const onSessionEventCallback = instance.addFunction((event, arg0, arg1, arg2) => console.log(`event:${event},${arg0},${arg1},${arg2}`), 'viiii');
+
+  const session = instance._open_dd(1, 0, onOutputVideoFrameCallback, onOutputAudioFrameCallback, onSessionEventCallback);
+  console.log(`ts filter:${instance._dd_set_ts_filter(session, program)}`);
+  for (const pid of pids) console.log(`pid ${pid}:${instance._dd_add_ts_pid(session, pid)}`);
+
+  // odd sized writes, packets are split across them
+  const buffer = new Uint8Array(100000);
+  let b;
+  const onWriteDDCallback = instance.addFunction((opaque, pos, size) => instance.writeArrayToMemory(b, pos), 'viii');
+
+  const fd = openSync(input_file);
+  const feedData = () => {
+    setTimeout(()=>{
+      const bytesRead = readSync(fd, buffer, 0, buffer.length);
+      if (bytesRead == 0)
+      {
+        instance._write_is_done(session);
+        return;
+      }
+      b = buffer.subarray(0, bytesRead);
+      instance._write_dd(session, b.length, onWriteDDCallback);
+      feedData();
+    }, 50)
+  }
+  feedData();
+
+  // 20: ts packets kept, 21: dropped
+  const started = Date.now();
+  setInterval(()=>console.log(`remain main thread, ${Date.now() - started}ms, heap:${instance._dd_heap_used()}, video:${vf}, audio:${af}, ts kept:${instance._dd_get_stat(session, 20)}, dropped:${instance._dd_get_stat(session, 21)}`), 1000);
+});
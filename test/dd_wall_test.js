@@ -0,0 +1,75 @@
+const { writeFileSync, readSync, openSync } = require("fs");
+
+const ffmpeg = require("../src/demux_decode.js");
+
+
+const input_file = "../data/xgplayer-demo-720p.mp4"
+const wall_output_file = "../result/xgplayer-demo-720p-wall.yuv";
+// inputs on the wall, all of them the same file, up to 25
+const inputs = Number(process.argv[2] || 4);
+const columns = Math.ceil(Math.sqrt(inputs));
+const rows = Math.ceil(inputs / columns);
+const feed_size = 409600;
+
+ffmpeg().then(async (instance)=>{
+  // show hello
+  instance._hello_wasm();
+
+  let frames = 0;
+  const onFrameComposed = (pos, size, width, height) => {
+    if (frames++ % 25 == 0) console.log(`wall frames:${frames},${width}x${height},size:${size}`);
+    // the last one is kept, yuv420p
+    writeFileSync(wall_output_file, instance.HEAPU8.subarray(pos, pos + size));
+  }
+  // 1280x720 yuv420p (0) at 25 fps
+  const wall = instance._dd_open_wall(1280, 720, 0, columns, rows, 25, instance.addFunction(onFrameComposed, 'viiii'));
+  console.log(`wall:${wall},${columns}x${rows}`);
+
+  const onOutputVideoFrameCallback = instance.addFunction(() => {}, 'viiii');
+  const onOutputAudioFrameCallback = instance.addFunction(() => {}, 'vii');
+  const onSessionEventCallback = instance.addFunction(() => {}, 'viiii');
+
+  const sessions = [];
+  for (let i = 0; i < inputs; i++)
+  {
+    // video only, paced so a lagging input drops late frames
+    const session = instance._open_dd(0, 1, onOutputVideoFrameCallback, onOutputAudioFrameCallback, onSessionEventCallback);
+    console.log(`tile:${i},${instance._dd_set_wall_tile(session, wall, i)}`);
+    instance._dd_set_pacing(session, 2, 500);
+    sessions.push({ session, fd: openSync(input_file), buffer: new Uint8Array(feed_size), done: false });
+  }
+
+  let b;
+  const onWriteDD = (opaque, pos, size) => {
+    instance.writeArrayToMemory(b, pos);
+  }
+  const onWriteDDCallback = instance.addFunction(onWriteDD, 'viii');
+
+  const feedData = () => {
+    setTimeout(()=>{
+      let done = 0;
+      for (const input of sessions)
+      {
+        if (input.done) { done++; continue; }
+        const bytesRead = readSync(input.fd, input.buffer, 0, input.buffer.length);
+        if (bytesRead == 0)
+        {
+          instance._write_is_done(input.session);
+          input.done = true;
+          continue;
+        }
+        b = input.buffer.subarray(0, bytesRead);
+        instance._write_dd(input.session, b.length, onWriteDDCallback);
+      }
+      if (done < sessions.length) feedData();
+    }, 100)
+  }
+  feedData();
+
+  // 1: composed, 2: dropped, 3: repeated
+  const started = Date.now();
+  setInterval(()=>{
+    const tiles = sessions.map((_, i) => [1, 2, 3].map(stat => instance._dd_get_wall_stat(wall, i, stat)).join('/'));
+    console.log(`remain main thread, ${Date.now() - started}ms, heap:${instance._dd_heap_used()}, tiles composed/dropped/repeated: ${tiles.join(' ')}`);
+  }, 1000);
+});